@@ -0,0 +1,283 @@
+#include "debugger.h"
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+#include "mem.h"
+#include "spdlog/spdlog.h"
+#include "symbolindex.h"
+#include "sys/ptrace.h"
+#include "sys/wait.h"
+#include "syscallCounter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The median of the rounds is reported, which the outliers do not move
+constexpr unsigned rounds = 5;
+
+struct Result {
+  std::string name;
+  std::size_t ops;
+  double nanosecondsPerOp;
+  double syscallsPerOp;
+  std::size_t bytesPerOp = 0; /**< to report a throughput, 0 if not relevant */
+};
+
+/**
+ * @brief Time `rounds` rounds of `ops` calls of `op`
+ *
+ * @param setup run before each round, neither timed nor counted
+ * @return Result the median round
+ */
+Result measure(const std::string &name,
+               std::size_t ops,
+               const std::function<void()> &setup,
+               const std::function<void()> &op) {
+  std::vector<Result> results;
+  for (unsigned round = 0; round < rounds; ++round) {
+    setup();
+    auto syscalls = getSyscallCounts().total();
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < ops; ++i) {
+      op();
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    syscalls = getSyscallCounts().total() - syscalls;
+    results.push_back(Result{name, ops, elapsed.count() / ops, static_cast<double>(syscalls) / ops});
+  }
+  std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) {
+    return a.nanosecondsPerOp < b.nanosecondsPerOp;
+  });
+  return results[rounds / 2];
+}
+
+void printHeader(std::ostream &report) {
+  report << fmt::format("{:<34} {:>8} {:>14} {:>12} {:>10}\n", "benchmark", "ops", "ns/op", "syscalls/op", "MB/s");
+}
+
+void print(std::ostream &report, const Result &result) {
+  auto throughput = result.bytesPerOp ? fmt::format("{:.1f}", result.bytesPerOp * 1e3 / result.nanosecondsPerOp) : "";
+  report << fmt::format("{:<34} {:>8} {:>14.1f} {:>12.2f} {:>10}\n",
+                        result.name,
+                        result.ops,
+                        result.nanosecondsPerOp,
+                        result.syscallsPerOp,
+                        throughput)
+         << std::flush;
+}
+
+/**
+ * @brief Fork and trace the benchmark target, `Debugger::start` waits
+ * for its exec
+ *
+ */
+pid_t launch() {
+  auto pid = fork();
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    execl(BENCH_TARGET, BENCH_TARGET, nullptr);
+    _exit(127);
+  }
+  return pid;
+}
+
+void killTarget(pid_t pid) {
+  kill(pid, SIGKILL);
+  int waitStatus;
+  while (waitpid(pid, &waitStatus, __WALL) != -1 && !WIFEXITED(waitStatus) && !WIFSIGNALED(waitStatus)) {
+  }
+}
+
+/**
+ * @brief A `cont` from a breakpoint to the next hit of the same one
+ *
+ */
+void benchBreakpoint(std::ostream &report) {
+  auto pid = launch();
+  {
+    Debugger debugger{BENCH_TARGET, pid};
+    debugger.start();
+    debugger.execute("break tick");
+    debugger.execute("cont");
+    print(report, measure("breakpoint round trip", 1000, [] {}, [&debugger] { debugger.execute("cont"); }));
+  }
+  killTarget(pid);
+}
+
+void benchSingleStep(std::ostream &report) {
+  auto pid = launch();
+  {
+    Debugger debugger{BENCH_TARGET, pid};
+    debugger.start();
+    debugger.execute("break tick");
+    debugger.execute("cont");
+    print(report, measure("stepi", 5000, [] {}, [&debugger] { debugger.execute("stepi"); }));
+  }
+  killTarget(pid);
+}
+
+/**
+ * @brief `step` or `next` through the generated lines of `large`, every
+ * round starts again at its breakpoint
+ *
+ */
+void benchLineStep(std::ostream &report, const std::string &command) {
+  auto pid = launch();
+  {
+    Debugger debugger{BENCH_TARGET, pid};
+    debugger.start();
+    debugger.execute("break large");
+    auto setup = [&debugger] { debugger.execute("cont"); };
+    auto op = [&debugger, &command] { debugger.execute(command); };
+    print(report, measure(command + " in a large function", 200, setup, op));
+  }
+  killTarget(pid);
+}
+
+/**
+ * @brief Build the index of the binary with the generated units, then
+ * look up PCs spread over its text with a fixed seed
+ *
+ */
+void benchLookups(std::ostream &report, bool lazy) {
+  auto fd = open(BENCH_UNITS, O_RDONLY);
+  if (fd == -1) {
+    spdlog::error("Cannot open {}", BENCH_UNITS);
+    return;
+  }
+  elf::elf elf{elf::create_mmap_loader(fd)};
+  dwarf::dwarf dwarf{dwarf::elf::create_loader(elf)};
+  close(fd);
+
+  IndexOptions options;
+  options.lazy = lazy;
+  auto mode = lazy ? " (lazy)" : "";
+  SymbolIndex index;
+  auto build = [&] { index = SymbolIndex{dwarf, elf, options, nullptr}; };
+  print(report, measure(fmt::format("index build{}", mode), 1, [] {}, build));
+
+  uint64_t low = 0;
+  uint64_t high = 0;
+  for (const auto &section : elf.sections()) {
+    if (section.get_name() == ".text") {
+      low = section.get_hdr().addr;
+      high = low + section.get_hdr().size;
+    }
+  }
+  if (low == high) {
+    spdlog::error("{} has no text", BENCH_UNITS);
+    return;
+  }
+  std::vector<uint64_t> pcs(4096);
+  uint64_t state = 42;
+  for (auto &pc : pcs) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    pc = low + (state >> 33) % (high - low);
+  }
+
+  std::size_t next = 0;
+  auto findLine = [&] { index.findLineEntry(pcs[next++ % pcs.size()]); };
+  auto findFunction = [&] { index.findFunction(pcs[next++ % pcs.size()]); };
+  print(report, measure(fmt::format("getLineEntryFromPC{}", mode), pcs.size(), [] {}, findLine));
+  print(report, measure(fmt::format("getFunctionFromPC{}", mode), pcs.size(), [] {}, findFunction));
+}
+
+/**
+ * @brief Read the largest readable mapping of the target, stopped once
+ * its libraries are loaded
+ *
+ */
+void benchMemory(std::ostream &report) {
+  auto pid = launch();
+  {
+    Debugger debugger{BENCH_TARGET, pid};
+    debugger.start();
+    debugger.execute("break tick");
+    debugger.execute("cont");
+
+    Memory memory{pid};
+    memory.selectThread(pid);
+    Mapping largest{};
+    for (const auto &mapping : memory.getMappings()) {
+      if (!mapping.permissions.empty() && mapping.permissions[0] == 'r' &&
+          mapping.high - mapping.low > largest.high - largest.low) {
+        largest = mapping;
+      }
+    }
+
+    std::vector<uint8_t> buffer(1 << 20);
+    for (std::size_t size : {std::size_t{8}, std::size_t{4096}, buffer.size()}) {
+      size = std::min<std::size_t>(size, largest.high - largest.low);
+      auto read = [&] { memory.readBlock(largest.low, buffer.data(), size); };
+      auto result = measure(fmt::format("readBlock {} bytes", size), size < buffer.size() ? 5000 : 100, [] {}, read);
+      result.bytesPerOp = size;
+      print(report, result);
+    }
+    auto result = measure("readMemory", 5000, [] {}, [&] { memory.readMemory(largest.low); });
+    result.bytesPerOp = sizeof(uint64_t);
+    print(report, result);
+  }
+  killTarget(pid);
+}
+
+}  // namespace
+
+/**
+ * @brief Run the benchmarks whose group contains one of the arguments,
+ * all of them without arguments
+ *
+ * @details Groups: breakpoint, stepi, step, next, lookup, memory.
+ *
+ */
+int main(int argc, char *argv[]) {
+  spdlog::set_level(spdlog::level::warn);
+  // The source printed by the stepping commands is not measured output
+  std::ostream report{std::cout.rdbuf()};
+  std::ofstream devNull{"/dev/null"};
+  std::cout.rdbuf(devNull.rdbuf());
+
+  auto selected = [argc, argv](const std::string &group) {
+    if (argc < 2) {
+      return true;
+    }
+    for (int i = 1; i < argc; ++i) {
+      if (group.find(argv[i]) != std::string::npos) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  printHeader(report);
+  if (selected("breakpoint")) {
+    benchBreakpoint(report);
+  }
+  if (selected("stepi")) {
+    benchSingleStep(report);
+  }
+  if (selected("step")) {
+    benchLineStep(report, "step");
+  }
+  if (selected("next")) {
+    benchLineStep(report, "next");
+  }
+  if (selected("lookup")) {
+    benchLookups(report, false);
+    benchLookups(report, true);
+  }
+  if (selected("memory")) {
+    benchMemory(report);
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "syscallCounter.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+SyscallCounts counts;
+
+}  // namespace
+
+const SyscallCounts &getSyscallCounts() { return counts; }
+
+// The linker sends the calls of the debugger here, `__real_` is the libc
+extern "C" {
+
+long __real_ptrace(enum __ptrace_request request, ...);
+pid_t __real_waitpid(pid_t pid, int *status, int options);
+ssize_t __real_process_vm_readv(pid_t pid,
+                                const iovec *local,
+                                unsigned long localCount,
+                                const iovec *remote,
+                                unsigned long remoteCount,
+                                unsigned long flags);
+ssize_t __real_process_vm_writev(pid_t pid,
+                                 const iovec *local,
+                                 unsigned long localCount,
+                                 const iovec *remote,
+                                 unsigned long remoteCount,
+                                 unsigned long flags);
+ssize_t __real_pread(int fd, void *buffer, size_t count, off_t offset);
+ssize_t __real_pwrite(int fd, const void *buffer, size_t count, off_t offset);
+int __real_kill(pid_t pid, int signal);
+long __real_syscall(long number, ...);
+
+long __wrap_ptrace(enum __ptrace_request request, ...) {
+  // Every request takes a pid, an address and a data word
+  va_list args;
+  va_start(args, request);
+  auto pid = va_arg(args, pid_t);
+  auto address = va_arg(args, void *);
+  auto data = va_arg(args, void *);
+  va_end(args);
+  ++counts.ptrace;
+  return __real_ptrace(request, pid, address, data);
+}
+
+pid_t __wrap_waitpid(pid_t pid, int *status, int options) {
+  ++counts.waitpid;
+  return __real_waitpid(pid, status, options);
+}
+
+ssize_t __wrap_process_vm_readv(pid_t pid,
+                                const iovec *local,
+                                unsigned long localCount,
+                                const iovec *remote,
+                                unsigned long remoteCount,
+                                unsigned long flags) {
+  ++counts.memory;
+  return __real_process_vm_readv(pid, local, localCount, remote, remoteCount, flags);
+}
+
+ssize_t __wrap_process_vm_writev(pid_t pid,
+                                 const iovec *local,
+                                 unsigned long localCount,
+                                 const iovec *remote,
+                                 unsigned long remoteCount,
+                                 unsigned long flags) {
+  ++counts.memory;
+  return __real_process_vm_writev(pid, local, localCount, remote, remoteCount, flags);
+}
+
+ssize_t __wrap_pread(int fd, void *buffer, size_t count, off_t offset) {
+  ++counts.memory;
+  return __real_pread(fd, buffer, count, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buffer, size_t count, off_t offset) {
+  ++counts.memory;
+  return __real_pwrite(fd, buffer, count, offset);
+}
+
+int __wrap_kill(pid_t pid, int signal) {
+  ++counts.signal;
+  return __real_kill(pid, signal);
+}
+
+long __wrap_syscall(long number, ...) {
+  ++counts.syscall;
+  // Reading more arguments than the caller passed is undefined, only the
+  // syscalls the debugger makes this way are known
+  va_list args;
+  va_start(args, number);
+  long result;
+  switch (number) {
+    case SYS_tgkill: {
+      auto tgid = va_arg(args, pid_t);
+      auto tid = va_arg(args, pid_t);
+      auto signal = va_arg(args, int);
+      result = __real_syscall(number, tgid, tid, signal);
+      break;
+    }
+    default:
+      std::fprintf(stderr, "syscallCounter: add the arguments of syscall %ld to __wrap_syscall\n", number);
+      std::abort();
+  }
+  va_end(args);
+  return result;
+}
+}
@@ -0,0 +1,27 @@
+#ifndef SYSCALLCOUNTER_H
+#define SYSCALLCOUNTER_H
+
+#include <cstdint>
+
+/**
+ * @brief Syscalls made by the debugger, counted by the `--wrap` wrappers
+ * the `bench` target is linked with
+ *
+ */
+struct SyscallCounts {
+  uint64_t ptrace = 0;
+  uint64_t waitpid = 0;
+  uint64_t memory = 0;  /**< `process_vm_readv`, `process_vm_writev`, `pread` and `pwrite` */
+  uint64_t signal = 0;  /**< `kill` */
+  uint64_t syscall = 0; /**< `syscall`, which is only used for `tgkill` */
+
+  uint64_t total() const { return ptrace + waitpid + memory + signal + syscall; }
+};
+
+/**
+ * @brief The counts since the start of the benchmark process
+ *
+ */
+const SyscallCounts &getSyscallCounts();
+
+#endif  // SYSCALLCOUNTER_H
@@ -0,0 +1,23 @@
+// Traced by the benchmarks, it loops until killed
+
+volatile long sink;
+
+__attribute__((noinline)) long tick(long x) { return x + 1; }
+
+__attribute__((noinline)) long leaf(long x) { return x ^ (x >> 7); }
+
+// The body is generated by CMake, one statement per line with a call
+// every few lines
+__attribute__((noinline)) long large(long acc) {
+#include "largeBody.inc"
+  return acc;
+}
+
+int main(int argc, char *argv[]) {
+  long acc = argc;
+  while (true) {
+    acc = tick(acc);
+    acc = large(acc);
+    sink = acc;
+  }
+}
@@ -0,0 +1,3 @@
+// Linked with the generated units, only its debug information is read
+
+int main() { return 0; }
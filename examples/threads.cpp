@@ -0,0 +1,21 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int work(int id) {
+  int sum = 0;
+  for (int i = 0; i < 1000; ++i) {
+    sum += i * id;
+  }
+  return sum;
+}
+
+int main() {
+  std::vector<std::thread> workers;
+  for (int id = 1; id <= 4; ++id) {
+    workers.emplace_back([id] { std::cerr << work(id) << std::endl; });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
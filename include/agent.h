@@ -0,0 +1,170 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include "breakpoint.h"
+#include "decoder.h"
+#include "mem.h"
+#include "tracebuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Conditional breakpoints and tracepoints run inside the tracee
+ *
+ * @details The agent is a code and a data mapping made in the tracee. The
+ * first instructions of a fast point are replaced by a jump to its
+ * trampoline, which saves the registers, counts the hit, then evaluates
+ * the condition or records the collected values in a ring of the data
+ * mapping. Only a true condition stops the tracee, on an INT3 of the
+ * trampoline. The replaced instructions are run relocated in the
+ * trampoline, which then jumps back after them.
+ *
+ * Data mapping: the number of records reserved, the hit counters of the
+ * points, then the ring of records.
+ *
+ */
+class Agent {
+public:
+  /**
+   * @brief A breakpoint served by a trampoline
+   *
+   */
+  struct Point {
+    std::intptr_t address;
+    std::vector<uint8_t> original; /**< whole instructions replaced by the jump */
+    uint64_t trampoline;
+    uint64_t stop; /**< the INT3 reached when the condition is true, 0 for a tracepoint */
+    unsigned slot; /**< index of its hit counter */
+    bool collects; /**< a tracepoint, which never stops */
+    bool patched;  /**< the jump is in place, otherwise it is a plain INT3 breakpoint */
+  };
+
+  static constexpr std::size_t jumpLength = 5;
+  static constexpr std::size_t codeSize = 1 << 20;
+  static constexpr std::size_t maxValues = 16; /**< collected by a fast tracepoint */
+  static constexpr std::size_t maxPoints = 1024;
+
+private:
+  /**
+   * @brief The header written in front of the values of a record
+   *
+   */
+  struct RecordHeader {
+    uint64_t sequence; /**< index of the record plus one, 0 while written */
+    uint64_t tsc;      /**< `rdtsc` at the hit */
+    uint32_t tracepoint;
+    int32_t tid;
+    uint32_t count; /**< number of values */
+    uint32_t padding;
+  };
+
+  static constexpr std::size_t recordSize = sizeof(RecordHeader) + maxValues * sizeof(int64_t);
+  static constexpr std::size_t ringRecords = 8192; /**< a power of two */
+  static constexpr std::size_t countersOffset = 64;
+  static constexpr std::size_t ringOffset = countersOffset + maxPoints * sizeof(uint64_t);
+
+  pid_t pid = 0;
+  uint64_t codeAddress = 0; /**< 0 until injected */
+  std::size_t codeUsed = 0;
+  uint64_t dataAddress = 0;
+  std::unordered_map<std::intptr_t, Point> points; /**< by address */
+  unsigned nextSlot = 0;                           /**< hit counters are not reused */
+  uint64_t drained = 0;                            /**< records moved to a trace buffer */
+  uint64_t startTsc = 0;                           /**< TSC and steady clock at the injection, to convert */
+  uint64_t startTime = 0;
+
+public:
+  static constexpr std::size_t dataSize = ringOffset + ringRecords * recordSize;
+
+  /**
+   * @brief Use the mappings made in process `p`
+   *
+   */
+  void attach(pid_t p, uint64_t code, uint64_t data);
+
+  bool isInjected() const { return codeAddress != 0; }
+
+  /**
+   * @brief Build and write the trampoline of `bp`, it is patched later
+   *
+   * @param instructions the instructions replaced by the jump, relocatable
+   * @param original their bytes, without INT3
+   * @return false if it cannot be served by the agent, nothing is written
+   */
+  bool addPoint(Memory &memory,
+                const Breakpoint &bp,
+                const std::vector<Instruction> &instructions,
+                const std::vector<uint8_t> &original);
+
+  /**
+   * @brief Unpatch and forget the point at `address`, its trampoline is
+   * not reused
+   *
+   */
+  void removePoint(Memory &memory, std::intptr_t address);
+
+  /**
+   * @brief Write the jump to the trampoline, the tracee must be stopped
+   *
+   */
+  void patch(Memory &memory, Point &point);
+
+  /**
+   * @brief Restore the replaced instructions, the tracee must be stopped
+   *
+   */
+  void unpatch(Memory &memory, Point &point);
+
+  std::unordered_map<std::intptr_t, Point> &getPoints() { return points; }
+
+  /**
+   * @brief Get the point at `address`
+   *
+   * @return Point* nullptr if there is none
+   */
+  Point *findPoint(std::intptr_t address);
+
+  /**
+   * @brief Get the point whose trampoline stops at `pc`
+   *
+   */
+  Point *findStop(uint64_t pc);
+
+  /**
+   * @brief Get the patched point whose jump overwrites `address`, past
+   * its first byte
+   *
+   */
+  Point *findCovering(std::intptr_t address);
+
+  /**
+   * @brief Put the original bytes back in code read at `address`
+   *
+   */
+  void hidePatches(uint64_t address, std::vector<uint8_t> &code) const;
+
+  /**
+   * @brief Read the hits counted by the trampoline of `point`
+   *
+   */
+  uint64_t getHits(Memory &memory, const Point &point) const;
+
+  bool hasTracepoints() const;
+
+  /**
+   * @brief Move the new records of the ring to `buffer`
+   *
+   * @details The TSC of a record is converted to the steady clock with
+   * the rates seen since the injection. Records not completed yet are left
+   * for the next time.
+   *
+   * @return uint64_t the records overwritten before they could be moved
+   */
+  uint64_t drain(Memory &memory, TraceBuffer &buffer);
+};
+
+#endif  // AGENT_H
@@ -0,0 +1,115 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+/**
+ * @brief The general purpose registers in their x86-64 encoding order
+ *
+ */
+enum class Gpr : uint8_t { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+
+/**
+ * @brief Emit the few x86-64 instructions of the agent trampolines
+ *
+ * @details Memory operands are always `[base + disp32]`. Code is built
+ * for a fixed address, so that jumps to absolute targets can be encoded
+ * relative to it.
+ *
+ */
+class Assembler {
+private:
+  uint64_t base; /**< address of the first byte */
+  std::vector<uint8_t> code;
+
+  void emitRex(bool wide, uint8_t reg, uint8_t rm);
+
+  /**
+   * @brief Emit ModRM, SIB and disp32 for `[base + disp]`
+   *
+   */
+  void emitMemory(uint8_t reg, Gpr base, int32_t disp);
+
+  void emit32(uint32_t value);
+
+public:
+  explicit Assembler(uint64_t address) : base{address} {}
+
+  uint64_t getAddress() const { return base + code.size(); }
+
+  const std::vector<uint8_t> &getCode() const { return code; }
+
+  /**
+   * @brief Emit raw bytes, for instructions without operands to encode
+   *
+   */
+  void bytes(std::initializer_list<uint8_t> raw);
+
+  void bytes(const uint8_t *raw, std::size_t length);
+
+  void push(Gpr r);
+
+  void pop(Gpr r);
+
+  /**
+   * @brief `mov dst, src`
+   *
+   */
+  void mov(Gpr dst, Gpr src);
+
+  /**
+   * @brief `movabs dst, value`
+   *
+   */
+  void movImmediate(Gpr dst, uint64_t value);
+
+  /**
+   * @brief `mov dst, [base + disp]`
+   *
+   */
+  void load(Gpr dst, Gpr base, int32_t disp);
+
+  /**
+   * @brief `mov [base + disp], src`, 64 or 32 bits
+   *
+   */
+  void store(Gpr base, int32_t disp, Gpr src, bool wide = true);
+
+  /**
+   * @brief `mov dword [base + disp], value`
+   *
+   */
+  void storeImmediate32(Gpr base, int32_t disp, uint32_t value);
+
+  /**
+   * @brief `lea dst, [base + disp]`
+   *
+   */
+  void lea(Gpr dst, Gpr base, int32_t disp);
+
+  /**
+   * @brief Emit a branch with a rel32 to fill later with `bind`
+   *
+   * @param opcode `{0xe9}` for `jmp`, `{0x0f, 0x8x}` for a `jcc`
+   * @return std::size_t the position of the rel32
+   */
+  std::size_t branch(std::initializer_list<uint8_t> opcode);
+
+  /**
+   * @brief Make the branch emitted at `position` go to the current address
+   *
+   */
+  void bind(std::size_t position);
+
+  /**
+   * @brief `jmp target`
+   *
+   * @return false if `target` is out of the reach of a rel32
+   */
+  bool jump(uint64_t target);
+};
+
+#endif  // ASSEMBLER_H
@@ -0,0 +1,64 @@
+#ifndef BATCHOUTPUT_H
+#define BATCHOUTPUT_H
+
+#include "spdlog/spdlog.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Report every command of the batch mode as one JSON line on stdout
+ *
+ * @details While it exists, the messages logged and the source printed
+ * by a command are captured in order, then written with it:
+ *
+ *     {"command":"break main","ok":true,"ms":0.215,"output":["Set breakpoint 1 at address 0x401136"]}
+ *
+ * `ok` is false if the command logged an error. Messages logged outside of
+ * the commands go to stderr, so stdout only has the records and what the
+ * tracee writes itself.
+ *
+ */
+class BatchOutput {
+private:
+  std::ostringstream printed;                     /**< `std::cout` while it exists */
+  std::streambuf *stdoutBuffer;                   /**< the buffer `std::cout` had */
+  std::ostream records;                           /**< to the real stdout */
+  std::shared_ptr<spdlog::logger> previousLogger; /**< restored at the end */
+  std::vector<std::string> lines;                 /**< of the running command */
+  bool capturing = false;                         /**< a command is running */
+  bool failed = false;                            /**< the running command logged an error */
+  uint64_t start = 0;
+
+  /**
+   * @brief Move what was printed to `std::cout` to the captured lines
+   *
+   */
+  void takePrinted();
+
+public:
+  BatchOutput();
+  BatchOutput(const BatchOutput &) = delete;
+  BatchOutput &operator=(const BatchOutput &) = delete;
+  ~BatchOutput();
+
+  void begin();
+
+  /**
+   * @brief Write the record of `command` with what it output since `begin`
+   *
+   */
+  void end(const std::string &command);
+
+  /**
+   * @brief Capture a message, called by the sink of the logger
+   *
+   */
+  void log(spdlog::level::level_enum level, const std::string &text);
+};
+
+#endif  // BATCHOUTPUT_H
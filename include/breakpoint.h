@@ -1,15 +1,33 @@
 #ifndef BREAKPOINT_H
 #define BREAKPOINT_H
 
+#include "condition.h"
+#include "mem.h"
+
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <unistd.h>
+#include <vector>
 
 class Breakpoint {
+public:
+  using Clock = std::chrono::steady_clock;
+
 private:
   pid_t pid;
   std::intptr_t address;
   bool enabled;
-  uint8_t savedData; /**< data which used to be at the break point address */
+  uint8_t savedData;                                        /**< data which used to be at the break point address */
+  std::shared_ptr<const Condition> condition;               /**< stop only when it evaluates to non-zero */
+  std::shared_ptr<const std::vector<Condition>> collect;    /**< recorded by a tracepoint, which never stops */
+  std::shared_ptr<const std::vector<std::string>> commands; /**< run when it stops, see `Debugger::execute` */
+  unsigned number = 0;                                      /**< user visible number, 0 for internal breakpoints */
+  uint64_t hitCount = 0;                                    /**< times the tracee trapped here */
+  uint64_t ignoreCount = 0;                                 /**< stops left to skip */
+  Clock::time_point firstHit;
+  Clock::time_point lastHit;
 
 public:
   Breakpoint() = default;
@@ -39,6 +57,85 @@ public:
   bool isEnabled() const { return enabled; }
 
   std::intptr_t getAddress() const { return address; }
+
+  uint8_t getSavedData() const { return savedData; }
+
+  void setCondition(std::shared_ptr<const Condition> c) { condition = std::move(c); }
+
+  /**
+   * @brief Get the condition
+   *
+   * @return const Condition* nullptr for an unconditional breakpoint
+   */
+  const Condition *getCondition() const { return condition.get(); }
+
+  void setCollect(std::shared_ptr<const std::vector<Condition>> c) { collect = std::move(c); }
+
+  /**
+   * @brief Get the expressions recorded on every hit
+   *
+   * @return const std::vector<Condition>* nullptr unless it is a tracepoint
+   */
+  const std::vector<Condition> *getCollect() const { return collect.get(); }
+
+  void setCommands(std::shared_ptr<const std::vector<std::string>> c) { commands = std::move(c); }
+
+  /**
+   * @brief Get the commands run when it stops
+   *
+   * @details Shared, so that they outlive the breakpoint if one of them
+   * removes it.
+   *
+   * @return nullptr if there are none
+   */
+  const std::shared_ptr<const std::vector<std::string>> &getCommands() const { return commands; }
+
+  void setNumber(unsigned n) { number = n; }
+
+  unsigned getNumber() const { return number; }
+
+  /**
+   * @brief Count a trap at this breakpoint and update the hit timestamps
+   *
+   */
+  void recordHit();
+
+  uint64_t getHitCount() const { return hitCount; }
+
+  void setIgnoreCount(uint64_t n) { ignoreCount = n; }
+
+  uint64_t getIgnoreCount() const { return ignoreCount; }
+
+  /**
+   * @brief Consume one ignore count
+   *
+   * @return true if this stop should be skipped
+   */
+  bool consumeIgnore();
+
+  /**
+   * @brief Get the hit rate between the first and the last hit
+   *
+   * @return double hits per second, 0 until it has been hit twice
+   */
+  double getHitsPerSecond() const;
+
+  /**
+   * @brief Inject INT3 into many breakpoints at once
+   *
+   * @details The addresses are grouped by page, every group is read
+   * with one `Memory::readBlock`, patched in the buffer and written back
+   * with one `Memory::writeBlock`, instead of a PEEKDATA/POKEDATA pair
+   * for every breakpoint.
+   *
+   */
+  static void enableAll(Memory &memory, const std::vector<Breakpoint *> &bps);
+
+  /**
+   * @brief Restore the original bytes of many breakpoints at once
+   *
+   */
+  static void disableAll(Memory &memory, const std::vector<Breakpoint *> &bps);
 };
 
 #endif  // BREAKPOINT_H
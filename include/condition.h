@@ -0,0 +1,105 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include "assembler.h"
+#include "mem.h"
+#include "reg.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A breakpoint condition compiled once into a small stack bytecode
+ *
+ * @details The grammar is C-like: decimal or `0x` constants, register
+ * names with an optional `$` (`$pc` is `rip`), `*expr` to read a word of
+ * memory, `u8()`, `u16()`, `u32()`, `i8()`, `i16()`, `i32()` to narrow a
+ * value, arithmetic `+ - * / %`, comparisons `== != < <= > >=`, `!`,
+ * `&&` and `||`. All values are signed 64 bit.
+ *
+ */
+class Condition {
+private:
+  enum class Op : uint8_t {
+    constant,
+    reg,
+    deref,
+    zeroExtend,
+    signExtend,
+    negate,
+    logicalNot,
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    logicalAnd,
+    logicalOr
+  };
+
+  struct Instruction {
+    Op op;
+    int64_t operand; /**< constant, register or bit width */
+  };
+
+  class Parser;
+
+  std::string text;
+  std::vector<Instruction> code;
+
+public:
+  static constexpr std::size_t maxStackDepth = 32;
+
+  /**
+   * @brief Where code compiled by `compile` finds the tracee state
+   *
+   */
+  struct NativeFrame {
+    std::array<int32_t, registersNumber> offsets; /**< of each saved register from `rbx` by `Reg`, -1 if not saved */
+    int32_t stackOffset;                          /**< `rsp` of the tracee is `rbx` plus it */
+    uint64_t pc;                                  /**< the value of `rip` */
+    pid_t pid;                                    /**< memory is read with `process_vm_readv` on it */
+  };
+
+  Condition() = default;
+
+  /**
+   * @brief Compile `text`
+   *
+   * @throw std::invalid_argument if `text` is not a valid expression
+   */
+  explicit Condition(const std::string &text);
+
+  /**
+   * @brief Evaluate the expression against the stopped tracee
+   *
+   * @details Registers come from the cached register file, each `*` is
+   * one word read.
+   */
+  int64_t evaluate(Memory &memory) const;
+
+  /**
+   * @brief Compile the expression to x86-64 code run inside the tracee
+   *
+   * @details The code reads the saved registers through `rbx` and leaves
+   * the value in `rax`, with the same results as `evaluate`. It uses the
+   * stack and clobbers the flags, `rax`, `rcx`, `rdx`, `rsi`, `rdi` and
+   * `r8` to `r11`.
+   *
+   * @return false if it reads a register which is not saved
+   */
+  bool compile(const NativeFrame &frame, Assembler &assembler) const;
+
+  const std::string &getText() const { return text; }
+};
+
+#endif  // CONDITION_H
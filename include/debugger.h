@@ -1,70 +1,114 @@
 #ifndef DEBUGGER_H
 #define DEBUGGER_H
 
+#include "agent.h"
+#include "batchoutput.h"
 #include "breakpoint.h"
+#include "condition.h"
+#include "decoder.h"
 #include "dwarf/dwarf++.hh"
 #include "elf/elf++.hh"
+#include "hardwarebreakpoint.h"
+#include "indexfile.h"
 #include "mem.h"
+#include "profiler.h"
 #include "reg.h"
 #include "signal.h"
+#include "sourcecache.h"
+#include "symbolindex.h"
+#include "tracebuffer.h"
+#include "unwinder.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
 #include <string>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
-enum class symType { notype, object, func, section, file };
-
-static std::string symToString(symType st) {
-  switch (st) {
-    case symType::notype:
-      return "notype";
-    case symType::object:
-      return "object";
-    case symType::func:
-      return "func";
-    case symType::section:
-      return "section";
-    case symType::file:
-      return "file";
-    default:
-      return "";
-  }
-}
-
-struct Sym {
-  symType type;
+/**
+ * @brief A call of an `ftrace` function, whose return address on the
+ * stack was replaced by the trampoline
+ *
+ */
+struct TracedCall {
+  std::size_t function;   /**< index in `tracedFunctions` */
+  uint64_t returnAddress; /**< the real one */
+  uint64_t stack;         /**< where the return address is stored */
+  uint64_t entryTime;     /**< nanoseconds of the steady clock */
+};
+
+/**
+ * @brief A function traced by `ftrace`, with all its definitions
+ *
+ */
+struct TracedFunction {
   std::string name;
-  std::uintptr_t address;
+  uint64_t calls = 0;
+  uint64_t returns = 0; /**< calls seen returning through the trampoline */
 };
 
-static symType elfToSymType11(elf::stt sym) {
-  switch (sym) {
-    case elf::stt::notype:
-      return symType::notype;
-    case elf::stt::object:
-      return symType::object;
-    case elf::stt::func:
-      return symType::func;
-    case elf::stt::section:
-      return symType::section;
-    case elf::stt::file:
-      return symType::file;
-    default:
-      return symType::notype;
-  }
-}
+/**
+ * @brief A traced thread of the tracee
+ *
+ */
+struct Thread {
+  pid_t tid;
+  bool running = true;                 /**< resumed and not waited for since */
+  bool stopExpected = false;           /**< a stop was requested, its `SIGSTOP` is swallowed */
+  bool isNew = true;                   /**< its first stop, automatic for clones, is not seen yet */
+  int pendingSignal = 0;               /**< delivered when the thread is resumed */
+  std::vector<TracedCall> tracedCalls; /**< calls of `ftrace` functions in progress, innermost last */
+
+  explicit Thread(pid_t t) : tid{t} {}
+};
 
 class Debugger {
 private:
-  std::string programName;                                   /**< program name */
-  pid_t pid;                                                 /**< process id */
-  uint64_t loadAddress = 0;                                  /**< load address */
-  std::unordered_map<std::intptr_t, Breakpoint> breakpoints; /**< breakpoints */
-  dwarf::dwarf pDwarf;                                       /**< dwarf instance*/
-  elf::elf pElf;                                             /**< elf*/
-  Memory memory;                                             /**< memory class*/
+  std::string programName;                                              /**< program name */
+  pid_t pid;                                                            /**< process id */
+  uint64_t loadAddress = 0;                                             /**< load address */
+  std::unordered_map<std::intptr_t, Breakpoint> breakpoints;            /**< breakpoints */
+  std::unordered_map<unsigned, HardwareBreakpoint> hardwareBreakpoints; /**< hardware breakpoints by slot */
+  dwarf::dwarf pDwarf;                                                  /**< dwarf instance*/
+  elf::elf pElf;                                                        /**< elf*/
+  Memory memory;                                                        /**< memory class*/
+  IndexFile indexFile;                                                  /**< saved index of this build */
+  SymbolIndex symbolIndex;                                              /**< PC lookup index */
+  Unwinder unwinder;                                                    /**< CFI stack unwinder */
+  bool resumeAfterStop = false;                                         /**< last stop was on a false condition */
+  unsigned nextBreakpointNumber = 1;                                    /**< number of the next user breakpoint */
+  bool attached = false;                                                /**< seized a running process */
+  bool detached = false;                                                /**< the process is no longer traced */
+  std::map<pid_t, Thread> threads;                                      /**< traced threads by tid */
+  pid_t currentThread;                                                  /**< thread of the registers and stepping */
+  bool nonStop = false;                                                 /**< only the reporting thread is halted */
+  uint64_t scratchAddress = 0;                                          /**< displaced stepping buffer */
+  TraceBuffer traceBuffer;                                              /**< records of the tracepoints */
+  std::vector<int64_t> traceValues;                                     /**< scratch of `collectTrace` */
+  bool catchingSyscalls = false;                                        /**< resume with `PTRACE_SYSCALL` */
+  std::vector<long> caughtSyscalls;                                     /**< syscalls which stop, empty for all */
+  SourceCache sourceCache;                                              /**< source files read for listing */
+  unsigned sourceContext = 2;                                           /**< lines printed around a stop */
+  std::string listFile;                                                 /**< file of the last `list` */
+  unsigned listLine = 0;                                                /**< last line printed by `list` */
+  std::vector<TracedFunction> tracedFunctions;                          /**< functions of `ftrace` */
+  std::unordered_map<std::intptr_t, std::size_t> tracedEntries;         /**< entry breakpoints to their function */
+  std::intptr_t ftraceTrampoline = 0;                                   /**< where traced calls return, 0 if off */
+  std::intptr_t ftraceUnwinder = 0;                                     /**< `_Unwind_RaiseException`, 0 if unknown */
+  bool ftraceUnwinderSearched = false;                                  /**< looked for since `ftrace` was on */
+  TraceBuffer ftraceBuffer;                                             /**< latency and depth of the returns */
+  Agent agent;                                                          /**< trampolines of the fast points */
+  bool agentEnabled = false;                                            /**< serve fast points with the agent */
+  std::unique_ptr<BatchOutput> batchOutput;                             /**< a JSON record per command in batch mode */
+  std::vector<std::string> scripts;                                     /**< run after the start */
+  bool readingCommands = false;                                         /**< a `commands` block is being read */
+  unsigned commandsBreakpoint = 0;                                      /**< whose `commands` are read, 0 drops them */
+  std::vector<std::string> commandsRead;                                /**< of the `commands` block so far */
+  std::shared_ptr<const std::vector<std::string>> hitCommands;          /**< of the breakpoint of the last stop */
 
   /**
    * @brief To handle user input
@@ -73,6 +117,28 @@ private:
    */
   void handleCommand(const std::string &line);
 
+  /**
+   * @brief Run one command, timed and, in batch mode, reported
+   *
+   * @details In batch mode a malformed command is reported as an error
+   * instead of ending the session.
+   *
+   */
+  void runCommand(const std::string &line);
+
+  /**
+   * @brief Run the lines of `input` as commands, skipping the blank ones
+   * and the `#` comments
+   *
+   */
+  void runScript(std::istream &input);
+
+  /**
+   * @brief Run the scripts given to `addScript`
+   *
+   */
+  void runStartupScripts();
+
   /**
    * @brief Auxilary function for `handleCommand` to split space
    *
@@ -105,7 +171,8 @@ private:
    * @details Use `ptrace` to continue the execution, however,
    * there may be the current address is a breakpoint, so we
    * need to first step in this instruction first, and do
-   * the continuation.
+   * the continuation. Stops at conditional breakpoints whose
+   * condition is false are resumed in the same loop.
    *
    */
   void continueExecution();
@@ -117,30 +184,345 @@ private:
    * to the `breakpoints` data structure
    *
    * @param addr the virtual address
+   * @param condition stop only when it is true, nullptr to always stop
+   * @return false if a breakpoint is already at `addr`
+   */
+  bool setBreakPointAtAddress(std::intptr_t addr, std::shared_ptr<const Condition> condition = nullptr);
+
+  /**
+   * @brief Set unnumbered breakpoints used internally by stepping
+   *
+   * @details The INT3 bytes are injected in one batch, see
+   * `Breakpoint::enableAll`
+   *
+   * @param addresses the virtual addresses, without existing breakpoints
+   */
+  void setTemporaryBreakpoints(const std::vector<std::intptr_t> &addresses);
+
+  /**
+   * @brief Find a user breakpoint by its number
+   *
+   * @return Breakpoint* nullptr if there is no such breakpoint
+   */
+  Breakpoint *getBreakpointByNumber(unsigned number);
+
+  /**
+   * @brief Print the user breakpoints with their hit statistics
+   *
+   */
+  void dumpBreakpoints();
+
+  /**
+   * @brief Set tracepoints, breakpoints which record `expressions` in
+   * `traceBuffer` and resume right away
+   *
+   * @param location as accepted by `resolveLocation`
+   * @param expressions comma separated, `$regs` stands for every register
+   */
+  void setTracepoint(const std::string &location, const std::string &expressions);
+
+  /**
+   * @brief Evaluate the collected expressions of a tracepoint hit by the
+   * current thread and record them
+   *
+   */
+  void collectTrace(const Breakpoint &bp);
+
+  /**
+   * @brief Decode and print the last `count` records of `traceBuffer`
+   *
+   */
+  void dumpTrace(std::size_t count);
+
+  /**
+   * @brief Trace the calls of functions and their latency
+   *
+   * @details Every definition gets an unnumbered breakpoint on its first
+   * instruction. On entry the return address is replaced by the address
+   * of the trampoline, a breakpoint in `_start`, so the return traps too.
+   * Both are handled in `waitForSignal` and the thread resumed right
+   * away, whatever the thread.
+   *
+   * @note The latency includes the stops of the tracee. The trampoline
+   * has no call frame information, an exception raised by a thread puts
+   * back the return addresses of all its traced calls before unwinding,
+   * and their returns are not recorded.
+   *
+   */
+  void setFunctionTrace(const std::vector<std::string> &names);
+
+  /**
+   * @brief Put the real return addresses back and remove the breakpoints
+   * of `ftrace`, the records are kept for `ftrace report`
+   *
+   */
+  void stopFunctionTrace();
+
+  /**
+   * @brief Write the real return address of the traced calls of every
+   * stopped thread back to the stack
+   *
+   */
+  void restoreReturnAddresses();
+
+  /**
+   * @brief Write the real return address of the traced calls of `thread`
+   * back to the stack and forget them
+   *
+   */
+  void restoreReturnAddresses(Thread &thread);
+
+  /**
+   * @brief Find `_Unwind_RaiseException` in the executable or the loaded
+   * libraries and break on it, for the exceptions thrown through traced
+   * calls
+   *
+   */
+  void setUnwinderBreakpoint();
+
+  /**
+   * @brief Print the calls, returns and latency percentiles of the traced
+   * functions with a log2 histogram of their latency
+   *
+   */
+  void dumpFunctionTrace();
+
+  /**
+   * @brief Handle the stop of a thread on an `ftrace` breakpoint and
+   * resume it
+   *
+   * @return false if the stop is not such a hit
+   */
+  bool handleTracedFunction(Thread &thread, int waitStatus);
+
+  /**
+   * @brief Record a call of a traced function by the selected `thread`,
+   * stopped on its entry, and hijack its return address
+   *
+   */
+  void enterTracedCall(Thread &thread, std::size_t function);
+
+  /**
+   * @brief Record the return of the selected `thread`, stopped on the
+   * trampoline, and move it to the real return address
+   *
+   * @return false if no traced call returns there, the PC is unchanged
+   */
+  bool returnFromTracedCall(Thread &thread);
+
+  /**
+   * @brief The real return address of a traced call of the selected thread
+   *
+   * @param address a return address read from the stack or unwound
+   * @param stack the stack pointer after the return
+   * @return uint64_t `address` unless it is the trampoline
+   */
+  uint64_t getTracedReturnAddress(uint64_t address, uint64_t stack);
+
+  /**
+   * @brief Run one syscall in the current thread, which must be stopped
+   *
+   * @details A `syscall` instruction is written in the scratch buffer and
+   * single stepped with the arguments in the registers. The registers,
+   * the buffer and the pending signal are restored afterwards.
+   *
+   * @param result the value of `rax` after the syscall
+   * @return false if the thread exited or there is no scratch buffer
+   */
+  bool remoteSyscall(long number, const std::vector<uint64_t> &args, uint64_t &result);
+
+  /**
+   * @brief Map the code and data of the agent in the tracee
+   *
+   * @details The code is mapped below the lowest executable mapping, so
+   * that the jumps of the program reach it with a rel32.
+   *
+   */
+  bool injectAgent();
+
+  /**
+   * @brief Serve the conditional breakpoint or tracepoint at `address`
+   * with a trampoline of the agent, if its instructions allow it
+   *
+   * @details The jump replaces whole instructions of the same function,
+   * which must be relocatable and no direct branch of the function may
+   * land among them. It is written by `rearmFastPoints`, until then the
+   * INT3 serves the breakpoint. Otherwise the debugger keeps evaluating
+   * it on every hit.
+   *
+   */
+  void setFastPoint(std::intptr_t address);
+
+  /**
+   * @brief Patch the jumps of the fast points left as INT3 breakpoints
+   *
+   * @details A point stays an INT3 while a thread stands or another
+   * breakpoint lies inside the bytes its jump would overwrite, or while a
+   * fast tracepoint has crossings to ignore.
+   *
+   */
+  void rearmFastPoints();
+
+  /**
+   * @brief Put the instructions of a fast point back, its INT3 serves it
+   * until `rearmFastPoints`
+   *
+   */
+  void demoteFastPoint(Agent::Point &point);
+
+  /**
+   * @brief Move the records of the fast tracepoints to `traceBuffer`
+   *
+   */
+  void drainAgent();
+
+  /**
+   * @brief Get the breakpoint addresses of a function, after its prologue
+   *
+   * @details Every definition whose plain, mangled or demangled name
+   * matches has one.
+   *
+   * @param name the plain, mangled or demangled function name
+   */
+  std::vector<std::intptr_t> getFunctionAddresses(const std::string &name);
+
+  /**
+   * @brief Get the address of the first statement of file:line
+   *
+   */
+  std::vector<std::intptr_t> getSourceLineAddresses(const std::string &file, unsigned line);
+
+  /**
+   * @brief Resolve a location as accepted by `break`: `0xaddr`,
+   * `file:line` or a function name
+   *
+   */
+  std::vector<std::intptr_t> resolveLocation(const std::string &location);
+
+  /**
+   * @brief Set a hardware breakpoint or watchpoint in a free debug register
+   *
+   * @param addr the virtual address
+   * @param kind execute, write or read-write
+   * @param length the watched length, ignored for execute
    */
-  void setBreakPointAtAddress(std::intptr_t addr);
+  void setHardwareBreakpoint(std::intptr_t addr, HardwareBreakpointKind kind, std::size_t length);
 
   /**
-   * @brief Set breakpoint at function
+   * @brief Release the debug register `slot`
    *
-   * @param name the function name
    */
-  void setBreakPointAtFunction(const std::string &name);
+  void removeHardwareBreakpoint(unsigned slot);
 
-  // Set breakpoint at line
+  /**
+   * @brief Get the enabled hardware execute breakpoint at `address`
+   *
+   * @return HardwareBreakpoint* nullptr if there is none
+   */
+  HardwareBreakpoint *getHardwareBreakpointAt(std::intptr_t address);
 
   /**
-   * @brief Set breakpoint at file:line
+   * @brief Report the debug registers which triggered, according to DR6
    *
    */
-  void setBreakPointAtSourceLine(const std::string &file, unsigned line);
+  void handleHardwareBreakpoint();
 
   /**
    * @brief Wait for the signal when child process
    * hits the breakpoints and other situations.
    *
+   * @details Wait with `__WALL`. Clone events, the stops requested by
+   * `stopAllThreads`, the `ftrace` breakpoints and the stepping
+   * breakpoints hit by other threads are handled here. The first other event selects its thread and, unless
+   * in non-stop mode, stops all the others.
+   *
+   * @param only the thread to wait for, -1 for any
+   */
+  void waitForSignal(pid_t only = -1);
+
+  /**
+   * @brief Trace the clones of the process, and seize the existing
+   * threads of an attached one
+   *
+   */
+  void initializeThreads();
+
+  /**
+   * @brief Add the thread reported by the `PTRACE_EVENT_CLONE` of `parent`
+   *
+   */
+  void addClonedThread(pid_t parent);
+
+  /**
+   * @brief Whether a stop is the one requested by `stopAllThreads` or the
+   * first stop of a new thread, which are not reported
+   *
+   */
+  bool isRequestedStop(Thread &thread, int waitStatus);
+
+  /**
+   * @brief Resume one thread, delivering its pending signal
+   *
+   */
+  void resumeThread(Thread &thread, bool singleStep);
+
+  /**
+   * @brief Resume every stopped thread
+   *
+   */
+  void resumeAllThreads();
+
+  /**
+   * @brief Halt every running thread, with `SIGSTOP` or `PTRACE_INTERRUPT`
+   * when seized, and wait for them
+   *
+   */
+  void stopAllThreads();
+
+  /**
+   * @brief Record the event of a thread halted by `stopAllThreads`
+   *
+   * @details Signals are kept to be delivered later and breakpoint hits
+   * are rewound, so that the thread hits them again when resumed. A
+   * return to the `ftrace` trampoline is completed instead.
+   *
+   */
+  void recordStop(Thread &thread, int waitStatus);
+
+  /**
+   * @brief Whether the syscall stop of thread `tid` is for a caught syscall
+   *
+   */
+  bool isCaughtSyscall(pid_t tid);
+
+  /**
+   * @brief Print the syscall entry or exit the current thread stopped at
+   *
+   */
+  void reportSyscall();
+
+  /**
+   * @brief Stop at the entry and exit of the syscalls `names`, all of them
+   * if empty, or stop catching with `off`
+   *
+   * @note Every syscall stops the tracee, the ones not caught are resumed
+   * right away. The seccomp filter of `--syscalls` cannot be used as it
+   * must be installed before the program starts and never changes.
+   *
+   */
+  void setSyscallCatchpoint(const std::vector<std::string> &names);
+
+  /**
+   * @brief Select the thread of the register and stepping commands
+   *
+   */
+  void switchThread(pid_t tid);
+
+  /**
+   * @brief Print every thread with its PC and function
+   *
    */
-  void waitForSignal();
+  void dumpThreads();
 
   /**
    * @brief Step over the breakpoint
@@ -148,10 +530,69 @@ private:
    * @details Step the current breakpoint, if it is enabled,
    * we should first disable it, and call `ptrace` to step in,
    * And calls `waitForSignal` and re-enable the breakpoint.
+   * A hardware execute breakpoint at the PC is stepped over the same way.
+   * While other threads run, the instruction is stepped out of line by
+   * `displacedStep` instead, or they are held during the step.
    *
    */
   void stepOverBreakpoint();
 
+  /**
+   * @brief Execute the instruction at the PC of `thread` in the scratch
+   * buffer, leaving the breakpoint in place
+   *
+   * @details The copy has its RIP relative displacement adjusted. After
+   * the single step, a PC relative to the buffer and the return address
+   * pushed by a call are moved back to the original code.
+   *
+   * @note A thread with a pending signal is not displaced, the handler
+   * would return to the buffer.
+   *
+   * @return false if the instruction cannot be displaced or a signal
+   * stopped the thread before it ran, the PC is unchanged
+   */
+  bool displacedStep(Thread &thread);
+
+  /**
+   * @brief Single step one thread and wait for it, without reporting
+   *
+   * @return false if the thread exited
+   */
+  bool stepThread(Thread &thread);
+
+  /**
+   * @brief Step a thread which is not the current one over a stepping
+   * breakpoint and resume it
+   *
+   * @return false if the stop is not such a hit
+   */
+  bool skipTemporaryBreakpoint(Thread &thread, int waitStatus);
+
+  /**
+   * @brief Step the selected `thread`, stopped on `bp` with its PC put
+   * back, over it and resume it
+   *
+   * @details The instruction is displaced, or the other threads are held
+   * while the breakpoint is lifted. The current thread is selected again.
+   *
+   */
+  void resumeOverBreakpoint(Thread &thread, Breakpoint &bp);
+
+  bool hasRunningThreads();
+
+  /**
+   * @brief Stop the running threads
+   *
+   * @return std::vector<pid_t> the threads to give to `releaseThreads`
+   */
+  std::vector<pid_t> holdThreads();
+
+  /**
+   * @brief Resume the threads stopped by `holdThreads`
+   *
+   */
+  void releaseThreads(const std::vector<pid_t> &held);
+
   /**
    * @brief Step single instruction
    *
@@ -169,12 +610,11 @@ private:
   /**
    * @brief Step out the current function.
    *
-   * @details We'll find the return address of the current function,
-   * so how to find the return address, remember the x86 call convention.
-   * `push ebp; mov ebp esp`. So we can get the value of the register
-   * `ebp`, and +8 bytes to get the return address. And we should set
-   * the return address a breakpoint, because we need to get the control
-   * for the user, and then disable the breakpoint.
+   * @details Unwind the current frame with the call frame information
+   * and run to the return address. Without CFI, decode the current
+   * function and set breakpoints on its `ret` instructions and tail
+   * calls, then step the `ret` to land on the return address. Neither
+   * relies on the frame pointer.
    *
    * @note However, there would be a situation that the user has set the
    * correspond address a breakpoint,this is a corner case.
@@ -182,6 +622,66 @@ private:
    */
   void stepOut();
 
+  /**
+   * @brief Step out by setting a breakpoint at `rbp+8`
+   *
+   * @note Only correct for functions keeping the frame pointer, used when
+   * the current function cannot be decoded.
+   */
+  void stepOutWithFramePointer();
+
+  /**
+   * @brief Step one instruction, running over it if it is a call
+   *
+   */
+  void stepInstructionOver();
+
+  /**
+   * @brief Continue until one of `addresses` is reached
+   *
+   * @details Temporary breakpoints are planted on the addresses without
+   * one. Hits with a stack pointer below `minStack` are deeper recursive
+   * calls and are resumed.
+   *
+   * @param frame if not 0, hits are compared by the frame address instead
+   * when they can be unwound: those of a lower one are resumed
+   * @return false if the tracee stopped for another reason, such as a
+   * user breakpoint or a signal
+   */
+  bool runToAddresses(const std::vector<std::intptr_t> &addresses, uint64_t minStack, uint64_t frame = 0);
+
+  /**
+   * @brief Read code with the INT3 patches of the breakpoints removed
+   *
+   */
+  std::vector<uint8_t> readCode(uint64_t address, std::size_t length);
+
+  /**
+   * @brief Decode every instruction in [low, high)
+   *
+   * @return false if the range is unreadable or not valid code
+   */
+  bool decodeRange(uint64_t low, uint64_t high, std::vector<Instruction> &instructions);
+
+  /**
+   * @brief Whether the PC is on a numbered breakpoint
+   *
+   */
+  bool stoppedAtUserBreakpoint();
+
+  /**
+   * @brief Print where a stepping command stopped, unless a user
+   * breakpoint has already done it
+   *
+   */
+  void finishStep();
+
+  /**
+   * @brief Print the source around the current PC, if it has line information
+   *
+   */
+  void printSourceAtPC();
+
   /**
    * @brief Remove breakpoint at the specified virtual address
    *
@@ -189,6 +689,12 @@ private:
    */
   void removeBreakpoint(std::intptr_t address);
 
+  /**
+   * @brief Remove many breakpoints, restoring their bytes in one batch
+   *
+   */
+  void removeBreakpoints(const std::vector<std::intptr_t> &addresses);
+
   /**
    * @brief Step the current line.
    *
@@ -214,9 +720,43 @@ private:
    * executed and work out all of the possible branch
    * targets, then set breakpoints on all of them.
    *
+   * @details The instructions of the current line are decoded, and
+   * breakpoints are only set where the line can be left: its end and
+   * the jumps out of it. Calls are run over, `ret` and indirect jumps
+   * are single stepped.
+   *
    */
   void stepOver();
 
+  /**
+   * @brief Step over by setting breakpoints on every line of the function
+   *
+   * @note Used when the current line cannot be decoded.
+   */
+  void stepOverWithLineTable();
+
+  /**
+   * @brief Get the canonical frame address of the current function, the
+   * stack pointer of its caller after it returns
+   *
+   * @return uint64_t 0 without call frame information
+   */
+  uint64_t getFrameAddress();
+
+  /**
+   * @brief Get the return address of the current function
+   *
+   * @details Use the call frame information, or `rbp+8` without it
+   *
+   */
+  uint64_t getReturnAddress();
+
+  /**
+   * @brief Print the call stack, unwound with the call frame information
+   *
+   */
+  void printBacktrace();
+
   // A helper function to offset address from DWARF info by the load address
 
   /**
@@ -228,8 +768,8 @@ private:
   /**
    * @brief Get the debug information entry from current pc.
    *
-   * @details For every compilation units, if the pc is in the compilation
-   * units, if the die contain contains the pc, return this die.
+   * @details Binary search the compilation unit ranges and then the
+   * subprogram ranges of that unit in `symbolIndex`.
    *
    * @param pc the PC
    * @return dwarf::die Debug Information Entry
@@ -240,6 +780,8 @@ private:
   /**
    * @brief Get line entry from PC
    *
+   * @details Binary search the line rows in `symbolIndex`.
+   *
    * @param pc
    * @return dwarf::line_table::iterator
    */
@@ -250,6 +792,9 @@ private:
   /**
    * @brief To find the sym to loop up the symbol table.
    *
+   * @details Served by the name index of `symbolIndex`, which accepts
+   * both mangled and demangled names.
+   *
    * @param name
    * @return std::vector<Sym>
    */
@@ -258,8 +803,11 @@ private:
   /**
    * @brief To get the mapped load address
    *
+   * @details Use the mapping of the executable at file offset 0
+   *
+   * @return false if it cannot be found
    */
-  void initializeLoadAddress();
+  bool initializeLoadAddress();
   // To calculate the offset from the load address
 
   /**
@@ -273,11 +821,36 @@ private:
   /**
    * @brief Print the source code
    *
+   * @details `sourceContext` lines are printed on each side of `line`,
+   * the window is served by `sourceCache`. A following `list` goes on
+   * after it.
+   *
    * @param fileName the filename we could get it from DWARF
    * @param line the line
-   * @param nLinesContext the window
    */
-  void printSource(const std::string &fileName, unsigned line, unsigned nLinesContext = 2);
+  void printSource(const std::string &fileName, unsigned line);
+
+  /**
+   * @brief Print the lines [first, last] of a file, marking `current`
+   *
+   * @return unsigned the last line printed, 0 if none
+   */
+  unsigned printSourceLines(const std::string &fileName, unsigned first, unsigned last, unsigned current);
+
+  /**
+   * @brief Find the path in the line tables of a file given by its suffix
+   *
+   * @return std::string empty if no compilation unit uses it
+   */
+  std::string findSourcePath(const std::string &file);
+
+  /**
+   * @brief List the source around a location, or after the last listing
+   * if `location` is empty
+   *
+   * @param location `file:line`, `0xaddr` or a function name
+   */
+  void listSource(const std::string &location);
 
   /**
    * @brief Get the signal information
@@ -296,14 +869,93 @@ public:
   /**
    * @brief Construct a new Debugger object
    *
+   * @param name the executable, `/proc/<pid>/exe` works for attached processes
+   * @param p the process id
+   * @param seized whether `p` was attached with `PTRACE_SEIZE` instead of forked
+   * @param indexOptions how the debug information is indexed
    */
-  Debugger(std::string name, pid_t p);
+  Debugger(std::string name, pid_t p, bool seized = false, const IndexOptions &indexOptions = IndexOptions{});
 
   /**
    * @brief The entry point of the debugger
    *
    */
   void run();
+
+  /**
+   * @brief Wait for the first stop of the tracee and read its layout, as
+   * `run` does before the prompt
+   *
+   * @return false if the load address cannot be read, an attached process
+   * is detached
+   */
+  bool start();
+
+  /**
+   * @brief Run one command as if typed at the prompt
+   *
+   * @details Inside a `commands` block the line is added to the block
+   * instead. When the command stops at a breakpoint with commands, they
+   * are run next. A command of the list stopping at such a breakpoint
+   * again ends the list, and the commands of the new stop follow, so a
+   * list ending with `cont` runs on every hit until the process exits.
+   *
+   */
+  void execute(const std::string &line);
+
+  /**
+   * @brief Run the commands of the file `path` after the start, before
+   * the prompt or the batch input
+   *
+   */
+  void addScript(const std::string &path);
+
+  /**
+   * @brief The entry point of the batch mode: run the commands of `input`
+   * back to back, without a prompt, and write a JSON record for each of
+   * them on stdout
+   *
+   */
+  void runBatch(std::istream &input);
+
+  /**
+   * @brief The entry point of the profile mode: sample the program from
+   * its start instead of running the prompt
+   *
+   */
+  void runProfiler(const ProfileOptions &options);
+
+  /**
+   * @brief Sample the stacks of the running tracee
+   *
+   * @details Stop every thread of the tracee each period, unwind their
+   * stacks and resume them. When the stops exceed the overhead budget
+   * the period is doubled. Samples are symbolized after the capture and
+   * written as folded stacks.
+   *
+   */
+  void profile(const ProfileOptions &options);
+
+  /**
+   * @brief Remove every breakpoint and stop tracing the process, which
+   * keeps running
+   *
+   */
+  void detach();
+
+  /**
+   * @brief In non-stop mode a stop only halts the thread which reports it,
+   * and `cont` only resumes the current thread
+   *
+   */
+  void setNonStop(bool enabled);
+
+  /**
+   * @brief Evaluate conditions and collect tracepoints in the tracee,
+   * with trampolines of an injected agent, instead of stopping on every hit
+   *
+   */
+  void setAgent(bool enabled);
 };
 
 #endif  // DEBUGGER_H
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief The control flow classes the stepping logic cares about
+ *
+ */
+enum class InstructionKind { other, call, indirectCall, jump, indirectJump, conditionalJump, ret };
+
+struct Instruction {
+  uint64_t address;            /**< virtual address of the first byte */
+  std::size_t length;          /**< length in bytes, including prefixes */
+  InstructionKind kind;        /**< control flow class */
+  uint64_t target;             /**< destination of direct calls and jumps */
+  std::size_t ripDisplacement; /**< offset of the disp32 of a RIP relative operand, 0 if there is none */
+};
+
+/**
+ * @brief Decode the length and the control flow class of one x86-64
+ * instruction
+ *
+ * @details Only the encoding is parsed: legacy and REX prefixes, VEX and
+ * EVEX prefixes, the one, two and three byte opcode maps, ModRM, SIB,
+ * displacement and immediate. Operands are not decoded except for the
+ * relative offset of direct branches and the position of a RIP relative
+ * displacement.
+ *
+ * @param code the bytes of the instruction, without INT3 patches
+ * @param size the number of bytes available in `code`
+ * @param address the virtual address of `code`
+ * @param instruction the decoded instruction
+ * @return false if the bytes are not a valid 64 bit instruction
+ */
+bool decodeInstruction(const uint8_t *code, std::size_t size, uint64_t address, Instruction &instruction);
+
+#endif  // DECODER_H
@@ -0,0 +1,104 @@
+#ifndef HARDWAREBREAKPOINT_H
+#define HARDWAREBREAKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+
+/**
+ * @brief What a debug register should trap on, the values are the
+ * R/W field encoding of DR7
+ *
+ */
+enum class HardwareBreakpointKind { execute = 0b00, write = 0b01, readWrite = 0b11 };
+
+class HardwareBreakpoint {
+private:
+  pid_t pid;
+  unsigned slot; /**< which of DR0-DR3 is used */
+  std::intptr_t address;
+  HardwareBreakpointKind kind;
+  std::size_t length; /**< 1, 2, 4 or 8 bytes, always 1 for execute */
+  bool enabled;
+
+public:
+  static constexpr unsigned slotsNumber = 4;
+
+  HardwareBreakpoint() = default;
+  /**
+   * @brief Construct a new Hardware Breakpoint object
+   *
+   * @param p the current process
+   * @param s the debug register slot, from 0 to 3
+   * @param addr the virtual address, aligned to `len`
+   * @param k the access to trap on
+   * @param len the watched length
+   */
+  HardwareBreakpoint(pid_t p, unsigned s, std::intptr_t addr, HardwareBreakpointKind k, std::size_t len = 1);
+
+  /**
+   * @brief Program DR<slot> with the address and turn on its
+   * local enable, R/W and LEN bits in DR7
+   *
+   * @details Use `PTRACE_POKEUSER` at `offsetof(struct user, u_debugreg)`
+   *
+   * @return false if the debug registers could not be written, the slot
+   * stays disabled
+   */
+  bool enable();
+
+  /**
+   * @brief Clear the local enable bit of the slot in DR7
+   *
+   */
+  void disable();
+
+  /**
+   * @brief Program the slot in the debug registers of thread `tid`
+   *
+   * @note Debug registers are per thread and not inherited by clones,
+   * `enable` only programs the thread given at construction.
+   *
+   * @return false if the debug registers could not be written
+   */
+  bool install(pid_t tid) const;
+
+  /**
+   * @brief Clear the local enable bit of the slot in thread `tid`
+   *
+   */
+  void uninstall(pid_t tid) const;
+
+  bool isEnabled() const { return enabled; }
+
+  std::intptr_t getAddress() const { return address; }
+
+  unsigned getSlot() const { return slot; }
+
+  HardwareBreakpointKind getKind() const { return kind; }
+
+  std::size_t getLength() const { return length; }
+
+  /**
+   * @brief Read DR7 of thread `tid`, to turn every slot off for a while
+   * and restore it with `writeControl`
+   *
+   */
+  static uint64_t readControl(pid_t tid);
+
+  static void writeControl(pid_t tid, uint64_t value);
+
+  /**
+   * @brief Read DR6, whose lower 4 bits tell which slots have triggered
+   *
+   */
+  static uint64_t readStatus(pid_t pid);
+
+  /**
+   * @brief Reset DR6, the processor never clears it by itself
+   *
+   */
+  static void clearStatus(pid_t pid);
+};
+
+#endif  // HARDWAREBREAKPOINT_H
@@ -0,0 +1,202 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include "elf/elf++.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A symbol, line and CFI index saved on disk for one build of a
+ * program, identified by its `.note.gnu.build-id`
+ *
+ * @details The file is a header followed by tables of fixed size records
+ * which refer to each other by index and to strings by offset, so it is
+ * used in place once mapped. Function names are found through an open
+ * addressing hash table.
+ *
+ */
+class IndexFile {
+public:
+  struct UnitRange {
+    uint64_t low;
+    uint64_t high;
+    uint64_t unit; /**< index in `compilation_units()` */
+  };
+
+  struct Function {
+    uint64_t low;
+    uint64_t high;
+    uint64_t dieOffset; /**< offset of the subprogram in `.debug_info` */
+    uint32_t unit;      /**< index in `compilation_units()` */
+    uint32_t name;      /**< offset in the strings */
+  };
+
+  struct Line {
+    uint64_t low;
+    uint64_t high;
+    uint32_t file; /**< offset in the strings */
+    uint32_t line;
+  };
+
+  struct Name {
+    uint32_t name;     /**< offset in the strings, `emptySlot` if unused */
+    uint32_t function; /**< index in the functions */
+  };
+
+  struct Cie {
+    uint64_t codeAlignment;
+    int64_t dataAlignment;
+    uint64_t instructions; /**< offset in the section */
+    uint64_t length;
+    uint32_t returnAddressRegister;
+    uint8_t pointerEncoding;
+    uint8_t isEhFrame; /**< in `.eh_frame` rather than `.debug_frame` */
+    uint16_t padding;
+  };
+
+  struct Fde {
+    uint64_t low;
+    uint64_t high;
+    uint64_t cie;          /**< index in the CIEs */
+    uint64_t instructions; /**< offset in the section of its CIE */
+    uint64_t length;
+  };
+
+  /**
+   * @brief A table of the mapped file
+   *
+   */
+  template <typename T>
+  struct Table {
+    const T *first = nullptr;
+    const T *last = nullptr;
+
+    const T *begin() const { return first; }
+
+    const T *end() const { return last; }
+
+    std::size_t size() const { return last - first; }
+
+    const T &operator[](std::size_t i) const { return first[i]; }
+  };
+
+  /**
+   * @brief What is written, tables of ranges are sorted by `low`
+   *
+   */
+  struct Contents {
+    uint64_t unitCount = 0;
+    std::vector<UnitRange> unitRanges;
+    std::vector<Function> functions;
+    std::vector<Line> lines;
+    std::vector<std::pair<uint32_t, uint32_t>> names; /**< name string and function index */
+    std::vector<Cie> cies;
+    std::vector<Fde> fdes;
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+
+    /**
+     * @brief Add a string once
+     *
+     * @return uint32_t its offset in `strings`
+     */
+    uint32_t addString(const std::string &s);
+  };
+
+  static constexpr uint32_t emptySlot = UINT32_MAX;
+
+private:
+  enum TableId {
+    unitRangesTable,
+    functionsTable,
+    linesTable,
+    namesTable,
+    ciesTable,
+    fdesTable,
+    stringsTable,
+    tablesNumber
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t buildIdSize;
+    uint8_t buildId[64];
+    uint64_t unitCount;
+    uint64_t offsets[tablesNumber]; /**< from the start of the file */
+    uint64_t counts[tablesNumber];  /**< records, or bytes for the strings */
+  };
+
+  const uint8_t *data = nullptr; /**< the mapping, nullptr if not open */
+  std::size_t size = 0;
+
+  template <typename T>
+  Table<T> getTable(TableId id) const;
+
+public:
+  IndexFile() = default;
+
+  IndexFile(const IndexFile &) = delete;
+
+  IndexFile &operator=(const IndexFile &) = delete;
+
+  ~IndexFile();
+
+  /**
+   * @brief Read the build id of `ef`
+   *
+   * @return std::string the raw bytes, empty without the note
+   */
+  static std::string getBuildId(const elf::elf &ef);
+
+  /**
+   * @brief The file of a build in `directory`, named after the hex build id
+   *
+   */
+  static std::string getPath(const std::string &directory, const std::string &buildId);
+
+  /**
+   * @brief Write `contents` to `path` through a temporary file, creating
+   * the directories
+   *
+   * @return false on failure, nothing is left behind
+   */
+  static bool write(const std::string &path, const std::string &buildId, const Contents &contents);
+
+  /**
+   * @brief Map `path` if it is a valid index of `buildId`
+   *
+   * @return false if it is missing, of another build or damaged
+   */
+  bool open(const std::string &path, const std::string &buildId);
+
+  bool isOpen() const { return data != nullptr; }
+
+  uint64_t getUnitCount() const;
+
+  Table<UnitRange> getUnitRanges() const;
+
+  Table<Function> getFunctions() const;
+
+  Table<Line> getLines() const;
+
+  Table<Cie> getCies() const;
+
+  Table<Fde> getFdes() const;
+
+  const char *getString(uint32_t offset) const;
+
+  /**
+   * @brief Find the functions with a plain, mangled or demangled name
+   *
+   * @return std::vector<uint32_t> indexes in the functions
+   */
+  std::vector<uint32_t> findFunctions(const std::string &name) const;
+};
+
+#endif  // INDEXFILE_H
@@ -0,0 +1,221 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include "sys/ptrace.h"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief What the debugger is waiting for, its wall time is split by phase
+ *
+ */
+enum class Phase {
+  other,   /**< the debugger itself */
+  tracee,  /**< blocked in `waitpid`, the tracee runs */
+  syscall, /**< `ptrace` requests and memory transfers */
+  dwarf,   /**< line, function and CFI lookups */
+  source   /**< printing source lines */
+};
+
+constexpr std::size_t phasesNumber = 5;
+
+/**
+ * @brief The costs of the runs of one command
+ *
+ */
+struct CommandStats {
+  uint64_t runs = 0;
+  uint64_t ptraceCalls = 0;
+  uint64_t waitCalls = 0;
+  uint64_t memoryCalls = 0;                  /**< `process_vm_readv` and `/proc/<pid>/mem` transfers */
+  uint64_t bytes = 0;                        /**< moved from or to the tracee */
+  std::array<uint64_t, phasesNumber> time{}; /**< nanoseconds by phase, each spent in one only */
+
+  uint64_t getWallTime() const;
+};
+
+/**
+ * @brief Count and time the syscalls made on the tracee and the phases of
+ * the commands
+ *
+ * @details Phases nest: entering one stops the clock of the enclosing
+ * one, so every nanosecond of a command is charged to a single phase. The
+ * costs go to the innermost running command, or to `(none)` outside of
+ * them. With a log open, every phase and command is also written as a
+ * complete event of the Chrome trace event format, which Perfetto and
+ * `chrome://tracing` load.
+ *
+ */
+class Instrumentation {
+private:
+  std::map<std::string, CommandStats> commands; /**< by name */
+  std::vector<CommandStats *> running;          /**< nested commands, innermost last */
+  std::vector<Phase> phases;                    /**< nested phases, innermost last */
+  uint64_t resumed = 0;                         /**< when the clock of the innermost phase restarted */
+  std::map<long, uint64_t> ptraceRequests;      /**< calls by request */
+  std::ofstream log;                            /**< the trace events, if open */
+  bool firstEvent = true;
+  uint64_t origin; /**< timestamps of the log are relative to it */
+
+  Instrumentation();
+
+  CommandStats &current();
+
+  /**
+   * @brief Charge the time since `resumed` to the innermost phase
+   *
+   */
+  void charge(uint64_t now);
+
+  void writeEvent(const std::string &name, const char *category, uint64_t start, uint64_t end);
+
+public:
+  Instrumentation(const Instrumentation &) = delete;
+  Instrumentation &operator=(const Instrumentation &) = delete;
+  ~Instrumentation();
+
+  static Instrumentation &get();
+
+  /**
+   * @brief Nanoseconds of the steady clock
+   *
+   */
+  static uint64_t now();
+
+  /**
+   * @brief Start `phase`, the enclosing one stops
+   *
+   * @return uint64_t the start, to give to `leave`
+   */
+  uint64_t enter(Phase phase);
+
+  /**
+   * @brief End the innermost phase, the enclosing one goes on
+   *
+   * @param name of its trace event
+   */
+  void leave(uint64_t start, const char *name);
+
+  void beginCommand(const std::string &name);
+
+  void endCommand(const std::string &name, uint64_t start);
+
+  void countPtrace(long request);
+
+  void countWait();
+
+  void countTransfer(std::size_t bytes);
+
+  /**
+   * @brief Write the trace events to `path` from now on
+   *
+   * @return false if it cannot be created
+   */
+  bool openLog(const std::string &path);
+
+  void closeLog();
+
+  void reset();
+
+  /**
+   * @brief Print the costs of every command and the `ptrace` requests
+   *
+   */
+  void dump();
+
+  /**
+   * @brief A phase for the lifetime of the object
+   *
+   */
+  class Scope {
+  private:
+    const char *name;
+    uint64_t start;
+
+  public:
+    Scope(Phase phase, const char *n) : name{n}, start{get().enter(phase)} {}
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() { get().leave(start, name); }
+  };
+
+  /**
+   * @brief A command for the lifetime of the object
+   *
+   */
+  class Command {
+  private:
+    std::string name;
+    uint64_t start;
+
+  public:
+    explicit Command(std::string n) : name{std::move(n)}, start{now()} { get().beginCommand(name); }
+    Command(const Command &) = delete;
+    Command &operator=(const Command &) = delete;
+    ~Command() { get().endCommand(name, start); }
+  };
+};
+
+/**
+ * @brief Escape `text` for a JSON string, without the quotes
+ *
+ */
+std::string escapeJson(const std::string &text);
+
+/**
+ * @brief Get the name of a `ptrace` request, such as `PTRACE_CONT`
+ *
+ */
+const char *getPtraceRequestName(long request);
+
+/**
+ * @brief `ptrace`, counted and timed
+ *
+ */
+template <typename Address, typename Data>
+long tracedPtrace(enum __ptrace_request request, pid_t pid, Address address, Data data) {
+  auto &instrumentation = Instrumentation::get();
+  auto start = instrumentation.enter(Phase::syscall);
+  auto result = ptrace(request, pid, address, data);
+  // `PTRACE_PEEKDATA` and others report errors through `errno` only
+  auto error = errno;
+  instrumentation.countPtrace(request);
+  instrumentation.leave(start, getPtraceRequestName(request));
+  errno = error;
+  return result;
+}
+
+/**
+ * @brief `waitpid`, whose time is charged to the tracee
+ *
+ */
+pid_t tracedWaitpid(pid_t pid, int *status, int options);
+
+/**
+ * @brief Run `transfer`, a syscall moving memory of the tracee, counted
+ * and timed as `name`
+ *
+ * @return ssize_t what `transfer` returns
+ */
+template <typename Transfer>
+ssize_t tracedTransfer(const char *name, Transfer transfer) {
+  auto &instrumentation = Instrumentation::get();
+  auto start = instrumentation.enter(Phase::syscall);
+  ssize_t result = transfer();
+  auto error = errno;
+  instrumentation.countTransfer(result > 0 ? result : 0);
+  instrumentation.leave(start, name);
+  errno = error;
+  return result;
+}
+
+#endif  // INSTRUMENTATION_H
@@ -2,15 +2,102 @@
 #define MEM_H
 
 #include "reg.h"
+#include "sys/user.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A line of `/proc/<pid>/maps`
+ *
+ */
+struct Mapping {
+  uint64_t low;
+  uint64_t high;
+  uint64_t offset; /**< file offset of `low` */
+  std::string permissions;
+  std::string path; /**< empty for anonymous mappings */
+};
+
+/**
+ * @brief The register file of one thread, cached for the current stop
+ *
+ */
+struct RegisterCache {
+  user_regs_struct regs;
+  bool valid; /**< whether `regs` reflects the stopped thread */
+  bool dirty; /**< whether `regs` must be written back before resuming */
+};
 
 class Memory {
 private:
-  pid_t pid;
+  pid_t pid;                                          /**< the process, whose address space is shared */
+  pid_t tid;                                          /**< the selected thread, target of the register accesses */
+  std::unordered_map<pid_t, RegisterCache> registers; /**< register caches by thread */
+  int memFd;                                          /**< `/proc/<pid>/mem`, opened on first use */
+
+  /**
+   * @brief Get the slot of register `r` inside the cached register file
+   *
+   */
+  uint64_t &registerSlot(Reg r);
+
+  /**
+   * @brief Open `/proc/<pid>/mem` if it is not opened yet
+   *
+   * @return int the file descriptor, -1 on failure
+   */
+  int openMemFile();
 
 public:
   Memory(pid_t p);
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+  ~Memory();
+
+  /**
+   * @brief Select the thread whose registers are accessed
+   *
+   */
+  void selectThread(pid_t t);
+
+  pid_t getThread() const { return tid; }
+
+  /**
+   * @brief Drop the register cache of an exited thread
+   *
+   */
+  void forgetThread(pid_t t);
+
+  /**
+   * @brief Fetch the whole register file of the selected thread with a
+   * single `PTRACE_GETREGS`
+   *
+   * @details Should be called once the thread has stopped, every
+   * register access afterwards is served from the cache.
+   *
+   */
+  void fetchRegisters();
+
+  /**
+   * @brief Write the cached register files back with a single
+   * `PTRACE_SETREGS` per thread if any register has been modified
+   *
+   */
+  void flushRegisters();
+
+  /**
+   * @brief Flush the dirty registers and drop the caches of every thread
+   *
+   * @note Must be called before the tracee is resumed, because the
+   * registers are no longer valid once it runs again.
+   *
+   */
+  void invalidateRegisters();
 
   /**
    * @brief Get the Register Value object
@@ -62,6 +149,41 @@ public:
    */
   void writeMemory(uint64_t address, uint64_t value);
 
+  /**
+   * @brief Read `length` bytes starting at `address` into `buffer`
+   *
+   * @details Use a single `process_vm_readv`, fall back to `pread` on
+   * `/proc/<pid>/mem` and finally to `PTRACE_PEEKDATA` word by word.
+   *
+   * @return std::size_t the number of bytes actually read
+   */
+  std::size_t readBlock(uint64_t address, void *buffer, std::size_t length);
+
+  /**
+   * @brief Write `length` bytes from `buffer` starting at `address`
+   *
+   * @details Use a single `pwrite` on `/proc/<pid>/mem`, which can also
+   * patch the read-only text segment, then fall back to
+   * `process_vm_writev` and finally to `PTRACE_POKEDATA`.
+   *
+   * @return std::size_t the number of bytes actually written
+   */
+  std::size_t writeBlock(uint64_t address, const void *buffer, std::size_t length);
+
+  /**
+   * @brief Dump `length` bytes starting at `address` as hex and ascii
+   *
+   * @details Read in fixed size chunks, stopping at the first short read.
+   *
+   */
+  void dumpMemory(uint64_t address, std::size_t length);
+
+  /**
+   * @brief Parse `/proc/<pid>/maps`
+   *
+   */
+  std::vector<Mapping> getMappings();
+
   /**
    * @brief Get the current PC from the current rip
    *
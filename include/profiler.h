@@ -0,0 +1,53 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct ProfileOptions {
+  unsigned frequency = 99;   /**< samples per second */
+  double duration = 10;      /**< seconds, 0 to profile until the tracee exits */
+  unsigned maxDepth = 64;    /**< frames kept per sample */
+  double maxOverhead = 0.05; /**< fraction of the time the tracee may spend stopped */
+  std::string output = "profile.folded";
+};
+
+/**
+ * @brief Raw stack samples, symbolized only once the capture is over
+ *
+ * @details Samples are kept as return addresses in one flat vector, so
+ * the sampling loop never touches the debug information.
+ *
+ */
+class Profiler {
+private:
+  std::vector<uint64_t> pcs;          /**< all the stacks, innermost frame first */
+  std::vector<std::size_t> stackEnds; /**< end of every sample in `pcs` */
+
+public:
+  /**
+   * @brief Record one stack
+   *
+   * @param stack the PCs of the sample, innermost frame first
+   */
+  void addSample(const std::vector<uint64_t> &stack);
+
+  std::size_t getSampleCount() const { return stackEnds.size(); }
+
+  /**
+   * @brief Write the samples as folded stacks for flame graphs
+   *
+   * @details Every distinct PC is symbolized once, then every distinct
+   * stack is written as `outer;...;inner count`.
+   *
+   * @param symbolize the name of the function containing a PC
+   * @return std::size_t the number of distinct stacks
+   */
+  std::size_t writeFolded(std::ostream &out, const std::function<std::string(uint64_t)> &symbolize) const;
+};
+
+#endif  // PROFILER_H
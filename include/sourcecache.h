@@ -0,0 +1,64 @@
+#ifndef SOURCECACHE_H
+#define SOURCECACHE_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Source files read once with the offset of every line, so that
+ * printing a window of a file does not read it from the start
+ *
+ * @note A file is read again when its size or modification time has
+ * changed since, the sources may be edited while debugging.
+ *
+ */
+class SourceCache {
+private:
+  struct File {
+    std::string text;                /**< the contents, empty if unreadable */
+    std::size_t size = 0;            /**< size of the file when read */
+    timespec modified{};             /**< modification time of the file when read */
+    std::vector<std::size_t> starts; /**< offset of every line, 1-based line n starts at starts[n - 1] */
+  };
+
+  std::unordered_map<std::string, File> files; /**< by path, unreadable files are kept too */
+
+  /**
+   * @brief Read `path` and index its lines on the first use or when it
+   * has changed
+   *
+   */
+  const File &load(const std::string &path);
+
+public:
+  SourceCache() = default;
+
+  /**
+   * @brief Get the number of lines of `path`
+   *
+   * @return unsigned 0 if the file cannot be read
+   */
+  unsigned getLineCount(const std::string &path);
+
+  /**
+   * @brief Get a line without its newline
+   *
+   * @param path the source file
+   * @param line the 1-based line number
+   * @param text set to the start of the line, valid until the next call
+   * @param length set to the length of the line
+   * @return false if the file has no such line
+   */
+  bool getLine(const std::string &path, unsigned line, const char *&text, std::size_t &length);
+
+  /**
+   * @brief Drop every file
+   *
+   */
+  void clear();
+};
+
+#endif  // SOURCECACHE_H
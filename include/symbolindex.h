@@ -0,0 +1,323 @@
+#ifndef SYMBOLINDEX_H
+#define SYMBOLINDEX_H
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+#include "indexfile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class symType { notype, object, func, section, file };
+
+static std::string symToString(symType st) {
+  switch (st) {
+    case symType::notype:
+      return "notype";
+    case symType::object:
+      return "object";
+    case symType::func:
+      return "func";
+    case symType::section:
+      return "section";
+    case symType::file:
+      return "file";
+    default:
+      return "";
+  }
+}
+
+struct Sym {
+  symType type;
+  std::string name;
+  std::uintptr_t address;
+};
+
+static symType elfToSymType11(elf::stt sym) {
+  switch (sym) {
+    case elf::stt::notype:
+      return symType::notype;
+    case elf::stt::object:
+      return symType::object;
+    case elf::stt::func:
+      return symType::func;
+    case elf::stt::section:
+      return symType::section;
+    case elf::stt::file:
+      return symType::file;
+    default:
+      return symType::notype;
+  }
+}
+
+/**
+ * @brief How the debug information is indexed
+ *
+ */
+struct IndexOptions {
+  bool lazy = false;                /**< parse a unit on the first lookup falling in it */
+  std::size_t maxIndexedUnits = 64; /**< unit indexes kept in lazy mode, not the libelfin units */
+  std::string cacheDirectory;       /**< where the index files are saved, empty not to save them */
+  unsigned threads = 0;             /**< threads indexing the units, 0 for one per core */
+};
+
+/**
+ * @brief Sorted address intervals built once from the DWARF information
+ * so that every PC lookup is a couple of binary searches instead of a walk
+ * over all the compilation units and DIEs.
+ *
+ * @details In lazy mode only the unit ranges are read at startup, from
+ * `.debug_aranges` or the root DIE of the units it does not cover. The
+ * functions and line rows of a unit are indexed on its first lookup and
+ * at most `maxIndexedUnits` indexed units are kept.
+ *
+ * With an `IndexFile`, the unit ranges and the name table are read from
+ * it and units are indexed on demand as well. Function names and source
+ * lines are answered by the file without indexing any unit.
+ *
+ * @note Only the memory of this index is bounded. libelfin caches the
+ * abbreviations and line table of every unit it has parsed for the
+ * lifetime of the `dwarf::dwarf`, which offers no way to release them.
+ *
+ */
+class SymbolIndex {
+private:
+  struct FunctionRange {
+    uint64_t low;
+    uint64_t high;
+    dwarf::die die;
+  };
+
+  struct LineRange {
+    uint64_t low;
+    uint64_t high;
+    dwarf::line_table::iterator entry;
+  };
+
+  struct UnitRange {
+    uint64_t low;
+    uint64_t high;
+    std::size_t unit; /**< index in `units` */
+  };
+
+  struct SymbolRange {
+    uint64_t low;
+    uint64_t high;
+    std::string name; /**< demangled if it can be */
+  };
+
+  struct UnitIndex {
+    bool parsed = false;                  /**< `functions` and `lines` are built */
+    uint64_t lastUse = 0;                 /**< `useClock` of the last lookup */
+    std::vector<FunctionRange> functions; /**< subprograms sorted by low pc */
+    std::vector<LineRange> lines;         /**< line rows sorted by address */
+  };
+
+  std::vector<UnitRange> unitRanges; /**< compilation unit ranges sorted by low pc */
+  std::vector<UnitIndex> units;      /**< in the order of `compilation_units()` */
+  std::size_t parsedUnits = 0;       /**< units with `parsed` set */
+  uint64_t useClock = 0;             /**< counts the unit lookups */
+  IndexOptions options;
+
+  const dwarf::dwarf *pDwarf = nullptr;
+  const elf::elf *pElf = nullptr;
+  const IndexFile *indexFile = nullptr; /**< the saved index, if loaded */
+  bool functionNamesBuilt = false;
+  bool symbolNamesBuilt = false;
+  bool symbolRangesBuilt = false;
+  std::unordered_map<std::string, std::vector<dwarf::die>> functionsByName; /**< plain, mangled and demangled names */
+  std::unordered_map<std::string, std::vector<Sym>> symbolsByName;          /**< ELF names and demangled names */
+  std::vector<dwarf::die> resolvedFunctions;                                /**< result of a lazy `findFunctions` */
+  std::vector<SymbolRange> symbolRanges;                                    /**< function symbols sorted by low */
+
+  /**
+   * @brief Build the function name table from every DIE, on the first
+   * function name lookup
+   *
+   */
+  void buildFunctionNames();
+
+  /**
+   * @brief Build the symbol name table on the first symbol lookup
+   *
+   */
+  void buildSymbolNames();
+
+  /**
+   * @brief Build the address table of the function symbols on the first
+   * symbol address lookup
+   *
+   */
+  void buildSymbolRanges();
+
+  /**
+   * @brief The threads of a walk over all the units
+   *
+   */
+  unsigned getThreadCount() const;
+
+  /**
+   * @brief Load the DWARF sections and the abbreviations of every unit
+   * read while indexing before the walk is split across threads
+   *
+   */
+  void loadSections() const;
+
+  /**
+   * @brief Read the unit ranges of `.debug_aranges`
+   *
+   * @return std::vector<bool> the units covered, by index in `units`
+   */
+  std::vector<bool> readAddressRanges();
+
+  /**
+   * @brief Add the ranges of the root DIE of a unit to `unitRanges`
+   *
+   */
+  void addUnitRanges(std::size_t index);
+
+  /**
+   * @brief Collect the functions and line rows of a unit
+   *
+   */
+  void indexUnit(std::size_t index, UnitIndex &unit) const;
+
+  /**
+   * @brief Index a unit, dropping the least recently used one in lazy
+   * mode when `maxIndexedUnits` are kept
+   *
+   */
+  void parseUnit(std::size_t index);
+
+  /**
+   * @brief Get a unit, indexing it if needed
+   *
+   */
+  const UnitIndex &useUnit(std::size_t index);
+
+  /**
+   * @brief Find the interval containing `pc` in [begin, end) sorted by `low`
+   *
+   */
+  template <typename T>
+  static const T *findRange(const T *begin, const T *end, uint64_t pc);
+
+  template <typename T>
+  static const T *findRange(const std::vector<T> &ranges, uint64_t pc) {
+    return findRange(ranges.data(), ranges.data() + ranges.size(), pc);
+  }
+
+  /**
+   * @brief Extend `range` over the adjacent ranges of the same line
+   *
+   */
+  template <typename T, typename SameLine>
+  static void extendLineRange(
+      const T *begin, const T *end, const T *range, SameLine sameLine, uint64_t &low, uint64_t &high);
+
+  /**
+   * @brief Find the compilation unit which contains `pc`, indexing it if
+   * needed
+   *
+   */
+  const UnitIndex *findUnit(uint64_t pc);
+
+public:
+  SymbolIndex() = default;
+
+  /**
+   * @brief Build the address index from every compilation unit of `dw`,
+   * or only the unit ranges in lazy mode
+   *
+   * @note The name index is only built on the first name lookup, `dw`
+   * and `ef` must outlive the index.
+   */
+  SymbolIndex(const dwarf::dwarf &dw,
+              const elf::elf &ef,
+              const IndexOptions &indexOptions = IndexOptions{},
+              const IndexFile *index = nullptr);
+
+  /**
+   * @brief Fill the symbol and line tables of an index file, indexing
+   * every unit without keeping them
+   *
+   */
+  void exportIndex(IndexFile::Contents &contents);
+
+  /**
+   * @brief Find the subprogram containing `pc`
+   *
+   * @note In lazy mode, the result is valid until a lookup indexes
+   * another unit.
+   *
+   * @param pc the PC relative to the load address
+   * @return const dwarf::die* nullptr if no function contains `pc`
+   */
+  const dwarf::die *findFunction(uint64_t pc);
+
+  /**
+   * @brief Find the line table row containing `pc`
+   *
+   * @note In lazy mode, the result is valid until a lookup indexes
+   * another unit.
+   *
+   * @param pc the PC relative to the load address
+   * @return const dwarf::line_table::iterator* nullptr if no row contains `pc`
+   */
+  const dwarf::line_table::iterator *findLineEntry(uint64_t pc);
+
+  /**
+   * @brief Find the addresses of the source line containing `pc`
+   *
+   * @details Adjacent rows of the same file and line are merged, so
+   * [low, high) is what a `next` has to leave.
+   *
+   * @return false if no row contains `pc`
+   */
+  bool findLineRange(uint64_t pc, uint64_t &low, uint64_t &high);
+
+  /**
+   * @brief Get the name of the function containing `pc`
+   *
+   * @return std::string empty if no function contains `pc`
+   */
+  std::string findFunctionName(uint64_t pc);
+
+  /**
+   * @brief Get the file and line of `pc`
+   *
+   * @return false if no row contains `pc`
+   */
+  bool findSourceLine(uint64_t pc, std::string &file, unsigned &line);
+
+  /**
+   * @brief Find the subprogram definitions called `name`
+   *
+   * @details In lazy mode the name is looked up in the ELF symbols and
+   * only the units defining them are indexed. The DIE walk of every unit
+   * is the fallback, for the functions without symbols.
+   *
+   * @param name the plain, mangled or demangled name
+   */
+  const std::vector<dwarf::die> &findFunctions(const std::string &name);
+
+  /**
+   * @brief Get the name of the `symtab` or `dynsym` function containing
+   * `pc`, for code without debug information
+   *
+   * @return std::string empty if no function symbol contains `pc`
+   */
+  std::string findSymbolName(uint64_t pc);
+
+  /**
+   * @brief Find the `symtab` and `dynsym` entries called `name`
+   *
+   * @param name the mangled or demangled name
+   */
+  const std::vector<Sym> &findSymbols(const std::string &name);
+};
+
+#endif  // SYMBOLINDEX_H
@@ -0,0 +1,52 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include "mem.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Get the name of the x86-64 syscall `number`
+ *
+ * @return std::string `syscall_<number>` if it is unknown
+ */
+std::string syscallName(long number);
+
+/**
+ * @brief Get the number of a syscall by its name
+ *
+ * @return long -1 if it is unknown
+ */
+long syscallNumber(const std::string &name);
+
+/**
+ * @brief Format a syscall entry as `name(args...)`
+ *
+ * @details The number comes from `orig_rax` and the arguments from rdi,
+ * rsi, rdx, r10, r8 and r9 of the selected thread of `memory`.
+ *
+ */
+std::string formatSyscallEntry(Memory &memory);
+
+/**
+ * @brief Format a syscall return value, with the error message of
+ * `-errno` values
+ *
+ */
+std::string formatSyscallReturn(int64_t value);
+
+/**
+ * @brief Install a seccomp filter which only makes `numbers`, or every
+ * syscall if it is empty, stop the tracer with `SECCOMP_RET_TRACE`
+ *
+ * @note Must be called by the tracee itself, after `PTRACE_TRACEME` and
+ * once the tracer has set `PTRACE_O_TRACESECCOMP`. Without that option the
+ * filtered syscalls would fail with `ENOSYS`.
+ *
+ * @return false if the filter could not be installed
+ */
+bool installSyscallFilter(const std::vector<long> &numbers);
+
+#endif  // SYSCALLS_H
@@ -0,0 +1,91 @@
+#ifndef SYSCALLTRACER_H
+#define SYSCALLTRACER_H
+
+#include "mem.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+struct SyscallOptions {
+  std::vector<long> numbers; /**< syscalls to trace, empty for all */
+  bool summary = true;       /**< print the time spent per syscall at the end */
+};
+
+/**
+ * @brief An strace-like mode, printing every syscall with its duration
+ *
+ * @details A tracee launched by us installs a seccomp filter so that
+ * only the selected syscalls stop it. Each stop at entry is followed by a
+ * `PTRACE_SYSCALL` to see the exit, then the tracee runs freely again.
+ * Attached processes cannot get a filter, they stop at every syscall and
+ * are filtered here.
+ *
+ */
+class SyscallTracer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+private:
+  /**
+   * @brief A syscall which has entered and not returned yet
+   *
+   */
+  struct Call {
+    long number;
+    bool wanted; /**< whether it is printed */
+    std::string text;
+    Clock::time_point start;
+  };
+
+  /**
+   * @brief The statistics of one syscall
+   *
+   */
+  struct Totals {
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    double seconds = 0;
+  };
+
+  pid_t pid;
+  bool seized;                             /**< attached with `PTRACE_SEIZE` */
+  bool filtered = false;                   /**< the tracee runs with our seccomp filter */
+  Memory memory;                           /**< register caches of the threads */
+  std::vector<long> numbers;               /**< sorted, empty for all */
+  std::unordered_map<pid_t, Call> calls;   /**< the current syscall of every thread */
+  std::unordered_map<long, Totals> totals; /**< statistics by syscall number */
+
+  bool isWanted(long number) const;
+
+  /**
+   * @brief Resume a thread until its next stop of interest
+   *
+   */
+  void resume(pid_t tid, int signal = 0);
+
+  void enter(pid_t tid);
+
+  void leave(pid_t tid);
+
+  void printSummary();
+
+public:
+  SyscallTracer(pid_t p, bool s);
+  SyscallTracer(const SyscallTracer &) = delete;
+  SyscallTracer &operator=(const SyscallTracer &) = delete;
+
+  /**
+   * @brief Trace until the process exits
+   *
+   * @details A launched tracee must stop itself with `SIGSTOP` before
+   * installing the filter, so that `PTRACE_O_TRACESECCOMP` can be set.
+   *
+   */
+  void run(const SyscallOptions &options);
+};
+
+#endif  // SYSCALLTRACER_H
@@ -0,0 +1,78 @@
+#ifndef TRACEBUFFER_H
+#define TRACEBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief A decoded tracepoint record
+ *
+ */
+struct TraceRecord {
+  unsigned tracepoint; /**< number of the tracepoint */
+  pid_t tid;           /**< thread which hit it */
+  uint64_t timestamp;  /**< nanoseconds of the steady clock */
+  std::vector<int64_t> values;
+};
+
+/**
+ * @brief Ring buffer of binary tracepoint records
+ *
+ * @details A record is a fixed header followed by its values, written
+ * back to back with wrap around. When the buffer is full the oldest
+ * records are overwritten, nothing is allocated while tracing.
+ *
+ */
+class TraceBuffer {
+private:
+  /**
+   * @brief The header written in front of the values
+   *
+   */
+  struct Header {
+    uint32_t tracepoint;
+    int32_t tid;
+    uint64_t timestamp;
+    uint32_t count; /**< number of values */
+  };
+
+  std::vector<uint8_t> storage;
+  std::size_t tail = 0;  /**< offset of the oldest record */
+  std::size_t used = 0;  /**< bytes in use from `tail` */
+  uint64_t recorded = 0; /**< records written since the last clear */
+  uint64_t dropped = 0;  /**< records overwritten since the last clear */
+
+  void copyIn(std::size_t offset, const void *data, std::size_t length);
+
+  void copyOut(std::size_t offset, void *data, std::size_t length) const;
+
+public:
+  /**
+   * @brief Construct a new Trace Buffer object
+   *
+   * @param capacity the size of the ring in bytes
+   */
+  explicit TraceBuffer(std::size_t capacity = 1 << 20);
+
+  /**
+   * @brief Append a record, overwriting the oldest ones if needed
+   *
+   */
+  void record(unsigned tracepoint, pid_t tid, uint64_t timestamp, const std::vector<int64_t> &values);
+
+  /**
+   * @brief Decode the records, oldest first
+   *
+   */
+  std::vector<TraceRecord> decode() const;
+
+  void clear();
+
+  uint64_t getRecorded() const { return recorded; }
+
+  uint64_t getDropped() const { return dropped; }
+};
+
+#endif  // TRACEBUFFER_H
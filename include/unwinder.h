@@ -0,0 +1,145 @@
+#ifndef UNWINDER_H
+#define UNWINDER_H
+
+#include "elf/elf++.hh"
+#include "indexfile.h"
+#include "mem.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Call frame information of a stack frame, registers use the
+ * DWARF numbering: 0-15 are the general purpose registers, 16 is the
+ * return address
+ *
+ */
+struct Frame {
+  static constexpr unsigned registersNumber = 17;
+
+  uint64_t pc = 0;    /**< the PC, or the return address in callers */
+  unsigned depth = 0; /**< 0 for the innermost frame */
+  std::array<uint64_t, registersNumber> regs{};
+  std::array<bool, registersNumber> valid{};
+};
+
+/**
+ * @brief Unwind the stack with the CFI of `.eh_frame` and `.debug_frame`
+ *
+ * @details The CIEs and FDE headers are parsed once and the FDEs sorted
+ * by PC range. The CFA program of an FDE is only run the first time a PC
+ * falls in it, and the resulting rows are cached.
+ *
+ */
+class Unwinder {
+private:
+  enum class RuleType : uint8_t { sameValue, undefined, offset, valOffset, reg, unsupported };
+
+  struct Rule {
+    RuleType type;
+    int64_t value; /**< offset from the CFA or register number */
+  };
+
+  struct Row {
+    uint64_t location;
+    unsigned cfaRegister;
+    int64_t cfaOffset;
+    bool cfaSupported; /**< false for CFA expressions */
+    std::array<Rule, Frame::registersNumber> rules;
+  };
+
+  struct Cie {
+    uint64_t codeAlignment;
+    int64_t dataAlignment;
+    unsigned returnAddressRegister;
+    uint8_t pointerEncoding;
+    const uint8_t *instructions;
+    std::size_t length;
+  };
+
+  struct Fde {
+    uint64_t low;
+    uint64_t high;
+    std::size_t cie; /**< index in `cies` */
+    const uint8_t *instructions;
+    std::size_t length;
+  };
+
+  std::vector<Cie> cies;
+  std::vector<Fde> fdes;                                      /**< sorted by low pc */
+  std::unordered_map<std::size_t, std::vector<Row>> rowCache; /**< rows by FDE index */
+
+  /**
+   * @brief Collect the CIEs and FDEs of a section
+   *
+   * @param isEhFrame `.eh_frame` and `.debug_frame` encode CIE pointers differently
+   */
+  void parseSection(const elf::section &section, bool isEhFrame);
+
+  /**
+   * @brief Take the CIEs and FDEs from an index file
+   *
+   * @return false if the index does not match the sections of `ef`
+   */
+  bool loadIndex(const elf::elf &ef, const IndexFile &index);
+
+  /**
+   * @brief Run the CFA programs of an FDE, or get the cached rows
+   *
+   */
+  const std::vector<Row> &getRows(std::size_t fde);
+
+  /**
+   * @brief Find the row describing `pc`
+   *
+   * @param pc an address of the ELF file, without the load address
+   */
+  const Row *findRow(uint64_t pc);
+
+public:
+  Unwinder() = default;
+
+  /**
+   * @brief Index the call frame information of `ef`, or take it from
+   * `index` if there is one
+   *
+   * @note `ef` must outlive the unwinder
+   */
+  explicit Unwinder(const elf::elf &ef, const IndexFile *index = nullptr);
+
+  /**
+   * @brief Fill the CFI tables of an index file
+   *
+   */
+  void exportIndex(const elf::elf &ef, IndexFile::Contents &contents) const;
+
+  /**
+   * @brief Whether there is call frame information for `pc`
+   *
+   * @param pc an address of the ELF file, without the load address
+   */
+  bool covers(uint64_t pc);
+
+  /**
+   * @brief Get the frame of the stopped tracee
+   *
+   */
+  static Frame currentFrame(Memory &memory);
+
+  /**
+   * @brief Compute the frame of the caller of `callee`
+   *
+   * @details Use the CFI if the PC has an FDE, otherwise follow the
+   * frame pointer chain. The stack pointer of the caller is the CFA of
+   * `callee`, i.e. its value once `callee` has returned.
+   *
+   * @param loadBias the load address of the ELF file
+   * @return false if there is no caller or it cannot be recovered
+   */
+  bool unwind(Memory &memory, uint64_t loadBias, const Frame &callee, Frame &caller);
+};
+
+#endif  // UNWINDER_H
@@ -0,0 +1,360 @@
+#include "agent.h"
+
+#include "assembler.h"
+#include "condition.h"
+#include "reg.h"
+#include "spdlog/spdlog.h"
+#include "sys/syscall.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <x86intrin.h>
+
+namespace {
+
+// Pushed in this order after the flags, `rbx` then points to the last one
+constexpr Gpr savedRegisters[] = {Gpr::rax,
+                                  Gpr::rcx,
+                                  Gpr::rdx,
+                                  Gpr::rbx,
+                                  Gpr::rbp,
+                                  Gpr::rsi,
+                                  Gpr::rdi,
+                                  Gpr::r8,
+                                  Gpr::r9,
+                                  Gpr::r10,
+                                  Gpr::r11,
+                                  Gpr::r12,
+                                  Gpr::r13,
+                                  Gpr::r14,
+                                  Gpr::r15};
+constexpr std::size_t savedCount = sizeof(savedRegisters) / sizeof(savedRegisters[0]);
+constexpr Reg savedRegs[savedCount] = {Reg::rax,
+                                       Reg::rcx,
+                                       Reg::rdx,
+                                       Reg::rbx,
+                                       Reg::rbp,
+                                       Reg::rsi,
+                                       Reg::rdi,
+                                       Reg::r8,
+                                       Reg::r9,
+                                       Reg::r10,
+                                       Reg::r11,
+                                       Reg::r12,
+                                       Reg::r13,
+                                       Reg::r14,
+                                       Reg::r15};
+constexpr int32_t redZone = 128;
+
+uint64_t nanosecondsNow() {
+  auto now = Breakpoint::Clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+/**
+ * @brief Save the state of the tracee below its red zone
+ *
+ */
+void saveRegisters(Assembler &assembler) {
+  assembler.lea(Gpr::rsp, Gpr::rsp, -redZone);
+  assembler.bytes({0x9c});  // pushfq
+  for (auto r : savedRegisters) {
+    assembler.push(r);
+  }
+  assembler.mov(Gpr::rbx, Gpr::rsp);
+}
+
+void restoreRegisters(Assembler &assembler) {
+  for (auto i = savedCount; i-- > 0;) {
+    assembler.pop(savedRegisters[i]);
+  }
+  assembler.bytes({0x9d});  // popfq
+  assembler.lea(Gpr::rsp, Gpr::rsp, redZone);
+}
+
+/**
+ * @brief Where the saved registers are for the compiled expressions
+ *
+ */
+Condition::NativeFrame getFrame(uint64_t pc, pid_t pid) {
+  Condition::NativeFrame frame;
+  frame.offsets.fill(-1);
+  for (std::size_t i = 0; i < savedCount; ++i) {
+    frame.offsets[static_cast<std::size_t>(savedRegs[i])] = static_cast<int32_t>((savedCount - 1 - i) * 8);
+  }
+  frame.offsets[static_cast<std::size_t>(Reg::rflags)] = static_cast<int32_t>(savedCount * 8);
+  frame.stackOffset = static_cast<int32_t>((savedCount + 1) * 8) + redZone;
+  frame.pc = pc;
+  frame.pid = pid;
+  return frame;
+}
+
+}  // namespace
+
+constexpr std::size_t Agent::jumpLength;
+constexpr std::size_t Agent::codeSize;
+constexpr std::size_t Agent::maxValues;
+constexpr std::size_t Agent::maxPoints;
+constexpr std::size_t Agent::dataSize;
+
+void Agent::attach(pid_t p, uint64_t code, uint64_t data) {
+  pid = p;
+  codeAddress = code;
+  dataAddress = data;
+  startTsc = __rdtsc();
+  startTime = nanosecondsNow();
+}
+
+bool Agent::addPoint(Memory &memory,
+                     const Breakpoint &bp,
+                     const std::vector<Instruction> &instructions,
+                     const std::vector<uint8_t> &original) {
+  if (nextSlot >= maxPoints) {
+    spdlog::info("The agent serves {} points at most", maxPoints);
+    return false;
+  }
+  auto collect = bp.getCollect();
+  if (collect && collect->size() > maxValues) {
+    spdlog::info("The agent collects {} values at most", maxValues);
+    return false;
+  }
+  Point point{bp.getAddress(), original, codeAddress + codeUsed, 0, nextSlot, collect != nullptr, false};
+  auto frame = getFrame(point.address, pid);
+
+  Assembler assembler{point.trampoline};
+  saveRegisters(assembler);
+  assembler.movImmediate(Gpr::rax, dataAddress + countersOffset + point.slot * sizeof(uint64_t));
+  assembler.bytes({0xf0, 0x48, 0xff, 0x00});  // lock inc qword [rax]
+
+  std::size_t stopBranch = 0;
+  if (collect) {
+    // Reserve a record, the sequence is cleared first and written last to
+    // publish it
+    assembler.movImmediate(Gpr::rdi, dataAddress);
+    assembler.movImmediate(Gpr::rax, 1);
+    assembler.bytes({0xf0, 0x48, 0x0f, 0xc1, 0x07});  // lock xadd [rdi], rax
+    assembler.mov(Gpr::r13, Gpr::rax);
+    assembler.bytes({0x48, 0x25});  // and rax, imm32
+    assembler.bytes({static_cast<uint8_t>(ringRecords - 1), static_cast<uint8_t>((ringRecords - 1) >> 8), 0, 0});
+    assembler.bytes({0x48, 0x69, 0xc0});  // imul rax, rax, imm32
+    assembler.bytes({static_cast<uint8_t>(recordSize), static_cast<uint8_t>(recordSize >> 8), 0, 0});
+    assembler.movImmediate(Gpr::r12, dataAddress + ringOffset);
+    assembler.bytes({0x49, 0x01, 0xc4});  // add r12, rax
+    // Invalidate the slot first, a drain copying it meanwhile drops it
+    assembler.bytes({0x31, 0xc0});  // xor eax, eax
+    assembler.store(Gpr::r12, offsetof(RecordHeader, sequence), Gpr::rax);
+    assembler.bytes({0x0f, 0x31, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0});  // rdtsc, shl rdx, 32, or rax, rdx
+    assembler.store(Gpr::r12, offsetof(RecordHeader, tsc), Gpr::rax);
+    assembler.movImmediate(Gpr::rax, SYS_gettid);
+    assembler.bytes({0x0f, 0x05});  // syscall
+    assembler.store(Gpr::r12, offsetof(RecordHeader, tid), Gpr::rax, false);
+    assembler.storeImmediate32(Gpr::r12, offsetof(RecordHeader, tracepoint), bp.getNumber());
+    assembler.storeImmediate32(Gpr::r12, offsetof(RecordHeader, count), collect->size());
+    for (std::size_t i = 0; i < collect->size(); ++i) {
+      if (!(*collect)[i].compile(frame, assembler)) {
+        spdlog::info("`{}` reads a register the agent does not save", (*collect)[i].getText());
+        return false;
+      }
+      assembler.store(Gpr::r12, sizeof(RecordHeader) + i * sizeof(int64_t), Gpr::rax);
+    }
+    assembler.lea(Gpr::rax, Gpr::r13, 1);
+    assembler.store(Gpr::r12, offsetof(RecordHeader, sequence), Gpr::rax);
+  } else if (bp.getCondition()) {
+    if (!bp.getCondition()->compile(frame, assembler)) {
+      spdlog::info("`{}` reads a register the agent does not save", bp.getCondition()->getText());
+      return false;
+    }
+    assembler.bytes({0x48, 0x85, 0xc0});  // test rax, rax
+    stopBranch = assembler.branch({0x0f, 0x85});
+  }
+  restoreRegisters(assembler);
+
+  // The replaced instructions, with their RIP relative operands moved
+  for (const auto &instruction : instructions) {
+    auto offset = instruction.address - point.address;
+    std::vector<uint8_t> copy(original.begin() + offset, original.begin() + offset + instruction.length);
+    if (instruction.ripDisplacement) {
+      int32_t displacement;
+      std::memcpy(&displacement, copy.data() + instruction.ripDisplacement, sizeof(displacement));
+      auto moved = displacement + static_cast<int64_t>(instruction.address - assembler.getAddress());
+      if (moved < INT32_MIN || moved > INT32_MAX) {
+        spdlog::info("The agent is too far from 0x{:x}", point.address);
+        return false;
+      }
+      displacement = static_cast<int32_t>(moved);
+      std::memcpy(copy.data() + instruction.ripDisplacement, &displacement, sizeof(displacement));
+    }
+    assembler.bytes(copy.data(), copy.size());
+  }
+  bool reachable = assembler.jump(point.address + original.size());
+
+  if (stopBranch) {
+    // Stopped with the registers of the tracee, it comes back to the
+    // original address if resumed here
+    assembler.bind(stopBranch);
+    restoreRegisters(assembler);
+    point.stop = assembler.getAddress();
+    assembler.bytes({0xcc});
+    reachable = reachable && assembler.jump(point.address);
+  }
+  auto rel = static_cast<int64_t>(point.trampoline - (point.address + jumpLength));
+  if (!reachable || rel < INT32_MIN || rel > INT32_MAX) {
+    spdlog::info("The agent is too far from 0x{:x}", point.address);
+    return false;
+  }
+
+  const auto &code = assembler.getCode();
+  if (codeUsed + code.size() > codeSize) {
+    spdlog::info("The code mapping of the agent is full");
+    return false;
+  }
+  if (memory.writeBlock(point.trampoline, code.data(), code.size()) != code.size()) {
+    spdlog::error("Cannot write the trampoline at 0x{:x}", point.trampoline);
+    return false;
+  }
+  codeUsed = (codeUsed + code.size() + 15) & ~std::size_t{15};
+  ++nextSlot;
+  points[point.address] = point;
+  return true;
+}
+
+void Agent::removePoint(Memory &memory, std::intptr_t address) {
+  auto it = points.find(address);
+  if (it == points.end()) {
+    return;
+  }
+  if (it->second.patched) {
+    unpatch(memory, it->second);
+  }
+  points.erase(it);
+}
+
+void Agent::patch(Memory &memory, Point &point) {
+  // The rest of the last replaced instruction is never reached
+  std::vector<uint8_t> bytes(point.original.size(), 0xcc);
+  auto rel = static_cast<int32_t>(point.trampoline - (point.address + jumpLength));
+  bytes[0] = 0xe9;
+  std::memcpy(bytes.data() + 1, &rel, sizeof(rel));
+  memory.writeBlock(point.address, bytes.data(), bytes.size());
+  point.patched = true;
+}
+
+void Agent::unpatch(Memory &memory, Point &point) {
+  memory.writeBlock(point.address, point.original.data(), point.original.size());
+  point.patched = false;
+}
+
+Agent::Point *Agent::findPoint(std::intptr_t address) {
+  auto it = points.find(address);
+  return it == points.end() ? nullptr : &it->second;
+}
+
+Agent::Point *Agent::findStop(uint64_t pc) {
+  for (auto &addressAndPoint : points) {
+    if (addressAndPoint.second.stop == pc && pc != 0) {
+      return &addressAndPoint.second;
+    }
+  }
+  return nullptr;
+}
+
+Agent::Point *Agent::findCovering(std::intptr_t address) {
+  for (auto &addressAndPoint : points) {
+    auto &point = addressAndPoint.second;
+    if (point.patched && address > point.address &&
+        address < point.address + static_cast<std::intptr_t>(point.original.size())) {
+      return &point;
+    }
+  }
+  return nullptr;
+}
+
+void Agent::hidePatches(uint64_t address, std::vector<uint8_t> &code) const {
+  for (const auto &addressAndPoint : points) {
+    const auto &point = addressAndPoint.second;
+    if (!point.patched) {
+      continue;
+    }
+    for (std::size_t i = 0; i < point.original.size(); ++i) {
+      auto byte = static_cast<uint64_t>(point.address) + i;
+      if (byte >= address && byte < address + code.size()) {
+        code[byte - address] = point.original[i];
+      }
+    }
+  }
+}
+
+uint64_t Agent::getHits(Memory &memory, const Point &point) const {
+  uint64_t hits = 0;
+  memory.readBlock(dataAddress + countersOffset + point.slot * sizeof(uint64_t), &hits, sizeof(hits));
+  return hits;
+}
+
+bool Agent::hasTracepoints() const {
+  for (const auto &addressAndPoint : points) {
+    if (addressAndPoint.second.collects) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t Agent::drain(Memory &memory, TraceBuffer &buffer) {
+  uint64_t reserved = 0;
+  if (!isInjected() || memory.readBlock(dataAddress, &reserved, sizeof(reserved)) != sizeof(reserved) ||
+      reserved == drained) {
+    return 0;
+  }
+
+  uint64_t lost = 0;
+  if (reserved - drained > ringRecords) {
+    lost = reserved - ringRecords - drained;
+    drained = reserved - ringRecords;
+  }
+  // Only the new records, in two reads if they wrap around the ring
+  auto first = drained;
+  auto count = reserved - drained;
+  auto start = first % ringRecords;
+  auto head = std::min<uint64_t>(count, ringRecords - start);
+  auto readRecords = [&](std::vector<uint8_t> &records) {
+    records.resize(count * recordSize);
+    auto tail = (count - head) * recordSize;
+    return memory.readBlock(dataAddress + ringOffset + start * recordSize, records.data(), head * recordSize) ==
+               head * recordSize &&
+           memory.readBlock(dataAddress + ringOffset, records.data() + head * recordSize, tail) == tail;
+  };
+  // The tracee clears the sequence before writing a record and sets it
+  // last, a record whose sequence changed during the copy may be torn
+  std::vector<uint8_t> records;
+  std::vector<uint8_t> reread;
+  if (!readRecords(records) || !readRecords(reread)) {
+    return lost;
+  }
+
+  // Both clocks run at a constant rate
+  auto nowTsc = __rdtsc();
+  auto nowTime = nanosecondsNow();
+  double nanosecondsPerTick = nowTsc > startTsc ? static_cast<double>(nowTime - startTime) / (nowTsc - startTsc) : 0;
+
+  std::vector<int64_t> values;
+  for (; drained < reserved; ++drained) {
+    const auto *record = records.data() + (drained - first) * recordSize;
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.sequence < drained + 1) {
+      break;  // still being written
+    }
+    uint64_t sequence;
+    std::memcpy(&sequence, reread.data() + (drained - first) * recordSize, sizeof(sequence));
+    if (header.sequence > drained + 1 || sequence != header.sequence || header.count > maxValues) {
+      ++lost;  // overwritten by a later one
+      continue;
+    }
+    values.resize(header.count);
+    std::memcpy(values.data(), record + sizeof(header), header.count * sizeof(int64_t));
+    auto ticks = header.tsc > startTsc ? header.tsc - startTsc : 0;
+    buffer.record(header.tracepoint, header.tid, startTime + static_cast<uint64_t>(ticks * nanosecondsPerTick), values);
+  }
+  return lost;
+}
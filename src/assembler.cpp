@@ -0,0 +1,106 @@
+#include "assembler.h"
+
+#include <climits>
+#include <cstring>
+
+namespace {
+
+uint8_t low(Gpr r) { return static_cast<uint8_t>(r) & 7; }
+
+}  // namespace
+
+void Assembler::emitRex(bool wide, uint8_t reg, uint8_t rm) {
+  uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) {
+    code.push_back(rex);
+  }
+}
+
+void Assembler::emitMemory(uint8_t reg, Gpr base, int32_t disp) {
+  // mod = 10 is `[base + disp32]`, an `rsp` or `r12` base needs a SIB
+  code.push_back(0x80 | ((reg & 7) << 3) | low(base));
+  if (low(base) == 4) {
+    code.push_back(0x24);
+  }
+  emit32(static_cast<uint32_t>(disp));
+}
+
+void Assembler::emit32(uint32_t value) {
+  for (unsigned i = 0; i < 4; ++i) {
+    code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+void Assembler::bytes(std::initializer_list<uint8_t> raw) { code.insert(code.end(), raw.begin(), raw.end()); }
+
+void Assembler::bytes(const uint8_t *raw, std::size_t length) { code.insert(code.end(), raw, raw + length); }
+
+void Assembler::push(Gpr r) {
+  emitRex(false, 0, static_cast<uint8_t>(r));
+  code.push_back(0x50 + low(r));
+}
+
+void Assembler::pop(Gpr r) {
+  emitRex(false, 0, static_cast<uint8_t>(r));
+  code.push_back(0x58 + low(r));
+}
+
+void Assembler::mov(Gpr dst, Gpr src) {
+  emitRex(true, static_cast<uint8_t>(src), static_cast<uint8_t>(dst));
+  code.push_back(0x89);
+  code.push_back(0xc0 | (low(src) << 3) | low(dst));
+}
+
+void Assembler::movImmediate(Gpr dst, uint64_t value) {
+  emitRex(true, 0, static_cast<uint8_t>(dst));
+  code.push_back(0xb8 + low(dst));
+  emit32(static_cast<uint32_t>(value));
+  emit32(static_cast<uint32_t>(value >> 32));
+}
+
+void Assembler::load(Gpr dst, Gpr base, int32_t disp) {
+  emitRex(true, static_cast<uint8_t>(dst), static_cast<uint8_t>(base));
+  code.push_back(0x8b);
+  emitMemory(static_cast<uint8_t>(dst), base, disp);
+}
+
+void Assembler::store(Gpr base, int32_t disp, Gpr src, bool wide) {
+  emitRex(wide, static_cast<uint8_t>(src), static_cast<uint8_t>(base));
+  code.push_back(0x89);
+  emitMemory(static_cast<uint8_t>(src), base, disp);
+}
+
+void Assembler::storeImmediate32(Gpr base, int32_t disp, uint32_t value) {
+  emitRex(false, 0, static_cast<uint8_t>(base));
+  code.push_back(0xc7);
+  emitMemory(0, base, disp);
+  emit32(value);
+}
+
+void Assembler::lea(Gpr dst, Gpr base, int32_t disp) {
+  emitRex(true, static_cast<uint8_t>(dst), static_cast<uint8_t>(base));
+  code.push_back(0x8d);
+  emitMemory(static_cast<uint8_t>(dst), base, disp);
+}
+
+std::size_t Assembler::branch(std::initializer_list<uint8_t> opcode) {
+  bytes(opcode);
+  auto position = code.size();
+  emit32(0);
+  return position;
+}
+
+void Assembler::bind(std::size_t position) {
+  auto rel = static_cast<int32_t>(code.size() - (position + 4));
+  std::memcpy(code.data() + position, &rel, sizeof(rel));
+}
+
+bool Assembler::jump(uint64_t target) {
+  auto rel = static_cast<int64_t>(target - (getAddress() + 5));
+  if (rel < INT32_MIN || rel > INT32_MAX) {
+    return false;
+  }
+  code.push_back(0xe9);
+  emit32(static_cast<uint32_t>(rel));
+  return true;
+}
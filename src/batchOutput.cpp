@@ -0,0 +1,92 @@
+#include "batchoutput.h"
+
+#include "instrumentation.h"
+#include "spdlog/sinks/base_sink.h"
+
+#include <mutex>
+
+namespace {
+
+/**
+ * @brief Give the messages of the logger to the batch output
+ *
+ */
+class CaptureSink : public spdlog::sinks::base_sink<std::mutex> {
+private:
+  BatchOutput &output;
+
+protected:
+  void sink_it_(const spdlog::details::log_msg &message) override {
+    output.log(message.level, std::string{message.payload.data(), message.payload.size()});
+  }
+
+  void flush_() override {}
+
+public:
+  explicit CaptureSink(BatchOutput &o) : output{o} {}
+};
+
+}  // namespace
+
+BatchOutput::BatchOutput()
+  : stdoutBuffer{std::cout.rdbuf(printed.rdbuf())}
+  , records{stdoutBuffer}
+  , previousLogger{spdlog::default_logger()} {
+  auto logger = std::make_shared<spdlog::logger>("batch", std::make_shared<CaptureSink>(*this));
+  logger->set_level(previousLogger->level());
+  spdlog::set_default_logger(logger);
+}
+
+BatchOutput::~BatchOutput() {
+  takePrinted();
+  spdlog::set_default_logger(previousLogger);
+  std::cout.rdbuf(stdoutBuffer);
+}
+
+void BatchOutput::takePrinted() {
+  std::istringstream text{printed.str()};
+  printed.str("");
+  std::string line;
+  while (std::getline(text, line)) {
+    if (capturing) {
+      lines.push_back(line);
+    } else {
+      std::cerr << line << '\n';
+    }
+  }
+}
+
+void BatchOutput::begin() {
+  takePrinted();
+  lines.clear();
+  failed = false;
+  capturing = true;
+  start = Instrumentation::now();
+}
+
+void BatchOutput::end(const std::string &command) {
+  takePrinted();
+  capturing = false;
+  std::string output;
+  for (const auto &line : lines) {
+    output += (output.empty() ? "\"" : ",\"") + escapeJson(line) + "\"";
+  }
+  records << fmt::format(R"({{"command":"{}","ok":{},"ms":{:.3f},"output":[{}]}})",
+                         escapeJson(command),
+                         failed ? "false" : "true",
+                         (Instrumentation::now() - start) / 1e6,
+                         output)
+          << std::endl;
+}
+
+void BatchOutput::log(spdlog::level::level_enum level, const std::string &text) {
+  // Keep the order of the source printed before the message
+  takePrinted();
+  if (!capturing) {
+    auto name = spdlog::level::to_string_view(level);
+    std::cerr << '[' << std::string{name.data(), name.size()} << "] " << text << '\n';
+    return;
+  }
+  failed = failed || level >= spdlog::level::err;
+  lines.push_back(text);
+}
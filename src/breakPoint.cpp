@@ -1,14 +1,18 @@
 #include "breakpoint.h"
 
+#include "instrumentation.h"
+#include "spdlog/spdlog.h"
 #include "sys/ptrace.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <vector>
 
 Breakpoint::Breakpoint(pid_t p, std::intptr_t addr) : pid{p}, address{addr}, enabled{false}, savedData{} {}
 
 void Breakpoint::enable() {
   // Use `PTRACE_PEEKDATA` to read the content of the specified address
-  auto data = ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+  auto data = tracedPtrace(PTRACE_PEEKDATA, pid, address, nullptr);
   // Store the lower 8 bit
   savedData = static_cast<uint8_t>(data & 0xff);
   uint64_t int3 = 0xcc;
@@ -16,14 +20,110 @@ void Breakpoint::enable() {
 
   // Substitute the low 8bit to the original data to achieve interrupt operation
   // Use `PTRACE_POKEDATA` to rewrite the content.
-  ptrace(PTRACE_POKEDATA, pid, address, dataWithInt3);
+  tracedPtrace(PTRACE_POKEDATA, pid, address, dataWithInt3);
   enabled = true;
 }
 
 void Breakpoint::disable() {
-  auto data = ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+  auto data = tracedPtrace(PTRACE_PEEKDATA, pid, address, nullptr);
   // recover the lower 8 bit
   auto restoredData = (data & ~0xff) | savedData;
-  ptrace(PTRACE_POKEDATA, pid, address, restoredData);
+  tracedPtrace(PTRACE_POKEDATA, pid, address, restoredData);
   enabled = false;
 }
+
+void Breakpoint::recordHit() {
+  lastHit = Clock::now();
+  if (hitCount++ == 0) {
+    firstHit = lastHit;
+  }
+}
+
+bool Breakpoint::consumeIgnore() {
+  if (ignoreCount == 0) {
+    return false;
+  }
+  --ignoreCount;
+  return true;
+}
+
+double Breakpoint::getHitsPerSecond() const {
+  std::chrono::duration<double> elapsed = lastHit - firstHit;
+  if (hitCount < 2 || elapsed.count() <= 0) {
+    return 0;
+  }
+  return (hitCount - 1) / elapsed.count();
+}
+
+/**
+ * @brief Patch the breakpoints one page at a time
+ *
+ * @param patch rewrites the byte of a breakpoint inside the page buffer
+ * @param update changes the state of a breakpoint once its byte is
+ * written, given the byte it replaced
+ */
+template <typename Patch, typename Update>
+static void patchByPage(Memory &memory, std::vector<Breakpoint *> bps, Patch patch, Update update) {
+  constexpr std::intptr_t pageSize = 4096;
+  std::sort(bps.begin(), bps.end(), [](auto a, auto b) { return a->getAddress() < b->getAddress(); });
+
+  std::vector<uint8_t> buffer;
+  std::vector<uint8_t> original;
+  auto first = bps.begin();
+  while (first != bps.end()) {
+    auto page = (*first)->getAddress() / pageSize;
+    auto last = std::find_if(first, bps.end(), [page](auto bp) { return bp->getAddress() / pageSize != page; });
+
+    // Only the span between the first and the last breakpoint is touched
+    auto low = (*first)->getAddress();
+    auto high = (*(last - 1))->getAddress() + 1;
+    buffer.resize(high - low);
+    auto read = memory.readBlock(low, buffer.data(), buffer.size());
+    original = buffer;
+    for (auto it = first; it != last; ++it) {
+      if (static_cast<std::size_t>((*it)->getAddress() - low) < read) {
+        patch(**it, buffer[(*it)->getAddress() - low]);
+      }
+    }
+    auto written = read > 0 ? memory.writeBlock(low, buffer.data(), read) : 0;
+    // A breakpoint whose byte could not be read or written keeps its state
+    for (auto it = first; it != last; ++it) {
+      auto offset = static_cast<std::size_t>((*it)->getAddress() - low);
+      if (offset < written) {
+        update(**it, original[offset]);
+      } else {
+        spdlog::error("Cannot patch the breakpoint at address 0x{:x}", (*it)->getAddress());
+      }
+    }
+    first = last;
+  }
+}
+
+void Breakpoint::enableAll(Memory &memory, const std::vector<Breakpoint *> &bps) {
+  patchByPage(
+      memory,
+      bps,
+      [](const Breakpoint &bp, uint8_t &byte) {
+        if (!bp.enabled) {
+          byte = 0xcc;
+        }
+      },
+      [](Breakpoint &bp, uint8_t byte) {
+        if (!bp.enabled) {
+          bp.savedData = byte;
+          bp.enabled = true;
+        }
+      });
+}
+
+void Breakpoint::disableAll(Memory &memory, const std::vector<Breakpoint *> &bps) {
+  patchByPage(
+      memory,
+      bps,
+      [](const Breakpoint &bp, uint8_t &byte) {
+        if (bp.enabled) {
+          byte = bp.savedData;
+        }
+      },
+      [](Breakpoint &bp, uint8_t) { bp.enabled = false; });
+}
@@ -0,0 +1,483 @@
+#include "condition.h"
+
+#include "reg.h"
+#include "sys/syscall.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+/**
+ * @brief Two's complement arithmetic, signed overflow is undefined
+ *
+ */
+static int64_t wrapped(uint64_t value) { return static_cast<int64_t>(value); }
+
+/**
+ * @brief A recursive descent parser emitting postfix code
+ *
+ */
+class Condition::Parser {
+private:
+  const std::string &text;
+  std::vector<Instruction> &code;
+  std::size_t position = 0;
+  std::size_t depth = 0; /**< stack depth of the emitted code */
+
+  [[noreturn]] void fail(const std::string &message) {
+    throw std::invalid_argument{message + " at column " + std::to_string(position + 1) + " of `" + text + "`"};
+  }
+
+  void skipSpaces() {
+    while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+      ++position;
+    }
+  }
+
+  bool accept(const std::string &token) {
+    skipSpaces();
+    if (text.compare(position, token.size(), token) == 0) {
+      position += token.size();
+      return true;
+    }
+    return false;
+  }
+
+  void expect(const std::string &token) {
+    if (!accept(token)) {
+      fail("Expected `" + token + "`");
+    }
+  }
+
+  void emit(Op op, int64_t operand = 0) {
+    switch (op) {
+      case Op::constant:
+      case Op::reg:
+        if (++depth > maxStackDepth) {
+          fail("Expression is too deep");
+        }
+        break;
+      case Op::deref:
+      case Op::zeroExtend:
+      case Op::signExtend:
+      case Op::negate:
+      case Op::logicalNot:
+        break;
+      default:
+        --depth;
+    }
+    code.push_back(Instruction{op, operand});
+  }
+
+  std::string identifier() {
+    skipSpaces();
+    auto start = position;
+    while (position < text.size() &&
+           (std::isalnum(static_cast<unsigned char>(text[position])) || text[position] == '_')) {
+      ++position;
+    }
+    return text.substr(start, position - start);
+  }
+
+  void primary() {
+    skipSpaces();
+    if (accept("(")) {
+      logicalOr();
+      expect(")");
+      return;
+    }
+    if (position < text.size() && std::isdigit(static_cast<unsigned char>(text[position]))) {
+      std::size_t length = 0;
+      auto value = std::stoull(text.substr(position), &length, 0);
+      position += length;
+      emit(Op::constant, static_cast<int64_t>(value));
+      return;
+    }
+
+    accept("$");
+    auto name = identifier();
+    if (name.empty()) {
+      fail("Expected an operand");
+    }
+
+    // Narrowing casts look like calls: u32(expr)
+    static const std::array<std::pair<const char *, int64_t>, 6> casts{
+        {{"u8", 8}, {"u16", 16}, {"u32", 32}, {"i8", -8}, {"i16", -16}, {"i32", -32}}};
+    for (const auto &cast : casts) {
+      if (name == cast.first) {
+        expect("(");
+        logicalOr();
+        expect(")");
+        emit(cast.second > 0 ? Op::zeroExtend : Op::signExtend, std::abs(cast.second));
+        return;
+      }
+    }
+
+    if (name == "pc") {
+      name = "rip";
+    }
+    auto it = std::find_if(std::begin(Registers), std::end(Registers), [&name](auto &&rd) { return rd.name == name; });
+    if (it == std::end(Registers)) {
+      fail("Unknown register `" + name + "`");
+    }
+    emit(Op::reg, static_cast<int64_t>(it->reg));
+  }
+
+  void unary() {
+    if (accept("*")) {
+      unary();
+      emit(Op::deref);
+    } else if (accept("-")) {
+      unary();
+      emit(Op::negate);
+    } else if (accept("!")) {
+      unary();
+      emit(Op::logicalNot);
+    } else {
+      primary();
+    }
+  }
+
+  void multiplicative() {
+    unary();
+    while (true) {
+      if (accept("*")) {
+        unary();
+        emit(Op::mul);
+      } else if (accept("/")) {
+        unary();
+        emit(Op::div);
+      } else if (accept("%")) {
+        unary();
+        emit(Op::mod);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void additive() {
+    multiplicative();
+    while (true) {
+      if (accept("+")) {
+        multiplicative();
+        emit(Op::add);
+      } else if (accept("-")) {
+        multiplicative();
+        emit(Op::sub);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void relational() {
+    additive();
+    while (true) {
+      // Longer tokens first so that `<=` is not read as `<`
+      if (accept("<=")) {
+        additive();
+        emit(Op::le);
+      } else if (accept(">=")) {
+        additive();
+        emit(Op::ge);
+      } else if (accept("<")) {
+        additive();
+        emit(Op::lt);
+      } else if (accept(">")) {
+        additive();
+        emit(Op::gt);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void equality() {
+    relational();
+    while (true) {
+      if (accept("==")) {
+        relational();
+        emit(Op::eq);
+      } else if (accept("!=")) {
+        relational();
+        emit(Op::ne);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void logicalAnd() {
+    equality();
+    while (accept("&&")) {
+      equality();
+      emit(Op::logicalAnd);
+    }
+  }
+
+  void logicalOr() {
+    logicalAnd();
+    while (accept("||")) {
+      logicalAnd();
+      emit(Op::logicalOr);
+    }
+  }
+
+public:
+  Parser(const std::string &t, std::vector<Instruction> &c) : text{t}, code{c} {}
+
+  void parse() {
+    logicalOr();
+    skipSpaces();
+    if (position != text.size()) {
+      fail("Unexpected character");
+    }
+  }
+};
+
+Condition::Condition(const std::string &t) : text{t} { Parser{text, code}.parse(); }
+
+int64_t Condition::evaluate(Memory &memory) const {
+  std::array<int64_t, maxStackDepth> stack;
+  std::size_t top = 0;
+
+  for (const auto &instruction : code) {
+    switch (instruction.op) {
+      case Op::constant:
+        stack[top++] = instruction.operand;
+        break;
+      case Op::reg:
+        stack[top++] = static_cast<int64_t>(memory.getRegisterValue(static_cast<Reg>(instruction.operand)));
+        break;
+      case Op::deref:
+        stack[top - 1] = static_cast<int64_t>(memory.readMemory(stack[top - 1]));
+        break;
+      case Op::zeroExtend: {
+        auto mask = (uint64_t{1} << instruction.operand) - 1;
+        stack[top - 1] = static_cast<int64_t>(static_cast<uint64_t>(stack[top - 1]) & mask);
+        break;
+      }
+      case Op::signExtend: {
+        auto shift = 64 - instruction.operand;
+        stack[top - 1] = static_cast<int64_t>(static_cast<uint64_t>(stack[top - 1]) << shift) >> shift;
+        break;
+      }
+      case Op::negate:
+        stack[top - 1] = wrapped(0 - static_cast<uint64_t>(stack[top - 1]));
+        break;
+      case Op::logicalNot:
+        stack[top - 1] = !stack[top - 1];
+        break;
+      default: {
+        auto rhs = stack[--top];
+        auto &lhs = stack[top - 1];
+        switch (instruction.op) {
+          case Op::add:
+            lhs = wrapped(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs));
+            break;
+          case Op::sub:
+            lhs = wrapped(static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs));
+            break;
+          case Op::mul:
+            lhs = wrapped(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs));
+            break;
+          // INT64_MIN / -1 would raise SIGFPE, -1 is handled apart
+          case Op::div:
+            lhs = rhs == 0 ? 0 : rhs == -1 ? wrapped(0 - static_cast<uint64_t>(lhs)) : lhs / rhs;
+            break;
+          case Op::mod:
+            lhs = rhs == 0 || rhs == -1 ? 0 : lhs % rhs;
+            break;
+          case Op::eq:
+            lhs = lhs == rhs;
+            break;
+          case Op::ne:
+            lhs = lhs != rhs;
+            break;
+          case Op::lt:
+            lhs = lhs < rhs;
+            break;
+          case Op::le:
+            lhs = lhs <= rhs;
+            break;
+          case Op::gt:
+            lhs = lhs > rhs;
+            break;
+          case Op::ge:
+            lhs = lhs >= rhs;
+            break;
+          case Op::logicalAnd:
+            lhs = lhs && rhs;
+            break;
+          case Op::logicalOr:
+            lhs = lhs || rhs;
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+  return top ? stack[top - 1] : 0;
+}
+
+bool Condition::compile(const NativeFrame &frame, Assembler &assembler) const {
+  for (const auto &instruction : code) {
+    switch (instruction.op) {
+      case Op::constant:
+        assembler.movImmediate(Gpr::rax, static_cast<uint64_t>(instruction.operand));
+        break;
+      case Op::reg: {
+        auto r = static_cast<Reg>(instruction.operand);
+        if (r == Reg::rip) {
+          assembler.movImmediate(Gpr::rax, frame.pc);
+        } else if (r == Reg::rsp) {
+          assembler.lea(Gpr::rax, Gpr::rbx, frame.stackOffset);
+        } else if (r == Reg::orig_rax) {
+          // A breakpoint is never hit inside a syscall
+          assembler.movImmediate(Gpr::rax, UINT64_MAX);
+        } else if (frame.offsets[static_cast<std::size_t>(r)] >= 0) {
+          assembler.load(Gpr::rax, Gpr::rbx, frame.offsets[static_cast<std::size_t>(r)]);
+        } else {
+          return false;
+        }
+        break;
+      }
+      case Op::deref: {
+        // process_vm_readv(pid, {result, 8}, 1, {address, 8}, 1, 0) on the
+        // stack, an unreadable address gives -1 like `PTRACE_PEEKDATA`
+        assembler.pop(Gpr::rax);
+        assembler.lea(Gpr::rsp, Gpr::rsp, -40);
+        assembler.store(Gpr::rsp, 16, Gpr::rax);
+        assembler.movImmediate(Gpr::rax, UINT64_MAX);
+        assembler.store(Gpr::rsp, 32, Gpr::rax);
+        assembler.lea(Gpr::rax, Gpr::rsp, 32);
+        assembler.store(Gpr::rsp, 0, Gpr::rax);
+        assembler.movImmediate(Gpr::rax, sizeof(uint64_t));
+        assembler.store(Gpr::rsp, 8, Gpr::rax);
+        assembler.store(Gpr::rsp, 24, Gpr::rax);
+        assembler.movImmediate(Gpr::rax, SYS_process_vm_readv);
+        assembler.movImmediate(Gpr::rdi, static_cast<uint64_t>(frame.pid));
+        assembler.lea(Gpr::rsi, Gpr::rsp, 0);
+        assembler.movImmediate(Gpr::rdx, 1);
+        assembler.lea(Gpr::r10, Gpr::rsp, 16);
+        assembler.movImmediate(Gpr::r8, 1);
+        assembler.movImmediate(Gpr::r9, 0);
+        assembler.bytes({0x0f, 0x05});  // syscall
+        assembler.load(Gpr::rax, Gpr::rsp, 32);
+        assembler.lea(Gpr::rsp, Gpr::rsp, 40);
+        break;
+      }
+      case Op::zeroExtend:
+        assembler.pop(Gpr::rax);
+        if (instruction.operand == 8) {
+          assembler.bytes({0x0f, 0xb6, 0xc0});  // movzx eax, al
+        } else if (instruction.operand == 16) {
+          assembler.bytes({0x0f, 0xb7, 0xc0});  // movzx eax, ax
+        } else {
+          assembler.bytes({0x89, 0xc0});  // mov eax, eax
+        }
+        break;
+      case Op::signExtend:
+        assembler.pop(Gpr::rax);
+        if (instruction.operand == 8) {
+          assembler.bytes({0x48, 0x0f, 0xbe, 0xc0});  // movsx rax, al
+        } else if (instruction.operand == 16) {
+          assembler.bytes({0x48, 0x0f, 0xbf, 0xc0});  // movsx rax, ax
+        } else {
+          assembler.bytes({0x48, 0x63, 0xc0});  // movsxd rax, eax
+        }
+        break;
+      case Op::negate:
+        assembler.pop(Gpr::rax);
+        assembler.bytes({0x48, 0xf7, 0xd8});  // neg rax
+        break;
+      case Op::logicalNot:
+        assembler.pop(Gpr::rax);
+        assembler.bytes({0x48, 0x85, 0xc0, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0});  // test, sete, movzx
+        break;
+      default: {
+        assembler.pop(Gpr::rcx);
+        assembler.pop(Gpr::rax);
+        // setcc al of the comparisons
+        uint8_t setcc = 0;
+        switch (instruction.op) {
+          case Op::add:
+            assembler.bytes({0x48, 0x01, 0xc8});  // add rax, rcx
+            break;
+          case Op::sub:
+            assembler.bytes({0x48, 0x29, 0xc8});  // sub rax, rcx
+            break;
+          case Op::mul:
+            assembler.bytes({0x48, 0x0f, 0xaf, 0xc1});  // imul rax, rcx
+            break;
+          case Op::div:
+          case Op::mod: {
+            // 0 for a zero divisor, and no #DE for INT64_MIN / -1
+            assembler.bytes({0x48, 0x85, 0xc9});  // test rcx, rcx
+            auto zero = assembler.branch({0x0f, 0x84});
+            assembler.bytes({0x48, 0x83, 0xf9, 0xff});  // cmp rcx, -1
+            auto divide = assembler.branch({0x0f, 0x85});
+            if (instruction.op == Op::div) {
+              assembler.bytes({0x48, 0xf7, 0xd8});  // neg rax
+            } else {
+              assembler.bytes({0x31, 0xc0});  // xor eax, eax
+            }
+            auto doneByMinusOne = assembler.branch({0xe9});
+            assembler.bind(divide);
+            assembler.bytes({0x48, 0x99, 0x48, 0xf7, 0xf9});  // cqo, idiv rcx
+            if (instruction.op == Op::mod) {
+              assembler.mov(Gpr::rax, Gpr::rdx);
+            }
+            auto done = assembler.branch({0xe9});
+            assembler.bind(zero);
+            assembler.bytes({0x31, 0xc0});  // xor eax, eax
+            assembler.bind(done);
+            assembler.bind(doneByMinusOne);
+            break;
+          }
+          case Op::eq:
+            setcc = 0x94;
+            break;
+          case Op::ne:
+            setcc = 0x95;
+            break;
+          case Op::lt:
+            setcc = 0x9c;
+            break;
+          case Op::le:
+            setcc = 0x9e;
+            break;
+          case Op::gt:
+            setcc = 0x9f;
+            break;
+          case Op::ge:
+            setcc = 0x9d;
+            break;
+          case Op::logicalAnd:
+          case Op::logicalOr:
+            // test rax, rax; setne al; test rcx, rcx; setne cl; and/or al, cl
+            assembler.bytes({0x48, 0x85, 0xc0, 0x0f, 0x95, 0xc0, 0x48, 0x85, 0xc9, 0x0f, 0x95, 0xc1});
+            assembler.bytes({static_cast<uint8_t>(instruction.op == Op::logicalAnd ? 0x20 : 0x08), 0xc8});
+            assembler.bytes({0x0f, 0xb6, 0xc0});  // movzx eax, al
+            break;
+          default:
+            break;
+        }
+        if (setcc) {
+          assembler.bytes({0x48, 0x39, 0xc8, 0x0f, setcc, 0xc0, 0x0f, 0xb6, 0xc0});  // cmp, setcc, movzx
+        }
+      }
+    }
+    assembler.push(Gpr::rax);
+  }
+  if (code.empty()) {
+    assembler.bytes({0x31, 0xc0});  // xor eax, eax
+  } else {
+    assembler.pop(Gpr::rax);
+  }
+  return true;
+}
@@ -1,30 +1,144 @@
 #include "debugger.h"
 
 #include "breakpoint.h"
+#include "decoder.h"
 #include "dwarf/dwarf++.hh"
 #include "elf/elf++.hh"
+#include "hardwarebreakpoint.h"
+#include "instrumentation.h"
 #include "linenoise.h"
 #include "reg.h"
 #include "signal.h"
 #include "spdlog/spdlog.h"
+#include "sys/mman.h"
 #include "sys/ptrace.h"
+#include "sys/syscall.h"
 #include "sys/user.h"
 #include "sys/wait.h"
+#include "syscalls.h"
 
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
-Debugger::Debugger(std::string name, pid_t p) : memory(p) {
+#ifndef TRAP_HWBKPT
+#define TRAP_HWBKPT 4
+#endif
+
+namespace {
+
+// Past the 15 bytes `displacedStep` may copy into the scratch buffer
+constexpr uint64_t trampolineOffset = 16;
+
+uint64_t nanosecondsNow() {
+  auto now = Breakpoint::Clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+std::string formatNanoseconds(uint64_t ns) {
+  if (ns < 1000) {
+    return fmt::format("{}ns", ns);
+  } else if (ns < 1000000) {
+    return fmt::format("{:.1f}us", ns / 1e3);
+  } else if (ns < 1000000000) {
+    return fmt::format("{:.1f}ms", ns / 1e6);
+  }
+  return fmt::format("{:.2f}s", ns / 1e9);
+}
+
+/**
+ * @brief Get the range of the function `die` containing `pc`, in DWARF
+ * addresses
+ *
+ * @details Optimized functions may have `DW_AT_ranges` instead of a low
+ * and high PC, the parts split by the compiler are not contiguous.
+ *
+ * @return false if `pc` is not in the function
+ */
+bool getFunctionRange(const dwarf::die &die, uint64_t pc, uint64_t &low, uint64_t &high) {
+  try {
+    for (const auto &range : dwarf::die_pc_range(die)) {
+      if (range.contains(pc)) {
+        low = range.low;
+        high = range.high;
+        return true;
+      }
+    }
+  } catch (const std::exception &) {
+  }
+  return false;
+}
+
+/**
+ * @brief Parse a decimal line or count typed by the user
+ *
+ * @return false if `text` is not a whole number that fits
+ */
+bool parseNumber(const std::string &text, unsigned &value) {
+  if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  auto number = std::strtoul(text.c_str(), &end, 10);
+  if (*end != '\0' || errno == ERANGE || number > UINT_MAX) {
+    return false;
+  }
+  value = number;
+  return true;
+}
+
+}  // namespace
+
+Debugger::Debugger(std::string name, pid_t p, bool seized, const IndexOptions &indexOptions) : memory(p) {
   programName = name;
   pid = p;
+  attached = seized;
+  currentThread = p;
+  threads.emplace(p, Thread{p});
+  threads.at(p).isNew = false;
   auto fd = open(programName.c_str(), O_RDONLY);
   pElf = elf::elf{elf::create_mmap_loader(fd)};
   pDwarf = dwarf::dwarf{dwarf::elf::create_loader(pElf)};
   close(fd);
+
+  // A saved index of the same build replaces the walk of the DWARF
+  std::string buildId;
+  std::string indexPath;
+  if (!indexOptions.cacheDirectory.empty()) {
+    buildId = IndexFile::getBuildId(pElf);
+    if (buildId.empty()) {
+      spdlog::info("{} has no build id, its index is not saved", programName);
+    } else {
+      indexPath = IndexFile::getPath(indexOptions.cacheDirectory, buildId);
+      if (indexFile.open(indexPath, buildId)) {
+        spdlog::info("Using the index {}", indexPath);
+      }
+    }
+  }
+  symbolIndex = SymbolIndex{pDwarf, pElf, indexOptions, indexFile.isOpen() ? &indexFile : nullptr};
+  unwinder = Unwinder{pElf, indexFile.isOpen() ? &indexFile : nullptr};
+
+  if (!indexPath.empty() && !indexFile.isOpen()) {
+    IndexFile::Contents contents;
+    symbolIndex.exportIndex(contents);
+    unwinder.exportIndex(pElf, contents);
+    if (IndexFile::write(indexPath, buildId, contents)) {
+      spdlog::info("Saved the index {}", indexPath);
+    }
+  }
 }
 
 std::vector<std::string> Debugger::split(const std::string &s, char delimiter) {
@@ -54,293 +168,1637 @@ bool Debugger::isSuffix(const std::string &s, const std::string &of) {
 }
 
 void Debugger::continueExecution() {
-  stepOverBreakpoint();
-  // Use `PTRACE_CONT` to tell the program to continue
-  ptrace(PTRACE_CONT, pid, nullptr, nullptr);
-  waitForSignal();
+  if (!threads.count(currentThread)) {
+    spdlog::error("The process is not being run");
+    return;
+  }
+  // Breakpoints whose condition is false resume right away
+  // without going back to the prompt
+  do {
+    stepOverBreakpoint();
+    rearmFastPoints();
+    // Use `PTRACE_CONT` to tell every thread, or only the current one in
+    // non-stop mode, to continue
+    if (!nonStop) {
+      resumeAllThreads();
+    } else if (threads.count(currentThread) && !threads.at(currentThread).running) {
+      resumeThread(threads.at(currentThread), false);
+    }
+    waitForSignal();
+  } while (resumeAfterStop);
 }
 
-void Debugger::setBreakPointAtAddress(std::intptr_t addr) {
-  spdlog::info("Set breakpoint at address 0x{0:x}", addr);
+bool Debugger::setBreakPointAtAddress(std::intptr_t addr, std::shared_ptr<const Condition> condition) {
+  // Its saved byte would be the INT3 of the breakpoint already there
+  if (breakpoints.count(addr)) {
+    if (breakpoints.at(addr).getNumber() == 0) {
+      spdlog::error("Cannot set a breakpoint at address 0x{:x}, ftrace uses it", addr);
+    } else {
+      spdlog::error("Breakpoint {} is already at address 0x{:x}", breakpoints.at(addr).getNumber(), addr);
+    }
+    return false;
+  }
+  // The jump of a fast point would run over the new INT3
+  if (auto point = agent.findCovering(addr)) {
+    demoteFastPoint(*point);
+  }
+  agent.removePoint(memory, addr);
+  spdlog::info("Set breakpoint {0} at address 0x{1:x}", nextBreakpointNumber, addr);
   Breakpoint breakpoint{pid, addr};
-  breakpoint.enable();
+  breakpoint.setCondition(std::move(condition));
+  breakpoint.setNumber(nextBreakpointNumber++);
   breakpoints[addr] = breakpoint;
+  // Through `/proc/<pid>/mem`, threads may be running in non-stop mode
+  Breakpoint::enableAll(memory, {&breakpoints[addr]});
+  setFastPoint(addr);
+  return true;
 }
 
-void Debugger::setBreakPointAtFunction(const std::string &name) {
-  for (const auto &compilationUnit : pDwarf.compilation_units()) {
-    for (const auto &die : compilationUnit.root()) {
-      if (die.has(dwarf::DW_AT::name) && at_name(die) == name) {
-        auto lowPC = at_low_pc(die);
-        auto entry = getLineEntryFromPC(lowPC);
-        ++entry;  // skip prologue
-        setBreakPointAtAddress(offsetDwarfAddress(entry->address));
-      }
+void Debugger::setTemporaryBreakpoints(const std::vector<std::intptr_t> &addresses) {
+  std::vector<Breakpoint *> bps;
+  for (auto addr : addresses) {
+    if (auto point = agent.findCovering(addr)) {
+      demoteFastPoint(*point);
     }
+    breakpoints[addr] = Breakpoint{pid, addr};
+    bps.push_back(&breakpoints[addr]);
   }
+  Breakpoint::enableAll(memory, bps);
 }
 
-void Debugger::setBreakPointAtSourceLine(const std::string &file, unsigned line) {
-  for (const auto &compilationUnit : pDwarf.compilation_units()) {
-    if (isSuffix(file, at_name(compilationUnit.root()))) {
-      const auto &lt = compilationUnit.get_line_table();
-
-      for (const auto &entry : lt) {
-        if (entry.is_stmt && entry.line == line) {
-          setBreakPointAtAddress(offsetDwarfAddress(entry.address));
-          return;
-        }
-      }
+Breakpoint *Debugger::getBreakpointByNumber(unsigned number) {
+  for (auto &addressAndBreakpoint : breakpoints) {
+    if (addressAndBreakpoint.second.getNumber() == number) {
+      return &addressAndBreakpoint.second;
     }
   }
+  spdlog::error("No breakpoint number {}", number);
+  return nullptr;
 }
 
-std::vector<Sym> Debugger::lookupSymbol(const std::string &name) {
-  std::vector<Sym> syms;
-  for (auto &section : pElf.sections()) {
-    if (section.get_hdr().type != elf::sht::symtab && section.get_hdr().type != elf::sht::dynsym) {
-      continue;
+void Debugger::dumpBreakpoints() {
+  std::vector<const Breakpoint *> sorted;
+  for (const auto &addressAndBreakpoint : breakpoints) {
+    if (addressAndBreakpoint.second.getNumber() != 0) {
+      sorted.push_back(&addressAndBreakpoint.second);
     }
+  }
+  std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->getNumber() < b->getNumber(); });
 
-    for (auto sym : section.as_symtab()) {
-      if (sym.get_name() == name) {
-        auto &data = sym.get_data();
-        syms.push_back(Sym{elfToSymType11(data.type()), sym.get_name(), data.value});
+  spdlog::info("{:<4} {:<18} {:>10} {:>8} {:>12}  {}", "Num", "Address", "Hits", "Ignore", "Hits/s", "Condition");
+  for (auto bp : sorted) {
+    std::string what = bp->getCondition() ? bp->getCondition()->getText() : "";
+    if (bp->getCollect()) {
+      what += what.empty() ? "collect " : " collect ";
+      for (const auto &expression : *bp->getCollect()) {
+        what += (&expression == &bp->getCollect()->front() ? "" : ", ") + expression.getText();
+      }
+    }
+    // The trampoline counts the hits while a fast point is patched
+    auto point = agent.findPoint(bp->getAddress());
+    if (point) {
+      what += " [agent]";
+    }
+    spdlog::info("{:<4} 0x{:016x} {:>10} {:>8} {:>12.1f}  {}",
+                 bp->getNumber(),
+                 bp->getAddress(),
+                 bp->getHitCount() + (point ? agent.getHits(memory, *point) : 0),
+                 bp->getIgnoreCount(),
+                 bp->getHitsPerSecond(),
+                 what);
+    if (bp->getCommands()) {
+      for (const auto &command : *bp->getCommands()) {
+        spdlog::info("{:<4} {}", "", command);
       }
     }
   }
-  return syms;
 }
 
-void Debugger::stepOverBreakpoint() {
-  // The address must be stored in the breakpoints
-  if (breakpoints.count(memory.getPC())) {
-    Breakpoint &bp = breakpoints[memory.getPC()];
-    if (bp.isEnabled()) {
-      bp.disable();
-      ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
-      waitForSignal();
-      bp.enable();
+void Debugger::setTracepoint(const std::string &location, const std::string &expressions) {
+  auto collect = std::make_shared<std::vector<Condition>>();
+  try {
+    for (auto item : split(expressions, ',')) {
+      item.erase(0, item.find_first_not_of(' '));
+      item.erase(item.find_last_not_of(' ') + 1);
+      if (item == "$regs") {
+        for (const auto &registerDescriptor : Registers) {
+          collect->emplace_back(registerDescriptor.name);
+        }
+      } else if (!item.empty()) {
+        collect->emplace_back(item);
+      }
+    }
+  } catch (const std::exception &e) {
+    spdlog::error("Invalid collect expression: {}", e.what());
+    return;
+  }
+  if (collect->empty()) {
+    spdlog::error("Nothing to collect");
+    return;
+  }
+
+  for (auto address : resolveLocation(location)) {
+    if (!setBreakPointAtAddress(address)) {
+      continue;
     }
+    breakpoints[address].setCollect(collect);
+    spdlog::info("Tracepoint {} collects {} values", breakpoints[address].getNumber(), collect->size());
+    setFastPoint(address);
   }
 }
 
-void Debugger::singleStepInstruction() {
-  ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
-  waitForSignal();
+void Debugger::collectTrace(const Breakpoint &bp) {
+  // Keep the records in the order of their hits
+  if (agent.hasTracepoints()) {
+    drainAgent();
+  }
+  traceValues.clear();
+  for (const auto &expression : *bp.getCollect()) {
+    traceValues.push_back(expression.evaluate(memory));
+  }
+  traceBuffer.record(bp.getNumber(), currentThread, nanosecondsNow(), traceValues);
 }
 
-void Debugger::singleStepInstructionWithBreakpointCheck() {
-  // First, check to see if we need to disable and enable breakpoint
-  if (breakpoints.count(memory.getPC())) {
-    stepOverBreakpoint();
-  } else {
-    singleStepInstruction();
+void Debugger::dumpTrace(std::size_t count) {
+  drainAgent();
+  auto records = traceBuffer.decode();
+  spdlog::info("{} records, {} overwritten", traceBuffer.getRecorded(), traceBuffer.getDropped());
+  if (records.empty()) {
+    return;
+  }
+
+  auto first = records.size() > count ? records.size() - count : 0;
+  for (auto i = first; i < records.size(); ++i) {
+    const auto &record = records[i];
+    const std::vector<Condition> *collect = nullptr;
+    for (const auto &addressAndBreakpoint : breakpoints) {
+      if (addressAndBreakpoint.second.getNumber() == record.tracepoint) {
+        collect = addressAndBreakpoint.second.getCollect();
+      }
+    }
+
+    std::string values;
+    for (std::size_t j = 0; j < record.values.size(); ++j) {
+      auto name = collect && j < collect->size() ? (*collect)[j].getText() : "$" + std::to_string(j);
+      values += fmt::format(" {}=0x{:x}", name, static_cast<uint64_t>(record.values[j]));
+    }
+    spdlog::info("+{:.6f}s tracepoint {} thread {}:{}",
+                 static_cast<int64_t>(record.timestamp - records.front().timestamp) / 1e9,
+                 record.tracepoint,
+                 record.tid,
+                 values);
   }
 }
 
-void Debugger::stepOut() {
-  auto framePointer = memory.getRegisterValue(Reg::rbp);
-  auto returnAddress = memory.readMemory(framePointer + 8);
+void Debugger::setFunctionTrace(const std::vector<std::string> &names) {
+  if (!threads.count(currentThread)) {
+    spdlog::error("The process is not being run");
+    return;
+  }
+  std::vector<std::intptr_t> addresses;
+  if (ftraceTrampoline == 0) {
+    ftraceTrampoline = scratchAddress + trampolineOffset;
+    addresses.push_back(ftraceTrampoline);
+  }
+  for (const auto &name : names) {
+    std::size_t function = 0;
+    while (function < tracedFunctions.size() && tracedFunctions[function].name != name) {
+      ++function;
+    }
+    if (function == tracedFunctions.size()) {
+      tracedFunctions.push_back(TracedFunction{name});
+    }
 
-  bool shouldRemoveBreakpoint = false;
-  if (!breakpoints.count(returnAddress)) {
-    setBreakPointAtAddress(returnAddress);
-    shouldRemoveBreakpoint = true;
+    unsigned found = 0;
+    for (const auto &die : symbolIndex.findFunctions(name)) {
+      auto address = static_cast<std::intptr_t>(offsetDwarfAddress(at_low_pc(die)));
+      if (tracedEntries.count(address)) {
+        continue;
+      }
+      if (breakpoints.count(address)) {
+        spdlog::error("Cannot trace {} at 0x{:x}, it already has a breakpoint", name, address);
+        continue;
+      }
+      tracedEntries.emplace(address, function);
+      addresses.push_back(address);
+      ++found;
+    }
+    if (found == 0) {
+      spdlog::error("No new definition of {} to trace", name);
+    } else {
+      spdlog::info("Tracing {} definitions of {}", found, name);
+    }
   }
+  setTemporaryBreakpoints(addresses);
+}
 
-  continueExecution();
+void Debugger::stopFunctionTrace() {
+  if (ftraceTrampoline == 0) {
+    spdlog::error("No function is traced");
+    return;
+  }
+  // Running threads could be returning to the trampoline meanwhile
+  auto held = holdThreads();
+  restoreReturnAddresses();
+  std::vector<std::intptr_t> addresses{ftraceTrampoline};
+  for (const auto &entryAndFunction : tracedEntries) {
+    addresses.push_back(entryAndFunction.first);
+  }
+  if (ftraceUnwinder != 0 && breakpoints.at(ftraceUnwinder).getNumber() == 0) {
+    addresses.push_back(ftraceUnwinder);
+  }
+  removeBreakpoints(addresses);
+  tracedEntries.clear();
+  ftraceTrampoline = 0;
+  ftraceUnwinder = 0;
+  ftraceUnwinderSearched = false;
+  releaseThreads(held);
+}
 
-  if (shouldRemoveBreakpoint) {
-    removeBreakpoint(returnAddress);
+void Debugger::restoreReturnAddresses() {
+  for (auto &tidAndThread : threads) {
+    restoreReturnAddresses(tidAndThread.second);
   }
 }
 
-void Debugger::removeBreakpoint(std::intptr_t address) {
-  if (breakpoints.at(address).isEnabled()) {
-    breakpoints.at(address).disable();
+void Debugger::restoreReturnAddresses(Thread &thread) {
+  auto &calls = thread.tracedCalls;
+  // Innermost first, the tail calls share the slot of their caller
+  for (auto it = calls.rbegin(); it != calls.rend(); ++it) {
+    memory.writeMemory(it->stack, it->returnAddress);
   }
-  breakpoints.erase(address);
+  calls.clear();
 }
 
-void Debugger::stepIn() {
-  /*
-   * A simple algorithm is to just keep on stepping
-   * over instructions until we get to a new line.
-   */
-  auto line = getLineEntryFromPC(getOffsetPC())->line;
-  while (getLineEntryFromPC(getOffsetPC())->line == line) {
-    singleStepInstructionWithBreakpointCheck();
+void Debugger::setUnwinderBreakpoint() {
+  ftraceUnwinderSearched = true;
+  const std::string name = "_Unwind_RaiseException";
+  // A static executable has its own unwinder
+  for (const auto &sym : symbolIndex.findSymbols(name)) {
+    if (sym.type == symType::func && sym.address != 0) {
+      ftraceUnwinder = offsetDwarfAddress(sym.address);
+    }
+  }
+  for (const auto &mapping : memory.getMappings()) {
+    if (ftraceUnwinder != 0) {
+      break;
+    }
+    if (mapping.offset != 0 || mapping.path.empty() || mapping.path[0] != '/') {
+      continue;
+    }
+    auto fd = open(mapping.path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      continue;
+    }
+    try {
+      elf::elf library{elf::create_mmap_loader(fd)};
+      // The first segment is mapped at `low`
+      uint64_t first = UINT64_MAX;
+      for (const auto &segment : library.segments()) {
+        if (segment.get_hdr().type == elf::pt::load) {
+          first = std::min(first, segment.get_hdr().vaddr & ~uint64_t{0xfff});
+        }
+      }
+      for (const auto &section : library.sections()) {
+        if (section.get_hdr().type != elf::sht::dynsym || ftraceUnwinder != 0) {
+          continue;
+        }
+        for (auto sym : section.as_symtab()) {
+          if (sym.get_data().type() == elf::stt::func && sym.get_data().value != 0 && sym.get_name() == name) {
+            ftraceUnwinder = mapping.low - first + sym.get_data().value;
+            break;
+          }
+        }
+      }
+    } catch (const std::exception &) {
+      // Not an ELF file
+    }
+    close(fd);
+  }
+
+  if (ftraceUnwinder == 0) {
+    spdlog::debug("No {} is loaded, exceptions are not followed", name);
+  } else if (!breakpoints.count(ftraceUnwinder)) {
+    setTemporaryBreakpoints({ftraceUnwinder});
   }
-  auto lineEntry = getLineEntryFromPC(getOffsetPC());
-  printSource(lineEntry->file->path, lineEntry->line);
 }
 
-uint64_t Debugger::getOffsetPC() { return offsetLoadAddress(memory.getPC()); }
+void Debugger::dumpFunctionTrace() {
+  std::vector<std::vector<uint64_t>> latencies(tracedFunctions.size());
+  for (const auto &record : ftraceBuffer.decode()) {
+    if (record.tracepoint < latencies.size() && !record.values.empty()) {
+      latencies[record.tracepoint].push_back(record.values[0]);
+    }
+  }
+  spdlog::info("{} returns recorded, {} overwritten", ftraceBuffer.getRecorded(), ftraceBuffer.getDropped());
 
-void Debugger::stepOver() {
-  auto func = getFunctionFromPC(getOffsetPC());
-  auto funcEntry = at_low_pc(func);
-  auto funcEnd = at_high_pc(func);
+  spdlog::info("{:<32} {:>10} {:>10} {:>10} {:>10} {:>10}", "Function", "Calls", "Returns", "p50", "p99", "Max");
+  for (std::size_t i = 0; i < tracedFunctions.size(); ++i) {
+    auto &sorted = latencies[i];
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](unsigned p) {
+      return sorted.empty() ? std::string{"-"} : formatNanoseconds(sorted[(sorted.size() - 1) * p / 100]);
+    };
+    spdlog::info("{:<32} {:>10} {:>10} {:>10} {:>10} {:>10}",
+                 tracedFunctions[i].name,
+                 tracedFunctions[i].calls,
+                 tracedFunctions[i].returns,
+                 percentile(50),
+                 percentile(99),
+                 percentile(100));
 
-  auto line = getLineEntryFromPC(funcEntry);
-  auto startLine = getLineEntryFromPC(getOffsetPC());
+    // Bucket `b` holds the latencies in [2^(b-1), 2^b) nanoseconds
+    std::vector<uint64_t> buckets(65);
+    for (auto latency : sorted) {
+      unsigned bucket = 0;
+      while (bucket < 64 && (latency >> bucket) != 0) {
+        ++bucket;
+      }
+      ++buckets[bucket];
+    }
+    auto most = *std::max_element(buckets.begin(), buckets.end());
+    for (unsigned b = 0; b < buckets.size(); ++b) {
+      if (buckets[b] == 0) {
+        continue;
+      }
+      constexpr uint64_t barWidth = 40;
+      auto low = b == 0 ? 0 : uint64_t{1} << (b - 1);
+      auto high = b == 64 ? UINT64_MAX : uint64_t{1} << b;
+      spdlog::info("  [{:>8}, {:>8}) {:>10} {}",
+                   formatNanoseconds(low),
+                   formatNanoseconds(high),
+                   buckets[b],
+                   std::string((buckets[b] * barWidth + most - 1) / most, '#'));
+    }
+  }
+}
 
-  std::vector<std::intptr_t> toDelete{};
+bool Debugger::handleTracedFunction(Thread &thread, int waitStatus) {
+  if (ftraceTrampoline == 0 || WSTOPSIG(waitStatus) != SIGTRAP || waitStatus >> 16 != 0) {
+    return false;
+  }
+  memory.selectThread(thread.tid);
+  auto pc = static_cast<std::intptr_t>(memory.getPC() - 1);
+  auto entry = tracedEntries.find(pc);
+  siginfo_t info;
+  // A single step can also end right after a breakpoint
+  bool hit = (pc == ftraceTrampoline || pc == ftraceUnwinder || entry != tracedEntries.end()) &&
+             tracedPtrace(PTRACE_GETSIGINFO, thread.tid, nullptr, &info) == 0 &&
+             (info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT);
+  if (!hit) {
+    memory.selectThread(currentThread);
+    return false;
+  }
 
-  while (line->address < funcEnd) {
-    auto loadAddress = offsetDwarfAddress(line->address);
-    if (line->address != startLine->address && !breakpoints.count(loadAddress)) {
-      setBreakPointAtAddress(loadAddress);
-      toDelete.push_back(loadAddress);
+  if (pc == ftraceUnwinder) {
+    // The unwinder cannot step through the trampoline, which has no call
+    // frame information, the returns of these calls are not recorded
+    restoreReturnAddresses(thread);
+    if (breakpoints.at(pc).getNumber() != 0) {
+      // Also a breakpoint of the user, reported as usual
+      memory.selectThread(currentThread);
+      return false;
     }
-    ++line;
+    memory.setPC(pc);
+    resumeOverBreakpoint(thread, breakpoints.at(pc));
+    return true;
   }
 
-  auto framePointer = memory.getRegisterValue(Reg::rbp);
-  auto returnAddress = memory.readMemory(framePointer + 8);
+  memory.setPC(pc);
+  if (pc == ftraceTrampoline) {
+    if (!returnFromTracedCall(thread)) {
+      memory.selectThread(currentThread);
+      return false;
+    }
+    // A breakpoint at the return address traps as soon as it is resumed
+    memory.selectThread(currentThread);
+    resumeThread(thread, false);
+    return true;
+  }
+  // The libraries are loaded by the first call
+  if (!ftraceUnwinderSearched) {
+    setUnwinderBreakpoint();
+    memory.selectThread(thread.tid);
+  }
+  enterTracedCall(thread, entry->second);
+  resumeOverBreakpoint(thread, breakpoints.at(pc));
+  return true;
+}
 
-  if (!breakpoints.count(returnAddress)) {
-    setBreakPointAtAddress(returnAddress);
-    toDelete.push_back(returnAddress);
+void Debugger::enterTracedCall(Thread &thread, std::size_t function) {
+  constexpr std::size_t maxDepth = 1024;
+  auto now = nanosecondsNow();
+  auto stack = memory.getRegisterValue(Reg::rsp);
+  auto returnAddress = memory.readMemory(stack);
+  bool tailCall = returnAddress == static_cast<uint64_t>(ftraceTrampoline);
+  ++tracedFunctions[function].calls;
+
+  // Calls left by a `longjmp` or an exception are below the stack pointer
+  auto &calls = thread.tracedCalls;
+  while (!calls.empty() && (calls.back().stack < stack || (calls.back().stack == stack && !tailCall))) {
+    calls.pop_back();
+  }
+  if (tailCall) {
+    // It returns with the traced call it replaces
+    if (calls.empty() || calls.back().stack != stack) {
+      return;
+    }
+    returnAddress = calls.back().returnAddress;
+  } else if (calls.size() < maxDepth) {
+    memory.writeMemory(stack, ftraceTrampoline);
+  } else {
+    return;
   }
+  calls.push_back(TracedCall{function, returnAddress, stack, now});
+}
 
-  continueExecution();
+bool Debugger::returnFromTracedCall(Thread &thread) {
+  auto now = nanosecondsNow();
+  // `ret` has popped the slot of the returning calls
+  auto stack = memory.getRegisterValue(Reg::rsp);
+  auto &calls = thread.tracedCalls;
+  uint64_t returnAddress = 0;
+  while (!calls.empty() && calls.back().stack < stack) {
+    const auto &call = calls.back();
+    if (call.stack + 8 == stack) {
+      returnAddress = call.returnAddress;
+      ++tracedFunctions[call.function].returns;
+      traceValues.assign({static_cast<int64_t>(now - call.entryTime), static_cast<int64_t>(calls.size() - 1)});
+      ftraceBuffer.record(call.function, thread.tid, now, traceValues);
+    }
+    calls.pop_back();
+  }
+  if (returnAddress == 0) {
+    spdlog::error("Thread {} returned to the ftrace trampoline without a traced call", thread.tid);
+    return false;
+  }
+  memory.setPC(returnAddress);
+  return true;
+}
 
-  for (auto address : toDelete) {
-    removeBreakpoint(address);
+uint64_t Debugger::getTracedReturnAddress(uint64_t address, uint64_t stack) {
+  if (ftraceTrampoline == 0 || address != static_cast<uint64_t>(ftraceTrampoline) ||
+      !threads.count(memory.getThread())) {
+    return address;
   }
+  for (const auto &call : threads.at(memory.getThread()).tracedCalls) {
+    if (call.stack + 8 == stack) {
+      return call.returnAddress;
+    }
+  }
+  return address;
 }
 
-uint64_t Debugger::offsetDwarfAddress(uint64_t address) { return address + loadAddress; }
+bool Debugger::remoteSyscall(long number, const std::vector<uint64_t> &args, uint64_t &result) {
+  static const Reg argumentRegisters[] = {Reg::rdi, Reg::rsi, Reg::rdx, Reg::r10, Reg::r8, Reg::r9};
+  static const uint8_t syscallInstruction[] = {0x0f, 0x05};
+  if (scratchAddress == 0 || !threads.count(currentThread) || threads.at(currentThread).running) {
+    return false;
+  }
+  auto &thread = threads.at(currentThread);
+  memory.selectThread(currentThread);
+  std::array<uint64_t, registersNumber> saved;
+  for (std::size_t i = 0; i < registersNumber; ++i) {
+    saved[i] = memory.getRegisterValue(Registers[i].reg);
+  }
+  auto pendingSignal = thread.pendingSignal;
+  thread.pendingSignal = 0;
+  uint8_t code[sizeof(syscallInstruction)];
+  memory.readBlock(scratchAddress, code, sizeof(code));
+  memory.writeBlock(scratchAddress, syscallInstruction, sizeof(syscallInstruction));
 
-dwarf::die Debugger::getFunctionFromPC(uint64_t pc) {
-  for (auto &compilationUnit : pDwarf.compilation_units()) {
-    if (dwarf::die_pc_range(compilationUnit.root()).contains(pc)) {
-      for (const auto &die : compilationUnit.root()) {
-        if (die.tag == dwarf::DW_TAG::subprogram) {
-          if (dwarf::die_pc_range(die).contains(pc)) {
-            return die;
-          }
-        }
-      }
+  memory.setRegisterValue(Reg::rax, number);
+  for (std::size_t i = 0; i < args.size() && i < 6; ++i) {
+    memory.setRegisterValue(argumentRegisters[i], args[i]);
+  }
+  // Not the restart of an interrupted syscall
+  memory.setRegisterValue(Reg::orig_rax, -1);
+  memory.setPC(scratchAddress);
+  // A signal arriving first is kept for later and the step is retried
+  int arrived = 0;
+  bool alive;
+  while ((alive = stepThread(thread))) {
+    arrived = thread.pendingSignal ? thread.pendingSignal : arrived;
+    thread.pendingSignal = 0;
+    if (memory.getPC() != scratchAddress) {
+      break;
     }
   }
+  memory.writeBlock(scratchAddress, code, sizeof(code));
+  if (!alive) {
+    return false;
+  }
 
-  spdlog::error("Cannot find function");
-  throw std::out_of_range{"Cannot find function"};
+  result = memory.getRegisterValue(Reg::rax);
+  for (std::size_t i = 0; i < registersNumber; ++i) {
+    memory.setRegisterValue(Registers[i].reg, saved[i]);
+  }
+  thread.pendingSignal = pendingSignal ? pendingSignal : arrived;
+  return true;
 }
 
-dwarf::line_table::iterator Debugger::getLineEntryFromPC(uint64_t pc) {
-  for (auto &compilationUnit : pDwarf.compilation_units()) {
-    if (dwarf::die_pc_range(compilationUnit.root()).contains(pc)) {
-      auto &lt = compilationUnit.get_line_table();
-      auto it = lt.find_address(pc);
-      if (it == lt.end()) {
-        spdlog::error("Cannot find line entry");
-        throw std::out_of_range{"Cannot find line entry"};
-      } else {
-        return it;
-      }
+bool Debugger::injectAgent() {
+  constexpr uint64_t reach = 16 << 20;
+  uint64_t lowest = UINT64_MAX;
+  for (const auto &mapping : memory.getMappings()) {
+    if (mapping.permissions.size() > 2 && mapping.permissions[2] == 'x') {
+      lowest = std::min(lowest, mapping.low);
     }
   }
-  spdlog::error("Cannot find line entry");
-  throw std::out_of_range{"Cannot find line entry"};
-}
+  uint64_t hint = lowest != UINT64_MAX && lowest > 2 * reach ? lowest - reach : 0x100000;
 
-void Debugger::initializeLoadAddress() {
-  if (pElf.get_hdr().type == elf::et::dyn) {
-    std::ifstream map("/proc/" + std::to_string(pid) + "/maps");
-    std::string address;
-    std::getline(map, address, '-');
-    map.close();
-    spdlog::info("The load address is {}", address);
-    loadAddress = std::stol(address, 0, 16);
+  uint64_t code = 0;
+  uint64_t data = 0;
+  // The kernel returns -errno on failure
+  auto failed = [](uint64_t address) { return address > static_cast<uint64_t>(-4096); };
+  if (!remoteSyscall(SYS_mmap, {hint, Agent::codeSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1ul, 0},
+                     code) ||
+      failed(code)) {
+    spdlog::error("Cannot map the code of the agent");
+    return false;
   }
+  if (!remoteSyscall(SYS_mmap, {0, Agent::dataSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1ul, 0},
+                     data) ||
+      failed(data)) {
+    spdlog::error("Cannot map the data of the agent");
+    uint64_t ignored;
+    remoteSyscall(SYS_munmap, {code, Agent::codeSize}, ignored);
+    return false;
+  }
+  agent.attach(pid, code, data);
+  spdlog::info("Injected the agent, code at 0x{:x}, data at 0x{:x}", code, data);
+  return true;
 }
 
-uint64_t Debugger::offsetLoadAddress(uint64_t address) { return address - loadAddress; }
+void Debugger::setFastPoint(std::intptr_t address) {
+  auto &bp = breakpoints.at(address);
+  if (!agentEnabled || (!bp.getCondition() && !bp.getCollect())) {
+    return;
+  }
+  if (!agent.isInjected() && !injectAgent()) {
+    // Do not try again on every breakpoint
+    agentEnabled = false;
+    return;
+  }
 
-void Debugger::printSource(const std::string &fileName, unsigned line, unsigned nLinesContext) {
-  std::ifstream file{fileName};
+  // The jump replaces whole instructions of the same function
+  auto func = symbolIndex.findFunction(offsetLoadAddress(address));
+  uint64_t low = 0;
+  uint64_t high = 0;
+  std::vector<Instruction> instructions;
+  if (func == nullptr || !getFunctionRange(*func, offsetLoadAddress(address), low, high) ||
+      !decodeRange(offsetDwarfAddress(low), offsetDwarfAddress(high), instructions)) {
+    spdlog::info("Breakpoint {} is evaluated by the debugger, its function cannot be decoded", bp.getNumber());
+    return;
+  }
+  std::vector<Instruction> replaced;
+  std::size_t length = 0;
+  for (const auto &instruction : instructions) {
+    if (instruction.address >= static_cast<uint64_t>(address) && length < Agent::jumpLength) {
+      replaced.push_back(instruction);
+      length += instruction.length;
+    }
+  }
+  bool usable = !replaced.empty() && replaced.front().address == static_cast<uint64_t>(address) &&
+                length >= Agent::jumpLength;
+  for (const auto &instruction : replaced) {
+    usable = usable && instruction.kind == InstructionKind::other;
+  }
+  // Nothing may branch past the first byte of the jump
+  for (const auto &instruction : instructions) {
+    bool direct = instruction.kind == InstructionKind::call || instruction.kind == InstructionKind::jump ||
+                  instruction.kind == InstructionKind::conditionalJump;
+    if (direct && instruction.target > static_cast<uint64_t>(address) && instruction.target < address + length) {
+      usable = false;
+    }
+  }
+  if (!usable) {
+    spdlog::info("Breakpoint {} is evaluated by the debugger, its instructions cannot be relocated", bp.getNumber());
+    return;
+  }
 
-  // Work out a window around the desired value
-  auto startLine = line <= nLinesContext ? 1 : line - nLinesContext;
-  auto endLine = line + nLinesContext + (line < nLinesContext ? nLinesContext - line : 0) + 1;
+  if (!agent.addPoint(memory, bp, replaced, readCode(address, length))) {
+    spdlog::info("Breakpoint {} is evaluated by the debugger", bp.getNumber());
+    return;
+  }
+  spdlog::info("Breakpoint {} is evaluated in the tracee", bp.getNumber());
+}
 
-  char c{};
-  unsigned int currentLine = 1;
-  while (currentLine != startLine && file.get(c)) {
-    if (c == '\n') {
-      ++currentLine;
+void Debugger::rearmFastPoints() {
+  std::vector<Agent::Point *> ready;
+  for (auto &addressAndPoint : agent.getPoints()) {
+    auto &point = addressAndPoint.second;
+    auto it = breakpoints.find(point.address);
+    if (!point.patched && it != breakpoints.end() && it->second.isEnabled() &&
+        !(point.collects && it->second.getIgnoreCount() > 0)) {
+      ready.push_back(&point);
     }
   }
+  if (ready.empty()) {
+    return;
+  }
 
-  std::cout << (currentLine == line ? "> " : "  ");
+  // A running thread could be executing the bytes being replaced
+  auto held = holdThreads();
+  std::vector<uint64_t> pcs;
+  for (const auto &tidAndThread : threads) {
+    memory.selectThread(tidAndThread.first);
+    pcs.push_back(memory.getPC());
+  }
+  memory.selectThread(currentThread);
 
-  while (currentLine <= endLine && file.get(c)) {
-    std::cout << c;
-    if (c == '\n') {
-      ++currentLine;
-      std::cout << (currentLine == line ? "> " : "  ");
+  for (auto point : ready) {
+    auto inside = [point](uint64_t address) {
+      return address > static_cast<uint64_t>(point->address) && address < point->address + point->original.size();
+    };
+    bool covered = std::any_of(pcs.begin(), pcs.end(), inside);
+    for (const auto &addressAndBreakpoint : breakpoints) {
+      covered = covered || (addressAndBreakpoint.second.isEnabled() && inside(addressAndBreakpoint.first));
+    }
+    for (const auto &slotAndBreakpoint : hardwareBreakpoints) {
+      const auto &hardwareBp = slotAndBreakpoint.second;
+      covered = covered || (hardwareBp.getKind() == HardwareBreakpointKind::execute && inside(hardwareBp.getAddress()));
+    }
+    if (!covered) {
+      Breakpoint::disableAll(memory, {&breakpoints.at(point->address)});
+      agent.patch(memory, *point);
     }
   }
+  releaseThreads(held);
+}
 
-  std::cout << std::endl;
-  file.close();
+void Debugger::demoteFastPoint(Agent::Point &point) {
+  if (!point.patched) {
+    return;
+  }
+  auto held = holdThreads();
+  agent.unpatch(memory, point);
+  auto it = breakpoints.find(point.address);
+  if (it != breakpoints.end()) {
+    Breakpoint::enableAll(memory, {&it->second});
+  }
+  releaseThreads(held);
 }
 
-siginfo_t Debugger::getSignalInfo() {
-  siginfo_t info;
-  ptrace(PTRACE_GETSIGINFO, pid, nullptr, &info);
-  return info;
+void Debugger::drainAgent() {
+  auto lost = agent.drain(memory, traceBuffer);
+  if (lost > 0) {
+    spdlog::warn("{} records of the agent were overwritten before they were read", lost);
+  }
 }
 
-void Debugger::handleSignalTrap(siginfo_t info) {
-  // Handle `SIGTRAP`. It suffices to know that
-  // `SI_KERNEL` or `TRAP_BRKPT` will be sent when
-  // a breakpoint is hit, and `TRAP_TRACE` will be
-  // sent on single step completion.
-  switch (info.si_code) {
-    case SI_KERNEL:
-    case TRAP_BRKPT: {
-      // Put the PC back where it should be, this is important
-      memory.setPC(memory.getPC() - 1);
-      spdlog::info("Hit breakpoint at address 0x{:x}", memory.getPC());
-      uint64_t offsetPC = offsetLoadAddress(memory.getPC());
-      // Get the current line
-      dwarf::line_table::iterator lineEntry = getLineEntryFromPC(offsetPC);
-      // print the source
-      printSource(lineEntry->file->path, lineEntry->line);
-      return;
-    }
-    // This will be set if the signal was sent by single stepping
-    case TRAP_TRACE:
-      return;
-    default:
-      spdlog::info("Unknown SIGTRAP code {}", info.si_code);
-      return;
+std::vector<std::intptr_t> Debugger::getFunctionAddresses(const std::string &name) {
+  std::vector<std::intptr_t> addresses;
+  for (const auto &die : symbolIndex.findFunctions(name)) {
+    auto lowPC = at_low_pc(die);
+    auto entry = getLineEntryFromPC(lowPC);
+    ++entry;  // skip prologue
+    addresses.push_back(offsetDwarfAddress(entry->address));
   }
+  return addresses;
 }
 
-void Debugger::handleCommand(const std::string &line) {
-  auto args = split(line, ' ');
-  // Get the first command
-  auto command = args[0];
+std::vector<std::intptr_t> Debugger::getSourceLineAddresses(const std::string &file, unsigned line) {
+  for (const auto &compilationUnit : pDwarf.compilation_units()) {
+    if (isSuffix(file, at_name(compilationUnit.root()))) {
+      const auto &lt = compilationUnit.get_line_table();
 
-  if (isPrefix(command, "cont")) {
-    continueExecution();
-  } else if (isPrefix(command, "break")) {
-    // For simplicity, this code assumes that user input 0xaddr
-    if (args[1][0] == '0' && args[1][1] == 'x') {
-      std::string address{args[1], 2};
-      setBreakPointAtAddress(std::stol(address, 0, 16));
-    } else if (args[1].find(':') != std::string::npos) {
-      auto fileAndLine = split(args[1], ':');
-      setBreakPointAtSourceLine(fileAndLine[0], std::stoi(fileAndLine[1]));
-    } else {
-      setBreakPointAtFunction(args[1]);
+      for (const auto &entry : lt) {
+        if (entry.is_stmt && entry.line == line) {
+          return {static_cast<std::intptr_t>(offsetDwarfAddress(entry.address))};
+        }
+      }
     }
+  }
+  return {};
+}
+
+std::vector<std::intptr_t> Debugger::resolveLocation(const std::string &location) {
+  // For simplicity, this code assumes that user input 0xaddr
+  if (location.size() > 2 && location[0] == '0' && location[1] == 'x') {
+    std::string address{location, 2};
+    return {static_cast<std::intptr_t>(std::stol(address, 0, 16))};
+  } else if (location.find(':') != std::string::npos) {
+    auto fileAndLine = split(location, ':');
+    return getSourceLineAddresses(fileAndLine[0], std::stoi(fileAndLine[1]));
+  } else {
+    return getFunctionAddresses(location);
+  }
+}
+
+void Debugger::setHardwareBreakpoint(std::intptr_t addr, HardwareBreakpointKind kind, std::size_t length) {
+  if (kind != HardwareBreakpointKind::execute &&
+      ((length != 1 && length != 2 && length != 4 && length != 8) || addr % length != 0)) {
+    spdlog::error("Watched length must be 1, 2, 4 or 8 and the address aligned to it");
+    return;
+  }
+
+  for (unsigned slot = 0; slot < HardwareBreakpoint::slotsNumber; ++slot) {
+    if (!hardwareBreakpoints.count(slot)) {
+      HardwareBreakpoint breakpoint{pid, slot, addr, kind, length};
+      // The debug registers of a running thread cannot be written
+      auto held = holdThreads();
+      bool armed = breakpoint.enable();
+      for (const auto &tidAndThread : threads) {
+        if (armed && tidAndThread.first != pid) {
+          armed = breakpoint.install(tidAndThread.first);
+        }
+      }
+      if (!armed) {
+        // The slot stays free, no thread keeps it enabled
+        for (const auto &tidAndThread : threads) {
+          breakpoint.uninstall(tidAndThread.first);
+        }
+        releaseThreads(held);
+        spdlog::error("Cannot set hardware breakpoint at address 0x{:x}", addr);
+        return;
+      }
+      releaseThreads(held);
+      hardwareBreakpoints[slot] = breakpoint;
+      spdlog::info("Set hardware breakpoint {0} at address 0x{1:x}", slot, addr);
+      return;
+    }
+  }
+  spdlog::error("All {} debug registers are in use", HardwareBreakpoint::slotsNumber);
+}
+
+void Debugger::removeHardwareBreakpoint(unsigned slot) {
+  if (!hardwareBreakpoints.count(slot)) {
+    spdlog::error("No hardware breakpoint {}", slot);
+    return;
+  }
+  // The debug registers of a running thread cannot be written
+  auto held = holdThreads();
+  hardwareBreakpoints.at(slot).disable();
+  for (const auto &tidAndThread : threads) {
+    if (tidAndThread.first != pid) {
+      hardwareBreakpoints.at(slot).uninstall(tidAndThread.first);
+    }
+  }
+  releaseThreads(held);
+  hardwareBreakpoints.erase(slot);
+}
+
+HardwareBreakpoint *Debugger::getHardwareBreakpointAt(std::intptr_t address) {
+  for (auto &slotAndBreakpoint : hardwareBreakpoints) {
+    auto &bp = slotAndBreakpoint.second;
+    if (bp.isEnabled() && bp.getKind() == HardwareBreakpointKind::execute && bp.getAddress() == address) {
+      return &bp;
+    }
+  }
+  return nullptr;
+}
+
+std::vector<Sym> Debugger::lookupSymbol(const std::string &name) { return symbolIndex.findSymbols(name); }
+
+void Debugger::stepOverBreakpoint() {
+  // The jump of a fast point would run its trampoline again
+  auto point = agent.findPoint(memory.getPC());
+  if (point && point->patched) {
+    demoteFastPoint(*point);
+  }
+  // The address must be stored in the breakpoints
+  Breakpoint *bp = nullptr;
+  if (breakpoints.count(memory.getPC()) && breakpoints[memory.getPC()].isEnabled()) {
+    bp = &breakpoints[memory.getPC()];
+  }
+  // A hardware execute breakpoint would fault again on the same instruction
+  HardwareBreakpoint *hardwareBp = getHardwareBreakpointAt(memory.getPC());
+
+  if ((bp == nullptr && hardwareBp == nullptr) || !threads.count(currentThread)) {
+    return;
+  }
+  auto &thread = threads.at(currentThread);
+  // With other threads running, the INT3 has to stay in place
+  if (hasRunningThreads() && displacedStep(thread)) {
+    return;
+  }
+
+  // The other threads are held, they cannot run past the removed INT3
+  auto held = holdThreads();
+  if (bp) {
+    Breakpoint::disableAll(memory, {bp});
+  }
+  if (hardwareBp) {
+    hardwareBp->uninstall(currentThread);
+  }
+  resumeThread(thread, true);
+  waitForSignal(currentThread);
+  if (bp) {
+    Breakpoint::enableAll(memory, {bp});
+  }
+  if (hardwareBp) {
+    hardwareBp->install(currentThread);
+  }
+  releaseThreads(held);
+}
+
+bool Debugger::displacedStep(Thread &thread) {
+  constexpr std::size_t maxInstructionLength = 15;
+  memory.selectThread(thread.tid);
+  auto address = memory.getPC();
+  auto code = readCode(address, maxInstructionLength);
+  Instruction instruction;
+  // A handler entered by the step would return to the buffer
+  bool usable = scratchAddress != 0 && thread.pendingSignal == 0 &&
+                decodeInstruction(code.data(), code.size(), address, instruction);
+  // A `syscall` could be a clone, whose child would start in the buffer
+  if (usable && instruction.length >= 2) {
+    usable = !(code[instruction.length - 2] == 0x0f && code[instruction.length - 1] == 0x05);
+  }
+
+  // RIP relative operands must still reach their data from the buffer
+  auto delta = static_cast<int64_t>(address - scratchAddress);
+  if (usable && instruction.ripDisplacement) {
+    int32_t displacement;
+    std::memcpy(&displacement, code.data() + instruction.ripDisplacement, sizeof(displacement));
+    auto moved = displacement + delta;
+    usable = moved >= INT32_MIN && moved <= INT32_MAX;
+    displacement = static_cast<int32_t>(moved);
+    std::memcpy(code.data() + instruction.ripDisplacement, &displacement, sizeof(displacement));
+  }
+  if (!usable) {
+    memory.selectThread(currentThread);
+    return false;
+  }
+
+  std::vector<uint8_t> saved(instruction.length);
+  memory.readBlock(scratchAddress, saved.data(), saved.size());
+  memory.writeBlock(scratchAddress, code.data(), instruction.length);
+  memory.setPC(scratchAddress);
+  bool alive = stepThread(thread);
+  memory.writeBlock(scratchAddress, saved.data(), saved.size());
+  if (!alive) {
+    memory.selectThread(currentThread);
+    return true;
+  }
+  if (memory.getPC() == scratchAddress) {
+    // A signal stopped the thread before the instruction ran, it is
+    // delivered when the thread is stepped in place
+    memory.setPC(address);
+    memory.selectThread(currentThread);
+    return false;
+  }
+
+  // Fall through, untaken and direct branches are relative to the
+  // buffer, absolute destinations like `ret` are already right
+  auto pc = memory.getPC();
+  auto kind = instruction.kind;
+  bool relative =
+      kind == InstructionKind::call || kind == InstructionKind::jump || kind == InstructionKind::conditionalJump;
+  if ((pc >= scratchAddress && pc <= scratchAddress + instruction.length) || relative) {
+    memory.setPC(pc + delta);
+  }
+  if (kind == InstructionKind::call || kind == InstructionKind::indirectCall) {
+    auto sp = memory.getRegisterValue(Reg::rsp);
+    uint64_t returnAddress = 0;
+    memory.readBlock(sp, &returnAddress, sizeof(returnAddress));
+    if (returnAddress == scratchAddress + instruction.length) {
+      returnAddress = address + instruction.length;
+      memory.writeBlock(sp, &returnAddress, sizeof(returnAddress));
+    }
+  }
+  memory.selectThread(currentThread);
+  return true;
+}
+
+bool Debugger::stepThread(Thread &thread) {
+  resumeThread(thread, true);
+  int waitStatus;
+  if (tracedWaitpid(thread.tid, &waitStatus, __WALL) == -1 || WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+    memory.forgetThread(thread.tid);
+    threads.erase(thread.tid);
+    return false;
+  }
+  thread.running = false;
+  // A signal which arrived instead of the step is delivered later
+  auto signal = WSTOPSIG(waitStatus);
+  if (waitStatus >> 16 == PTRACE_EVENT_CLONE) {
+    addClonedThread(thread.tid);
+  } else if ((signal & 0x7f) != SIGTRAP && !isRequestedStop(thread, waitStatus)) {
+    thread.pendingSignal = signal;
+  }
+  return true;
+}
+
+bool Debugger::skipTemporaryBreakpoint(Thread &thread, int waitStatus) {
+  if (thread.tid == currentThread || WSTOPSIG(waitStatus) != SIGTRAP || waitStatus >> 16 != 0) {
+    return false;
+  }
+  memory.selectThread(thread.tid);
+  auto pc = memory.getPC() - 1;
+  auto it = breakpoints.find(pc);
+  if (it == breakpoints.end() || it->second.getNumber() != 0 || !it->second.isEnabled()) {
+    memory.selectThread(currentThread);
+    return false;
+  }
+
+  // Stepping breakpoints belong to the current thread, the others pass
+  memory.setPC(pc);
+  resumeOverBreakpoint(thread, it->second);
+  return true;
+}
+
+void Debugger::resumeOverBreakpoint(Thread &thread, Breakpoint &bp) {
+  auto tid = thread.tid;
+  if (!displacedStep(thread)) {
+    auto held = holdThreads();
+    Breakpoint::disableAll(memory, {&bp});
+    memory.selectThread(thread.tid);
+    bool alive = stepThread(thread);
+    Breakpoint::enableAll(memory, {&bp});
+    releaseThreads(held);
+    if (!alive) {
+      memory.selectThread(currentThread);
+      return;
+    }
+  } else if (!threads.count(tid)) {
+    // It exited during the displaced step
+    return;
+  }
+  memory.selectThread(currentThread);
+  resumeThread(thread, false);
+}
+
+bool Debugger::hasRunningThreads() {
+  return std::any_of(threads.begin(), threads.end(), [](const std::pair<const pid_t, Thread> &tidAndThread) {
+    return tidAndThread.second.running;
+  });
+}
+
+std::vector<pid_t> Debugger::holdThreads() {
+  std::vector<pid_t> held;
+  for (const auto &tidAndThread : threads) {
+    if (tidAndThread.second.running) {
+      held.push_back(tidAndThread.first);
+    }
+  }
+  stopAllThreads();
+  return held;
+}
+
+void Debugger::releaseThreads(const std::vector<pid_t> &held) {
+  for (auto tid : held) {
+    if (threads.count(tid) && !threads.at(tid).running) {
+      resumeThread(threads.at(tid), false);
+    }
+  }
+}
+
+void Debugger::singleStepInstruction() {
+  if (!threads.count(currentThread)) {
+    spdlog::error("The process is not being run");
+    return;
+  }
+  resumeThread(threads.at(currentThread), true);
+  waitForSignal(currentThread);
+}
+
+void Debugger::singleStepInstructionWithBreakpointCheck() {
+  // First, check to see if we need to disable and enable breakpoint
+  if (breakpoints.count(memory.getPC()) || getHardwareBreakpointAt(memory.getPC())) {
+    stepOverBreakpoint();
+  } else {
+    singleStepInstruction();
+  }
+}
+
+void Debugger::stepOut() {
+  // With call frame information the return address and the stack
+  // pointer after the return are known, so one breakpoint is enough
+  Frame caller;
+  if (unwinder.covers(getOffsetPC()) &&
+      unwinder.unwind(memory, loadAddress, Unwinder::currentFrame(memory), caller)) {
+    runToAddresses({static_cast<std::intptr_t>(getTracedReturnAddress(caller.pc, caller.regs[7]))}, caller.regs[7]);
+    finishStep();
+    return;
+  }
+
+  // The return address is on the top of the stack when `ret` runs, above
+  // everything this call has pushed, so `ret`s executed with a lower
+  // stack pointer belong to deeper recursive calls.
+  auto stack = memory.getRegisterValue(Reg::rsp);
+  bool atEntry = false;
+
+  while (true) {
+    auto func = symbolIndex.findFunction(getOffsetPC());
+    uint64_t low = 0;
+    uint64_t high = 0;
+    std::vector<Instruction> instructions;
+    if (func == nullptr || !getFunctionRange(*func, getOffsetPC(), low, high) ||
+        !decodeRange(offsetDwarfAddress(low), offsetDwarfAddress(high), instructions)) {
+      if (atEntry) {
+        // Tail call into code without debug information
+        auto returnAddress = getTracedReturnAddress(memory.readMemory(stack), stack + 8);
+        runToAddresses({static_cast<std::intptr_t>(returnAddress)}, stack);
+        finishStep();
+      } else {
+        stepOutWithFramePointer();
+      }
+      return;
+    }
+
+    low = offsetDwarfAddress(low);
+    high = offsetDwarfAddress(high);
+    std::vector<std::intptr_t> exits;
+    const Instruction *current = nullptr;
+    for (const auto &instruction : instructions) {
+      if (instruction.address == memory.getPC()) {
+        current = &instruction;
+      }
+      if (instruction.kind == InstructionKind::ret || instruction.kind == InstructionKind::indirectJump) {
+        exits.push_back(instruction.address);
+      } else if ((instruction.kind == InstructionKind::jump || instruction.kind == InstructionKind::conditionalJump) &&
+                 (instruction.target < low || instruction.target >= high)) {
+        exits.push_back(instruction.target);  // tail call
+      }
+    }
+
+    if (current && (current->kind == InstructionKind::ret || current->kind == InstructionKind::indirectJump)) {
+      singleStepInstructionWithBreakpointCheck();
+      if (current->kind == InstructionKind::ret) {
+        break;
+      }
+      atEntry = memory.getPC() < low || memory.getPC() >= high;
+    } else {
+      if (!runToAddresses(exits, stack)) {
+        return;
+      }
+      atEntry = memory.getPC() < low || memory.getPC() >= high;
+    }
+  }
+  finishStep();
+}
+
+void Debugger::stepOutWithFramePointer() {
+  auto framePointer = memory.getRegisterValue(Reg::rbp);
+  auto returnAddress = getTracedReturnAddress(memory.readMemory(framePointer + 8), framePointer + 16);
+
+  bool shouldRemoveBreakpoint = false;
+  if (!breakpoints.count(returnAddress)) {
+    setTemporaryBreakpoints({static_cast<std::intptr_t>(returnAddress)});
+    shouldRemoveBreakpoint = true;
+  }
+
+  continueExecution();
+
+  if (shouldRemoveBreakpoint) {
+    removeBreakpoint(returnAddress);
+  }
+  finishStep();
+}
+
+void Debugger::stepInstructionOver() {
+  auto pc = memory.getPC();
+  auto code = readCode(pc, 15);
+  Instruction instruction;
+  if (decodeInstruction(code.data(), code.size(), pc, instruction) &&
+      (instruction.kind == InstructionKind::call || instruction.kind == InstructionKind::indirectCall)) {
+    // The call returns with the stack pointer where it is now
+    runToAddresses({static_cast<std::intptr_t>(pc + instruction.length)}, memory.getRegisterValue(Reg::rsp));
+  } else {
+    singleStepInstructionWithBreakpointCheck();
+  }
+  finishStep();
+}
+
+bool Debugger::runToAddresses(const std::vector<std::intptr_t> &addresses, uint64_t minStack, uint64_t frame) {
+  std::vector<std::intptr_t> temporaries;
+  for (auto address : addresses) {
+    if (!breakpoints.count(address)) {
+      temporaries.push_back(address);
+    }
+  }
+  std::sort(temporaries.begin(), temporaries.end());
+  temporaries.erase(std::unique(temporaries.begin(), temporaries.end()), temporaries.end());
+  setTemporaryBreakpoints(temporaries);
+
+  bool reached = false;
+  while (true) {
+    continueExecution();
+    auto pc = static_cast<std::intptr_t>(memory.getPC());
+    reached = std::find(addresses.begin(), addresses.end(), pc) != addresses.end();
+    if (!reached || stoppedAtUserBreakpoint()) {
+      reached = false;
+      break;
+    }
+    // The frame of the stop is compared when it can be unwound
+    auto stopFrame = frame != 0 ? getFrameAddress() : 0;
+    if (stopFrame != 0 ? stopFrame >= frame : memory.getRegisterValue(Reg::rsp) >= minStack) {
+      break;
+    }
+  }
+
+  removeBreakpoints(temporaries);
+  return reached;
+}
+
+std::vector<uint8_t> Debugger::readCode(uint64_t address, std::size_t length) {
+  std::vector<uint8_t> code(length);
+  code.resize(memory.readBlock(address, code.data(), length));
+  // Hide our own INT3 patches from the decoder
+  for (const auto &addressAndBreakpoint : breakpoints) {
+    const auto &bp = addressAndBreakpoint.second;
+    auto bpAddress = static_cast<uint64_t>(bp.getAddress());
+    if (bp.isEnabled() && bpAddress >= address && bpAddress < address + code.size()) {
+      code[bpAddress - address] = bp.getSavedData();
+    }
+  }
+  agent.hidePatches(address, code);
+  return code;
+}
+
+bool Debugger::decodeRange(uint64_t low, uint64_t high, std::vector<Instruction> &instructions) {
+  auto code = readCode(low, high - low);
+  if (code.size() != high - low) {
+    return false;
+  }
+  std::size_t position = 0;
+  while (position < code.size()) {
+    Instruction instruction;
+    if (!decodeInstruction(code.data() + position, code.size() - position, low + position, instruction)) {
+      return false;
+    }
+    instructions.push_back(instruction);
+    position += instruction.length;
+  }
+  return true;
+}
+
+bool Debugger::stoppedAtUserBreakpoint() {
+  auto it = breakpoints.find(memory.getPC());
+  return it != breakpoints.end() && it->second.getNumber() != 0;
+}
+
+void Debugger::finishStep() {
+  // A user breakpoint has already printed its source
+  if (!stoppedAtUserBreakpoint()) {
+    printSourceAtPC();
+  }
+}
+
+void Debugger::printSourceAtPC() {
+  auto lineEntry = symbolIndex.findLineEntry(getOffsetPC());
+  if (lineEntry) {
+    printSource((*lineEntry)->file->path, (*lineEntry)->line);
+  }
+}
+
+void Debugger::removeBreakpoint(std::intptr_t address) {
+  if (breakpoints.at(address).isEnabled()) {
+    Breakpoint::disableAll(memory, {&breakpoints.at(address)});
+  }
+  breakpoints.erase(address);
+}
+
+void Debugger::removeBreakpoints(const std::vector<std::intptr_t> &addresses) {
+  std::vector<Breakpoint *> bps;
+  for (auto address : addresses) {
+    bps.push_back(&breakpoints.at(address));
+  }
+  Breakpoint::disableAll(memory, bps);
+  for (auto address : addresses) {
+    breakpoints.erase(address);
+  }
+}
+
+void Debugger::stepIn() {
+  /*
+   * A simple algorithm is to just keep on stepping
+   * over instructions until we get to a new line.
+   */
+  auto line = getLineEntryFromPC(getOffsetPC())->line;
+  while (getLineEntryFromPC(getOffsetPC())->line == line) {
+    singleStepInstructionWithBreakpointCheck();
+  }
+  auto lineEntry = getLineEntryFromPC(getOffsetPC());
+  printSource(lineEntry->file->path, lineEntry->line);
+}
+
+uint64_t Debugger::getOffsetPC() { return offsetLoadAddress(memory.getPC()); }
+
+void Debugger::stepOver() {
+  uint64_t low = 0;
+  uint64_t high = 0;
+  std::vector<Instruction> instructions;
+  if (!symbolIndex.findLineRange(getOffsetPC(), low, high) ||
+      !decodeRange(offsetDwarfAddress(low), offsetDwarfAddress(high), instructions)) {
+    stepOverWithLineTable();
+    return;
+  }
+  low = offsetDwarfAddress(low);
+  high = offsetDwarfAddress(high);
+  auto inLine = [low, high](uint64_t pc) { return pc >= low && pc < high; };
+
+  // The line is left by falling through its end, by a jump out of it,
+  // or by a `ret` or an indirect jump whose destination is only known
+  // once it executes, so those are stepped.
+  std::vector<std::intptr_t> exits{static_cast<std::intptr_t>(high)};
+  std::vector<std::intptr_t> leaving;
+  for (const auto &instruction : instructions) {
+    switch (instruction.kind) {
+      case InstructionKind::jump:
+      case InstructionKind::conditionalJump:
+        if (!inLine(instruction.target)) {
+          exits.push_back(instruction.target);
+        }
+        break;
+      case InstructionKind::ret:
+      case InstructionKind::indirectJump:
+        leaving.push_back(instruction.address);
+        exits.push_back(instruction.address);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // A recursive call reaching the exits stops in a deeper frame
+  auto frame = getFrameAddress();
+  auto stack = memory.getRegisterValue(Reg::rsp);
+  while (inLine(memory.getPC())) {
+    if (std::find(leaving.begin(), leaving.end(), memory.getPC()) != leaving.end()) {
+      singleStepInstructionWithBreakpointCheck();
+    } else if (!runToAddresses(exits, stack, frame)) {
+      return;
+    }
+  }
+  finishStep();
+}
+
+void Debugger::stepOverWithLineTable() {
+  auto func = getFunctionFromPC(getOffsetPC());
+  // The part of the function being run, the return address covers the others
+  uint64_t funcEntry = 0;
+  uint64_t funcEnd = 0;
+  if (!getFunctionRange(func, getOffsetPC(), funcEntry, funcEnd)) {
+    spdlog::error("Cannot find the range of the current function");
+    return;
+  }
+
+  auto line = getLineEntryFromPC(funcEntry);
+  auto startLine = getLineEntryFromPC(getOffsetPC());
+
+  std::vector<std::intptr_t> toDelete{};
+
+  while (line->address < funcEnd) {
+    auto loadAddress = offsetDwarfAddress(line->address);
+    if (line->address != startLine->address && !breakpoints.count(loadAddress)) {
+      toDelete.push_back(loadAddress);
+    }
+    ++line;
+  }
+
+  auto returnAddress = getReturnAddress();
+
+  if (!breakpoints.count(returnAddress)) {
+    toDelete.push_back(returnAddress);
+  }
+
+  // Several rows may share an address
+  std::sort(toDelete.begin(), toDelete.end());
+  toDelete.erase(std::unique(toDelete.begin(), toDelete.end()), toDelete.end());
+
+  // Plant and remove all the temporary breakpoints in one batch
+  setTemporaryBreakpoints(toDelete);
+
+  continueExecution();
+
+  removeBreakpoints(toDelete);
+  finishStep();
+}
+
+uint64_t Debugger::getFrameAddress() {
+  Frame caller;
+  if (unwinder.covers(getOffsetPC()) &&
+      unwinder.unwind(memory, loadAddress, Unwinder::currentFrame(memory), caller)) {
+    return caller.regs[7];
+  }
+  return 0;
+}
+
+uint64_t Debugger::getReturnAddress() {
+  Frame caller;
+  if (unwinder.unwind(memory, loadAddress, Unwinder::currentFrame(memory), caller)) {
+    return getTracedReturnAddress(caller.pc, caller.regs[7]);
+  }
+  auto framePointer = memory.getRegisterValue(Reg::rbp);
+  return getTracedReturnAddress(memory.readMemory(framePointer + 8), framePointer + 16);
+}
+
+void Debugger::printBacktrace() {
+  constexpr unsigned maxFrames = 64;
+  auto frame = Unwinder::currentFrame(memory);
+  Frame caller;
+
+  while (true) {
+    // Return addresses point after the call, look up the call itself
+    auto pc = offsetLoadAddress(frame.pc) - (frame.depth == 0 ? 0 : 1);
+    auto function = symbolIndex.findFunctionName(pc);
+    if (function.empty()) {
+      function = "??";
+    }
+    std::string location;
+    std::string file;
+    unsigned line;
+    if (symbolIndex.findSourceLine(pc, file, line)) {
+      location = fmt::format(" at {}:{}", file, line);
+    }
+    spdlog::info("#{:<2} 0x{:016x} in {}(){}", frame.depth, frame.pc, function, location);
+
+    if (frame.depth + 1 >= maxFrames || !unwinder.unwind(memory, loadAddress, frame, caller)) {
+      break;
+    }
+    caller.pc = getTracedReturnAddress(caller.pc, caller.regs[7]);
+    frame = caller;
+  }
+}
+
+uint64_t Debugger::offsetDwarfAddress(uint64_t address) { return address + loadAddress; }
+
+dwarf::die Debugger::getFunctionFromPC(uint64_t pc) {
+  auto die = symbolIndex.findFunction(pc);
+  if (die == nullptr) {
+    spdlog::error("Cannot find function");
+    throw std::out_of_range{"Cannot find function"};
+  }
+  return *die;
+}
+
+dwarf::line_table::iterator Debugger::getLineEntryFromPC(uint64_t pc) {
+  auto entry = symbolIndex.findLineEntry(pc);
+  if (entry == nullptr) {
+    spdlog::error("Cannot find line entry");
+    throw std::out_of_range{"Cannot find line entry"};
+  }
+  return *entry;
+}
+
+bool Debugger::initializeLoadAddress() {
+  if (pElf.get_hdr().type != elf::et::dyn) {
+    return true;
+  }
+  // The executable is the mapping of `/proc/<pid>/exe` at offset 0,
+  // which is not necessarily the first one of an attached process
+  char exe[PATH_MAX] = {};
+  if (readlink(("/proc/" + std::to_string(pid) + "/exe").c_str(), exe, sizeof(exe) - 1) == -1) {
+    spdlog::error("Cannot read the executable of process {}: {}", pid, strerror(errno));
+    return false;
+  }
+  for (const auto &mapping : memory.getMappings()) {
+    if (mapping.offset == 0 && mapping.path == exe) {
+      loadAddress = mapping.low;
+      spdlog::info("The load address is {:x}", loadAddress);
+      return true;
+    }
+  }
+  spdlog::error("Cannot find the mapping of {} in process {}", exe, pid);
+  return false;
+}
+
+uint64_t Debugger::offsetLoadAddress(uint64_t address) { return address - loadAddress; }
+
+void Debugger::printSource(const std::string &fileName, unsigned line) {
+  // Work out a window around the desired value, shifted down near the top
+  auto startLine = line <= sourceContext ? 1 : line - sourceContext;
+  auto endLine = startLine + 2 * sourceContext;
+  listFile = fileName;
+  listLine = printSourceLines(fileName, startLine, endLine, line);
+}
+
+unsigned Debugger::printSourceLines(const std::string &fileName, unsigned first, unsigned last, unsigned current) {
+  Instrumentation::Scope scope{Phase::source, "printSourceLines"};
+  std::string text;
+  const char *data;
+  std::size_t length;
+  auto line = first;
+  for (; line <= last && sourceCache.getLine(fileName, line, data, length); ++line) {
+    text += line == current ? "> " : "  ";
+    text.append(data, length);
+    text += '\n';
+  }
+  if (line == first) {
+    auto count = sourceCache.getLineCount(fileName);
+    if (count == 0) {
+      spdlog::error("Cannot read {}", fileName);
+    } else {
+      spdlog::error("Line {} is out of range, {} has {} lines", first, fileName, count);
+    }
+    return 0;
+  }
+
+  std::cout << text << std::flush;
+  return line - 1;
+}
+
+std::string Debugger::findSourcePath(const std::string &file) {
+  for (const auto &compilationUnit : pDwarf.compilation_units()) {
+    const dwarf::line_table::file *lastFile = nullptr;
+    for (const auto &entry : compilationUnit.get_line_table()) {
+      if (entry.file != lastFile) {
+        lastFile = entry.file;
+        if (isSuffix(file, lastFile->path)) {
+          return lastFile->path;
+        }
+      }
+    }
+  }
+  // Not in the debug information, it may still be a readable path
+  return sourceCache.getLineCount(file) ? file : "";
+}
+
+void Debugger::listSource(const std::string &location) {
+  if (location.empty()) {
+    if (listFile.empty()) {
+      printSourceAtPC();
+      return;
+    }
+    auto lastLine = printSourceLines(listFile, listLine + 1, listLine + 1 + 2 * sourceContext, 0);
+    if (lastLine) {
+      listLine = lastLine;
+    }
+    return;
+  }
+
+  std::string file;
+  unsigned line = 0;
+  auto colon = location.find(':');
+  if (colon != std::string::npos) {
+    if (!parseNumber(location.substr(colon + 1), line)) {
+      spdlog::error("Invalid line number in {}", location);
+      return;
+    }
+    file = findSourcePath(location.substr(0, colon));
+  } else {
+    auto addresses = resolveLocation(location);
+    auto lineEntry = addresses.empty() ? nullptr : symbolIndex.findLineEntry(offsetLoadAddress(addresses.front()));
+    if (lineEntry) {
+      file = (*lineEntry)->file->path;
+      line = (*lineEntry)->line;
+    }
+  }
+  if (file.empty()) {
+    spdlog::error("No source for {}", location);
+    return;
+  }
+  printSource(file, line);
+}
+
+siginfo_t Debugger::getSignalInfo() {
+  siginfo_t info;
+  tracedPtrace(PTRACE_GETSIGINFO, currentThread, nullptr, &info);
+  return info;
+}
+
+void Debugger::handleSignalTrap(siginfo_t info) {
+  // Handle `SIGTRAP`. It suffices to know that
+  // `SI_KERNEL` or `TRAP_BRKPT` will be sent when
+  // a breakpoint is hit, and `TRAP_TRACE` will be
+  // sent on single step completion.
+  switch (info.si_code) {
+    case SI_KERNEL:
+    case TRAP_BRKPT: {
+      // Put the PC back where it should be, this is important
+      memory.setPC(memory.getPC() - 1);
+      if (auto point = agent.findStop(memory.getPC())) {
+        // The trampoline found the condition true and counted the hit, the
+        // tracee stops at the breakpoint with its own registers
+        memory.setPC(point->address);
+        if (breakpoints.at(point->address).consumeIgnore()) {
+          resumeAfterStop = true;
+          return;
+        }
+      } else if (breakpoints.count(memory.getPC())) {
+        auto &bp = breakpoints[memory.getPC()];
+        bp.recordHit();
+        auto condition = bp.getCondition();
+        if ((condition && !condition->evaluate(memory)) || bp.consumeIgnore()) {
+          resumeAfterStop = true;
+          return;
+        }
+        // Tracepoints record and go on, without printing anything
+        if (bp.getCollect()) {
+          collectTrace(bp);
+          resumeAfterStop = true;
+          return;
+        }
+      }
+      // Temporary breakpoints of the stepping commands stay silent
+      if (breakpoints.count(memory.getPC()) && breakpoints[memory.getPC()].getNumber() == 0) {
+        return;
+      }
+      // `execute` runs them once the stop is handled
+      if (breakpoints.count(memory.getPC())) {
+        hitCommands = breakpoints[memory.getPC()].getCommands();
+      }
+      spdlog::info("Hit breakpoint at address 0x{:x}", memory.getPC());
+      uint64_t offsetPC = offsetLoadAddress(memory.getPC());
+      // Get the current line
+      dwarf::line_table::iterator lineEntry = getLineEntryFromPC(offsetPC);
+      // print the source
+      printSource(lineEntry->file->path, lineEntry->line);
+      return;
+    }
+    case TRAP_HWBKPT:
+      handleHardwareBreakpoint();
+      return;
+    // This will be set if the signal was sent by single stepping
+    case TRAP_TRACE:
+      // A `ret` of a traced call lands on the trampoline
+      if (ftraceTrampoline != 0 && memory.getPC() == static_cast<uint64_t>(ftraceTrampoline)) {
+        returnFromTracedCall(threads.at(currentThread));
+      }
+      return;
+    default:
+      spdlog::info("Unknown SIGTRAP code {}", info.si_code);
+      return;
+  }
+}
+
+void Debugger::handleHardwareBreakpoint() {
+  auto status = HardwareBreakpoint::readStatus(currentThread);
+  HardwareBreakpoint::clearStatus(currentThread);
+
+  for (unsigned slot = 0; slot < HardwareBreakpoint::slotsNumber; ++slot) {
+    if (!(status & (uint64_t{1} << slot)) || !hardwareBreakpoints.count(slot)) {
+      continue;
+    }
+    const auto &bp = hardwareBreakpoints.at(slot);
+    if (bp.getKind() == HardwareBreakpointKind::execute) {
+      // Execute breakpoints are faults, the PC is already right
+      spdlog::info("Hit hardware breakpoint {0} at address 0x{1:x}", slot, memory.getPC());
+    } else {
+      uint64_t value = 0;
+      memory.readBlock(bp.getAddress(), &value, bp.getLength());
+      spdlog::info("Hardware watchpoint {0} at address 0x{1:x}, value 0x{2:x}", slot, bp.getAddress(), value);
+    }
+  }
+
+  printSourceAtPC();
+}
+
+void Debugger::handleCommand(const std::string &line) {
+  auto args = split(line, ' ');
+  // Get the first command
+  auto command = args[0];
+
+  if (isPrefix(command, "cont")) {
+    continueExecution();
+  } else if (isPrefix(command, "break")) {
+    // break <location> [if <expression>]
+    if (args.size() < 2) {
+      spdlog::error("Usage: break <location> [if <expression>]");
+      return;
+    }
+    std::shared_ptr<const Condition> condition;
+    if (args.size() > 3 && args[2] == "if") {
+      try {
+        condition = std::make_shared<const Condition>(line.substr(line.find(" if ") + 4));
+      } catch (const std::exception &e) {
+        spdlog::error("Invalid condition: {}", e.what());
+        return;
+      }
+    }
+    for (auto address : resolveLocation(args[1])) {
+      setBreakPointAtAddress(address, condition);
+    }
+  } else if (isPrefix(command, "info")) {
+    if (args.size() > 1 && isPrefix(args[1], "breakpoints")) {
+      dumpBreakpoints();
+    } else if (args.size() > 1 && isPrefix(args[1], "threads")) {
+      dumpThreads();
+    }
+  } else if (command == "commands") {
+    // commands [bp], then one command per line and end
+    // The block is read even for a wrong number, its lines must not run
+    unsigned number = nextBreakpointNumber - 1;
+    if (args.size() > 1 && !parseNumber(args[1], number)) {
+      spdlog::error("Invalid breakpoint number {}", args[1]);
+      number = 0;
+    } else if (number == 0) {
+      spdlog::error("No breakpoint number {}", number);
+    }
+    readingCommands = true;
+    commandsBreakpoint = number != 0 && getBreakpointByNumber(number) ? number : 0;
+    commandsRead.clear();
+  } else if (isPrefix(command, "ignore")) {
+    // ignore <bp> <count>
+    auto bp = getBreakpointByNumber(std::stoul(args[1]));
+    if (bp) {
+      bp->setIgnoreCount(std::stoull(args[2]));
+      spdlog::info("Will ignore next {} crossings of breakpoint {}", bp->getIgnoreCount(), bp->getNumber());
+    }
+  } else if (isPrefix(command, "hbreak")) {
+    for (auto address : resolveLocation(args[1])) {
+      setHardwareBreakpoint(address, HardwareBreakpointKind::execute, 1);
+    }
+  } else if (isPrefix(command, "watch")) {
+    // watch 0xaddr <len> [w|rw]
+    std::string address{args[1], 2};
+    auto kind = args.size() > 3 && args[3] == "rw" ? HardwareBreakpointKind::readWrite : HardwareBreakpointKind::write;
+    setHardwareBreakpoint(std::stol(address, 0, 16), kind, args.size() > 2 ? std::stoul(args[2], 0, 0) : 8);
+  } else if (isPrefix(command, "hdelete")) {
+    removeHardwareBreakpoint(std::stoul(args[1]));
   } else if (isPrefix(command, "register")) {
     if (isPrefix(args[1], "dump")) {
       memory.dumpRegisters();
@@ -353,18 +1811,106 @@ void Debugger::handleCommand(const std::string &line) {
   } else if (isPrefix(command, "memory")) {
     std::string address{args[2], 2};
     if (isPrefix(args[1], "read")) {
-      spdlog::info("{:016x}", memory.readMemory(std::stol(address, 0, 16)));
+      if (args.size() > 3) {
+        memory.dumpMemory(std::stoul(address, 0, 16), std::stoul(args[3], 0, 0));
+      } else {
+        spdlog::info("{:016x}", memory.readMemory(std::stol(address, 0, 16)));
+      }
     }
     if (isPrefix(args[1], "write")) {
       std::string value{args[3], 2};
       memory.writeMemory(std::stol(address, 0, 16), std::stol(value, 0, 16));
     }
+  } else if (command == "stepi") {
+    singleStepInstructionWithBreakpointCheck();
+    finishStep();
+  } else if (command == "stepi-over") {
+    stepInstructionOver();
   } else if (isPrefix(command, "step")) {
     stepIn();
   } else if (isPrefix(command, "next")) {
     stepOver();
   } else if (isPrefix(command, "finish")) {
     stepOut();
+  } else if (command == "catch") {
+    // catch syscall [name...|off]
+    if (args.size() < 2 || !isPrefix(args[1], "syscall")) {
+      spdlog::error("Usage: catch syscall [<name>...|off]");
+      return;
+    }
+    setSyscallCatchpoint(std::vector<std::string>(args.begin() + 2, args.end()));
+  } else if (isPrefix(command, "trace")) {
+    // trace <location> collect <expression>[, <expression>...]
+    auto collect = line.find(" collect ");
+    if (args.size() < 4 || collect == std::string::npos) {
+      spdlog::error("Usage: trace <location> collect <expression>[, <expression>...]");
+      return;
+    }
+    setTracepoint(args[1], line.substr(collect + 9));
+  } else if (command == "ftrace") {
+    // ftrace <function>...|report|off
+    if (args.size() < 2) {
+      spdlog::error("Usage: ftrace <function>...|report|off");
+    } else if (args[1] == "report") {
+      dumpFunctionTrace();
+    } else if (args[1] == "off") {
+      stopFunctionTrace();
+    } else {
+      setFunctionTrace(std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+  } else if (isPrefix(command, "tdump")) {
+    // tdump [count]
+    dumpTrace(args.size() > 1 ? std::stoul(args[1]) : SIZE_MAX);
+  } else if (command == "thread") {
+    // thread [tid]
+    if (args.size() > 1) {
+      switchThread(std::stoi(args[1]));
+    } else {
+      spdlog::info("Current thread is {}", currentThread);
+    }
+  } else if (isPrefix(command, "list")) {
+    // list [file:line|function|0xaddr]
+    listSource(args.size() > 1 ? args[1] : "");
+  } else if (command == "set") {
+    // set context <lines>
+    if (args.size() < 3 || !isPrefix(args[1], "context")) {
+      spdlog::error("Usage: set context <lines>");
+      return;
+    }
+    if (!parseNumber(args[2], sourceContext)) {
+      spdlog::error("Invalid number of lines {}", args[2]);
+    }
+  } else if (command == "stats") {
+    // stats [reset|log <file>|log off]
+    auto &instrumentation = Instrumentation::get();
+    if (args.size() < 2) {
+      instrumentation.dump();
+    } else if (args[1] == "reset") {
+      instrumentation.reset();
+    } else if (args[1] == "log" && args.size() > 2 && args[2] == "off") {
+      instrumentation.closeLog();
+    } else if (args[1] == "log" && args.size() > 2) {
+      instrumentation.openLog(args[2]);
+    } else {
+      spdlog::error("Usage: stats [reset|log <file>|log off]");
+    }
+  } else if (isPrefix(command, "detach")) {
+    detach();
+  } else if (isPrefix(command, "profile")) {
+    // profile [seconds] [hz] [file]
+    ProfileOptions options;
+    if (args.size() > 1) {
+      options.duration = std::stod(args[1]);
+    }
+    if (args.size() > 2) {
+      options.frequency = std::stoul(args[2]);
+    }
+    if (args.size() > 3) {
+      options.output = args[3];
+    }
+    profile(options);
+  } else if (isPrefix(command, "backtrace") || command == "bt") {
+    printBacktrace();
   } else if (isPrefix(command, "symbol")) {
     auto syms = lookupSymbol(args[1]);
     for (auto sym : syms) {
@@ -375,10 +1921,84 @@ void Debugger::handleCommand(const std::string &line) {
   }
 }
 
-void Debugger::waitForSignal() {
+void Debugger::waitForSignal(pid_t only) {
+  resumeAfterStop = false;
+  if (!hasRunningThreads()) {
+    spdlog::error("No thread is running");
+    return;
+  }
   int waitStatus;
-  int options = 0;
-  waitpid(pid, &waitStatus, options);
+  pid_t tid;
+  // Wait for any thread, the events we handle ourselves resume it
+  while (true) {
+    tid = tracedWaitpid(only, &waitStatus, __WALL);
+    if (tid == -1) {
+      spdlog::error("Cannot wait for the process: {}", strerror(errno));
+      return;
+    }
+    if (WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+      threads.erase(tid);
+      memory.forgetThread(tid);
+      if (tid == pid) {
+        spdlog::info("Process {} exited", pid);
+        return;
+      }
+      spdlog::info("Thread {} exited", tid);
+      if (tid == currentThread && !threads.empty()) {
+        // The stepped thread is gone, nothing else is running
+        switchThread(threads.begin()->first);
+        stopAllThreads();
+        return;
+      }
+      continue;
+    }
+
+    // A clone may stop before its parent reports it
+    auto &thread = threads.emplace(tid, Thread{tid}).first->second;
+    thread.running = false;
+    if (waitStatus >> 16 == PTRACE_EVENT_CLONE) {
+      addClonedThread(tid);
+      resumeThread(thread, false);
+      continue;
+    }
+    if (isRequestedStop(thread, waitStatus)) {
+      resumeThread(thread, false);
+      continue;
+    }
+    if (handleTracedFunction(thread, waitStatus) || skipTemporaryBreakpoint(thread, waitStatus)) {
+      continue;
+    }
+    if (WSTOPSIG(waitStatus) == (SIGTRAP | 0x80) && !isCaughtSyscall(tid)) {
+      resumeThread(thread, false);
+      continue;
+    }
+    break;
+  }
+
+  if (tid != currentThread && threads.size() > 1) {
+    spdlog::info("[Switching to thread {}]", tid);
+  }
+  currentThread = tid;
+  // All-stop: the others are halted before the prompt is back
+  if (!nonStop) {
+    stopAllThreads();
+  }
+  memory.selectThread(currentThread);
+  // Take one snapshot of the registers for the whole stop
+  memory.fetchRegisters();
+  if (agent.hasTracepoints()) {
+    drainAgent();
+  }
+
+  // `PTRACE_INTERRUPT` of a seized process carries no signal
+  if (waitStatus >> 16 == PTRACE_EVENT_STOP) {
+    spdlog::info("Process {} is stopped", pid);
+    return;
+  }
+  if (WSTOPSIG(waitStatus) == (SIGTRAP | 0x80)) {
+    reportSyscall();
+    return;
+  }
 
   siginfo_t siginfo = getSignalInfo();
 
@@ -394,21 +2014,551 @@ void Debugger::waitForSignal() {
   }
 }
 
+void Debugger::profile(const ProfileOptions &options) {
+  using Clock = std::chrono::steady_clock;
+  using Seconds = std::chrono::duration<double>;
+  if (ftraceTrampoline != 0) {
+    // The hijacked returns need the trampoline breakpoint
+    spdlog::error("Cannot profile while functions are traced, use `ftrace off` first");
+    return;
+  }
+  spdlog::info("Profiling process {} at {} Hz", pid, options.frequency);
+
+  // A breakpoint would stop the sampling loop, lift them meanwhile, the
+  // fast points are patched again by the next `cont`
+  for (auto &addressAndPoint : agent.getPoints()) {
+    demoteFastPoint(addressAndPoint.second);
+  }
+  std::vector<Breakpoint *> enabled;
+  for (auto &addressAndBreakpoint : breakpoints) {
+    if (addressAndBreakpoint.second.isEnabled()) {
+      enabled.push_back(&addressAndBreakpoint.second);
+    }
+  }
+  Breakpoint::disableAll(memory, enabled);
+  // Hardware breakpoints trap too, DR7 is cleared for the sampling window
+  std::map<pid_t, uint64_t> controls;
+  if (!hardwareBreakpoints.empty()) {
+    for (const auto &tidAndThread : threads) {
+      controls[tidAndThread.first] = HardwareBreakpoint::readControl(tidAndThread.first);
+      HardwareBreakpoint::writeControl(tidAndThread.first, 0);
+    }
+  }
+
+  Profiler profiler;
+  std::vector<uint64_t> stack;
+  const Seconds period{1.0 / std::max(options.frequency, 1u)};
+  Seconds interval = period;
+  Seconds stopped{0};
+  auto start = Clock::now();
+  bool alive = true;
+
+  // Syscall stops would end the sampling window of a thread early
+  bool syscalls = catchingSyscalls;
+  catchingSyscalls = false;
+
+  while (alive) {
+    resumeAllThreads();
+    std::this_thread::sleep_for(interval);
+
+    // Signals met on the way are kept pending and delivered on resume
+    auto stopStart = Clock::now();
+    stopAllThreads();
+    if (threads.empty()) {
+      alive = false;
+      break;
+    }
+
+    for (const auto &tidAndThread : threads) {
+      auto tid = tidAndThread.first;
+      if (!hardwareBreakpoints.empty() && !controls.count(tid)) {
+        // A thread cloned meanwhile got the hardware breakpoints installed
+        controls[tid] = HardwareBreakpoint::readControl(tid);
+        HardwareBreakpoint::writeControl(tid, 0);
+      }
+      memory.selectThread(tid);
+      memory.fetchRegisters();
+      stack.clear();
+      auto frame = Unwinder::currentFrame(memory);
+      Frame caller;
+      stack.push_back(frame.pc);
+      while (stack.size() < options.maxDepth && unwinder.unwind(memory, loadAddress, frame, caller)) {
+        // Return addresses point after the call, keep the call itself
+        stack.push_back(caller.pc - 1);
+        frame = caller;
+      }
+      profiler.addSample(stack);
+    }
+    stopped += Clock::now() - stopStart;
+
+    // Back off when the stops cost more than the overhead budget
+    Seconds elapsed = Clock::now() - start;
+    if (stopped.count() > options.maxOverhead * elapsed.count()) {
+      interval = std::min(interval * 2, Seconds{1});
+    } else if (interval > period) {
+      interval = std::max(interval / 2, period);
+    }
+    if (options.duration > 0 && elapsed.count() >= options.duration) {
+      break;
+    }
+  }
+
+  catchingSyscalls = syscalls;
+  if (alive && !threads.count(currentThread)) {
+    currentThread = threads.begin()->first;
+  }
+  memory.selectThread(currentThread);
+
+  Seconds elapsed = Clock::now() - start;
+  spdlog::info("Collected {} samples in {:.2f}s, the tracee was stopped {:.2f}% of the time",
+               profiler.getSampleCount(),
+               elapsed.count(),
+               elapsed.count() > 0 ? 100 * stopped.count() / elapsed.count() : 0.0);
+
+  // Symbolize only now, off the sampling path
+  auto mappings = alive ? memory.getMappings() : std::vector<Mapping>{};
+  auto symbolize = [this, &mappings](uint64_t pc) -> std::string {
+    auto function = symbolIndex.findFunctionName(offsetLoadAddress(pc));
+    if (function.empty()) {
+      function = symbolIndex.findSymbolName(offsetLoadAddress(pc));
+    }
+    if (!function.empty()) {
+      return function;
+    }
+    for (const auto &mapping : mappings) {
+      if (pc >= mapping.low && pc < mapping.high && !mapping.path.empty()) {
+        return "[" + mapping.path.substr(mapping.path.rfind('/') + 1) + "]";
+      }
+    }
+    return fmt::format("0x{:x}", pc);
+  };
+  std::ofstream out{options.output};
+  auto stacks = profiler.writeFolded(out, symbolize);
+  spdlog::info("Wrote {} folded stacks to {}", stacks, options.output);
+
+  if (alive) {
+    Breakpoint::enableAll(memory, enabled);
+    for (const auto &tidAndControl : controls) {
+      if (threads.count(tidAndControl.first)) {
+        HardwareBreakpoint::writeControl(tidAndControl.first, tidAndControl.second);
+      }
+    }
+  } else {
+    spdlog::info("Process {} exited", pid);
+  }
+}
+
+void Debugger::runProfiler(const ProfileOptions &options) {
+  if (start()) {
+    profile(options);
+  }
+}
+
+void Debugger::initializeThreads() {
+  long options = PTRACE_O_TRACECLONE | PTRACE_O_TRACESYSGOOD;
+  tracedPtrace(PTRACE_SETOPTIONS, pid, nullptr, options);
+  // `_start` never runs again, its bytes are the displaced stepping buffer
+  scratchAddress = offsetDwarfAddress(pElf.get_hdr().entry);
+  if (!attached) {
+    return;
+  }
+
+  // Threads which existed before the attach are seized one by one
+  auto dir = opendir(("/proc/" + std::to_string(pid) + "/task").c_str());
+  if (dir == nullptr) {
+    spdlog::error("Cannot list the threads of process {}", pid);
+    return;
+  }
+  while (auto entry = readdir(dir)) {
+    pid_t tid = std::atoi(entry->d_name);
+    if (tid <= 0 || threads.count(tid)) {
+      continue;
+    }
+    if (tracedPtrace(PTRACE_SEIZE, tid, nullptr, options) == -1) {
+      spdlog::error("Cannot attach to thread {}: {}", tid, strerror(errno));
+      continue;
+    }
+    tracedPtrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+    int waitStatus;
+    tracedWaitpid(tid, &waitStatus, __WALL);
+    auto &thread = threads.emplace(tid, Thread{tid}).first->second;
+    thread.running = false;
+    thread.isNew = false;
+  }
+  closedir(dir);
+  spdlog::info("Process {} has {} threads", pid, threads.size());
+}
+
+void Debugger::addClonedThread(pid_t parent) {
+  unsigned long tid = 0;
+  tracedPtrace(PTRACE_GETEVENTMSG, parent, nullptr, &tid);
+  // Its first stop is automatic and will be swallowed
+  threads.emplace(tid, Thread{static_cast<pid_t>(tid)});
+}
+
+bool Debugger::isRequestedStop(Thread &thread, int waitStatus) {
+  auto signal = WSTOPSIG(waitStatus);
+  if ((signal != SIGSTOP && waitStatus >> 16 != PTRACE_EVENT_STOP) || (!thread.stopExpected && !thread.isNew)) {
+    return false;
+  }
+  thread.stopExpected = false;
+  if (thread.isNew) {
+    // Debug registers are not inherited by clones
+    thread.isNew = false;
+    for (const auto &slotAndBreakpoint : hardwareBreakpoints) {
+      if (slotAndBreakpoint.second.isEnabled()) {
+        slotAndBreakpoint.second.install(thread.tid);
+      }
+    }
+    spdlog::info("New thread {}", thread.tid);
+  }
+  return true;
+}
+
+void Debugger::resumeThread(Thread &thread, bool singleStep) {
+  memory.invalidateRegisters();
+  auto request = singleStep ? PTRACE_SINGLESTEP : catchingSyscalls ? PTRACE_SYSCALL : PTRACE_CONT;
+  tracedPtrace(request, thread.tid, nullptr, static_cast<long>(thread.pendingSignal));
+  thread.pendingSignal = 0;
+  thread.running = true;
+}
+
+void Debugger::resumeAllThreads() {
+  for (auto &tidAndThread : threads) {
+    if (!tidAndThread.second.running) {
+      resumeThread(tidAndThread.second, false);
+    }
+  }
+}
+
+void Debugger::stopAllThreads() {
+  bool waited = true;
+  // Clone events met on the way add threads, scan until all are halted
+  while (waited) {
+    waited = false;
+    for (auto &tidAndThread : threads) {
+      auto &thread = tidAndThread.second;
+      if (thread.running && !thread.stopExpected && !thread.isNew) {
+        if (attached) {
+          tracedPtrace(PTRACE_INTERRUPT, thread.tid, nullptr, nullptr);
+        } else {
+          syscall(SYS_tgkill, pid, thread.tid, SIGSTOP);
+        }
+        thread.stopExpected = true;
+      }
+    }
+
+    for (auto it = threads.begin(); it != threads.end();) {
+      auto &thread = it->second;
+      if (!thread.running) {
+        ++it;
+        continue;
+      }
+      waited = true;
+      int waitStatus;
+      if (tracedWaitpid(thread.tid, &waitStatus, __WALL) == -1 || WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+        memory.forgetThread(thread.tid);
+        it = threads.erase(it);
+        continue;
+      }
+      thread.running = false;
+      recordStop(thread, waitStatus);
+      ++it;
+    }
+  }
+}
+
+void Debugger::recordStop(Thread &thread, int waitStatus) {
+  if (waitStatus >> 16 == PTRACE_EVENT_CLONE) {
+    addClonedThread(thread.tid);
+    return;
+  }
+  if (isRequestedStop(thread, waitStatus)) {
+    return;
+  }
+
+  auto signal = WSTOPSIG(waitStatus);
+  if (signal == (SIGTRAP | 0x80)) {
+    // A syscall stop, the thread goes on with the syscall when resumed
+    return;
+  }
+  if (signal != SIGTRAP) {
+    // Delivered when the thread is resumed
+    thread.pendingSignal = signal;
+    return;
+  }
+
+  // A breakpoint hit is undone, the thread will hit it again when resumed
+  siginfo_t info;
+  tracedPtrace(PTRACE_GETSIGINFO, thread.tid, nullptr, &info);
+  memory.selectThread(thread.tid);
+  auto pc = memory.getPC() - 1;
+  if ((info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT) && breakpoints.count(pc) &&
+      breakpoints.at(pc).isEnabled()) {
+    memory.setPC(pc);
+    // No thread is left on the trampoline, `_start` must not run
+    if (pc == static_cast<uint64_t>(ftraceTrampoline)) {
+      returnFromTracedCall(thread);
+    }
+  } else if ((info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT) && agent.findStop(pc)) {
+    // Stopped by a fast point, which evaluates its condition again
+    memory.setPC(agent.findStop(pc)->address);
+  } else {
+    spdlog::debug("Dropped SIGTRAP of thread {}", thread.tid);
+  }
+  memory.selectThread(currentThread);
+}
+
+bool Debugger::isCaughtSyscall(pid_t tid) {
+  memory.selectThread(tid);
+  auto number = static_cast<long>(memory.getRegisterValue(Reg::orig_rax));
+  memory.selectThread(currentThread);
+  return catchingSyscalls && (caughtSyscalls.empty() ||
+                              std::find(caughtSyscalls.begin(), caughtSyscalls.end(), number) != caughtSyscalls.end());
+}
+
+void Debugger::reportSyscall() {
+  // The kernel sets rax to -ENOSYS before running the syscall
+  auto value = static_cast<int64_t>(memory.getRegisterValue(Reg::rax));
+  if (value == -ENOSYS) {
+    spdlog::info("Catchpoint: call to syscall {}", formatSyscallEntry(memory));
+  } else {
+    auto name = syscallName(static_cast<long>(memory.getRegisterValue(Reg::orig_rax)));
+    spdlog::info("Catchpoint: returned from syscall {} = {}", name, formatSyscallReturn(value));
+  }
+  printSourceAtPC();
+}
+
+void Debugger::setSyscallCatchpoint(const std::vector<std::string> &names) {
+  if (names.size() == 1 && names[0] == "off") {
+    catchingSyscalls = false;
+    caughtSyscalls.clear();
+    spdlog::info("No longer catching syscalls");
+    return;
+  }
+
+  std::vector<long> numbers;
+  for (const auto &name : names) {
+    auto number = syscallNumber(name);
+    if (number == -1) {
+      spdlog::error("Unknown syscall {}", name);
+      return;
+    }
+    numbers.push_back(number);
+  }
+  catchingSyscalls = true;
+  caughtSyscalls = numbers;
+  spdlog::info("Catching {} syscalls", numbers.empty() ? "all" : std::to_string(numbers.size()));
+}
+
+void Debugger::switchThread(pid_t tid) {
+  if (!threads.count(tid)) {
+    spdlog::error("No thread {}", tid);
+    return;
+  }
+  currentThread = tid;
+  memory.selectThread(tid);
+  spdlog::info("[Switching to thread {}]", tid);
+  printSourceAtPC();
+}
+
+void Debugger::dumpThreads() {
+  for (const auto &tidAndThread : threads) {
+    auto tid = tidAndThread.first;
+    if (tidAndThread.second.running) {
+      spdlog::info("{} {:<8} (running)", tid == currentThread ? '*' : ' ', tid);
+      continue;
+    }
+    memory.selectThread(tid);
+    auto pc = memory.getPC();
+    auto function = symbolIndex.findFunctionName(offsetLoadAddress(pc));
+    if (function.empty()) {
+      function = "??";
+    }
+    spdlog::info("{} {:<8} 0x{:016x} in {}()", tid == currentThread ? '*' : ' ', tid, pc, function);
+  }
+  memory.selectThread(currentThread);
+}
+
+void Debugger::detach() {
+  // Leave no INT3, hijacked return address or debug register behind, the
+  // process keeps running
+  stopAllThreads();
+  restoreReturnAddresses();
+  tracedEntries.clear();
+  ftraceTrampoline = 0;
+  ftraceUnwinder = 0;
+  ftraceUnwinderSearched = false;
+  // The trampolines stay mapped for the threads inside them
+  for (auto &addressAndPoint : agent.getPoints()) {
+    if (addressAndPoint.second.patched) {
+      agent.unpatch(memory, addressAndPoint.second);
+    }
+  }
+  std::vector<Breakpoint *> enabled;
+  for (auto &addressAndBreakpoint : breakpoints) {
+    if (addressAndBreakpoint.second.isEnabled()) {
+      enabled.push_back(&addressAndBreakpoint.second);
+    }
+  }
+  Breakpoint::disableAll(memory, enabled);
+  breakpoints.clear();
+  for (auto &slotAndBreakpoint : hardwareBreakpoints) {
+    for (const auto &tidAndThread : threads) {
+      slotAndBreakpoint.second.uninstall(tidAndThread.first);
+    }
+  }
+  hardwareBreakpoints.clear();
+
+  for (auto &tidAndThread : threads) {
+    auto &thread = tidAndThread.second;
+    // A `SIGSTOP` we sent and not yet consumed would stop the released process
+    while (thread.stopExpected && !attached) {
+      resumeThread(thread, false);
+      int waitStatus;
+      if (tracedWaitpid(thread.tid, &waitStatus, __WALL) == -1 || WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+        break;
+      }
+      thread.running = false;
+      recordStop(thread, waitStatus);
+    }
+  }
+
+  memory.invalidateRegisters();
+  for (const auto &tidAndThread : threads) {
+    tracedPtrace(PTRACE_DETACH, tidAndThread.first, nullptr, static_cast<long>(tidAndThread.second.pendingSignal));
+  }
+  detached = true;
+  spdlog::info("Detached from process {}", pid);
+}
+
+void Debugger::setNonStop(bool enabled) { nonStop = enabled; }
+
+void Debugger::setAgent(bool enabled) { agentEnabled = enabled; }
+
+bool Debugger::start() {
+  waitForSignal();
+  // Every symbol would be wrong without the load address
+  if (!initializeLoadAddress()) {
+    if (attached) {
+      detach();
+    }
+    return false;
+  }
+  initializeThreads();
+  return true;
+}
+
+void Debugger::execute(const std::string &line) {
+  if (readingCommands) {
+    auto first = line.find_first_not_of(" \t");
+    auto text = first == std::string::npos ? "" : line.substr(first, line.find_last_not_of(" \t") + 1 - first);
+    if (text != "end") {
+      if (!text.empty()) {
+        commandsRead.push_back(text);
+      }
+      return;
+    }
+    // An empty block removes the commands, the block of a wrong number is dropped
+    auto bp = commandsBreakpoint != 0 ? getBreakpointByNumber(commandsBreakpoint) : nullptr;
+    if (bp) {
+      bp->setCommands(commandsRead.empty() ? nullptr : std::make_shared<const std::vector<std::string>>(commandsRead));
+    }
+    readingCommands = false;
+    commandsBreakpoint = 0;
+    commandsRead.clear();
+    return;
+  }
+
+  runCommand(line);
+  // No prompt in between: a list ending with `cont` runs until the exit
+  while (hitCommands && threads.count(pid) && !detached) {
+    auto commands = std::move(hitCommands);
+    hitCommands = nullptr;
+    for (const auto &command : *commands) {
+      runCommand(command);
+      if (hitCommands || !threads.count(pid) || detached) {
+        break;
+      }
+    }
+  }
+}
+
+void Debugger::runCommand(const std::string &line) {
+  Instrumentation::Command command{line.substr(0, line.find(' '))};
+  if (!batchOutput) {
+    handleCommand(line);
+    return;
+  }
+  batchOutput->begin();
+  try {
+    handleCommand(line);
+  } catch (const std::exception &e) {
+    spdlog::error("{}", e.what());
+  }
+  batchOutput->end(line);
+}
+
+void Debugger::runScript(std::istream &input) {
+  std::string line;
+  while (!detached && std::getline(input, line)) {
+    auto first = line.find_first_not_of(" \t");
+    if (first != std::string::npos && line[first] != '#') {
+      execute(line.substr(first));
+    }
+  }
+}
+
+void Debugger::addScript(const std::string &path) { scripts.push_back(path); }
+
+void Debugger::runStartupScripts() {
+  for (const auto &path : scripts) {
+    std::ifstream script{path};
+    if (!script) {
+      spdlog::error("Cannot open {}", path);
+      continue;
+    }
+    runScript(script);
+  }
+}
+
+void Debugger::runBatch(std::istream &input) {
+  batchOutput = std::make_unique<BatchOutput>();
+  if (!start()) {
+    batchOutput.reset();
+    return;
+  }
+  runStartupScripts();
+  runScript(input);
+
+  if (attached && !detached) {
+    detach();
+  }
+  batchOutput.reset();
+}
+
 void Debugger::run() {
   // When the traced process is launched, it will be
   // sent a `SIGTRAP` signal, which is a trace or
   // breakpoint trap. We can wait until this signal
   // is sent using the `waitpid` function
-  waitForSignal();
-  initializeLoadAddress();
+  if (!start()) {
+    return;
+  }
+  runStartupScripts();
 
   char *line = nullptr;
   // User linenoise library to handle user input for convenience
-  while ((line = linenoise("miniDebugger> ")) != nullptr) {
+  while (!detached && (line = linenoise(readingCommands ? ">" : "miniDebugger> ")) != nullptr) {
     // To handle the use input
-    handleCommand(line);
+    execute(line);
     // To add the line to the history to support history and navigation
     linenoiseHistoryAdd(line);
     linenoiseFree(line);
   }
+
+  // An attached process outlives the debugger, it must not keep our patches
+  if (attached && !detached) {
+    detach();
+  }
 }
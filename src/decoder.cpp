@@ -0,0 +1,399 @@
+#include "decoder.h"
+
+#include <cstring>
+
+/**
+ * @brief One byte opcodes followed by a ModRM byte, one bit per opcode
+ *
+ */
+static bool hasModRM(uint8_t opcode) {
+  static const uint8_t table[256] = {
+      //    0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
+      /*0*/ 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
+      /*1*/ 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
+      /*2*/ 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
+      /*3*/ 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
+      /*4*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*5*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*6*/ 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0, 0,
+      /*7*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*8*/ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+      /*9*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*a*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*b*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*c*/ 1, 1, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*d*/ 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+      /*e*/ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      /*f*/ 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1,
+  };
+  return table[opcode];
+}
+
+/**
+ * @brief One byte opcodes which do not exist in 64 bit mode
+ *
+ */
+static bool isInvalid64(uint8_t opcode) {
+  switch (opcode) {
+    case 0x06:
+    case 0x07:
+    case 0x0e:
+    case 0x16:
+    case 0x17:
+    case 0x1e:
+    case 0x1f:
+    case 0x27:
+    case 0x2f:
+    case 0x37:
+    case 0x3f:
+    case 0x60:
+    case 0x61:
+    case 0x82:
+    case 0x9a:
+    case 0xce:
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xea:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Two byte (0F xx) opcodes without a ModRM byte
+ *
+ */
+static bool twoByteHasModRM(uint8_t opcode) {
+  switch (opcode) {
+    case 0x05:
+    case 0x06:
+    case 0x07:
+    case 0x08:
+    case 0x09:
+    case 0x0b:
+    case 0x0e:
+    case 0x30:
+    case 0x31:
+    case 0x32:
+    case 0x33:
+    case 0x34:
+    case 0x35:
+    case 0x37:
+    case 0x77:
+    case 0xa0:
+    case 0xa1:
+    case 0xa2:
+    case 0xa8:
+    case 0xa9:
+    case 0xaa:
+      return false;
+    default:
+      // jcc rel32 and bswap
+      return !(opcode >= 0x80 && opcode <= 0x8f) && !(opcode >= 0xc8 && opcode <= 0xcf);
+  }
+}
+
+/**
+ * @brief Two byte (0F xx) opcodes followed by an 8 bit immediate
+ *
+ */
+static bool twoByteHasImm8(uint8_t opcode) {
+  switch (opcode) {
+    case 0x0f:  // 3DNow! suffix
+    case 0x70:
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    case 0xa4:
+    case 0xac:
+    case 0xba:
+    case 0xc2:
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Length of the ModRM byte, the SIB byte and the displacement
+ *
+ * @return std::size_t 0 if `size` is too short
+ */
+static std::size_t modRMLength(const uint8_t *code, std::size_t size) {
+  if (size < 1) {
+    return 0;
+  }
+  auto modrm = code[0];
+  auto mod = modrm >> 6;
+  auto rm = modrm & 7;
+  std::size_t length = 1;
+
+  if (mod == 3) {
+    return length;
+  }
+  if (rm == 4) {
+    if (size < 2) {
+      return 0;
+    }
+    // No base register, disp32 instead
+    if (mod == 0 && (code[1] & 7) == 5) {
+      length += 4;
+    }
+    length += 1;
+  } else if (mod == 0 && rm == 5) {
+    length += 4;  // RIP relative
+  }
+  if (mod == 1) {
+    length += 1;
+  } else if (mod == 2) {
+    length += 4;
+  }
+  return length <= size ? length : 0;
+}
+
+static int64_t readSigned(const uint8_t *code, std::size_t bytes) {
+  if (bytes == 1) {
+    return static_cast<int8_t>(code[0]);
+  }
+  int32_t value;
+  std::memcpy(&value, code, sizeof(value));
+  return value;
+}
+
+bool decodeInstruction(const uint8_t *code, std::size_t size, uint64_t address, Instruction &instruction) {
+  std::size_t position = 0;
+  bool operandSize16 = false;
+  bool addressSize32 = false;
+  bool rexW = false;
+
+  // Legacy prefixes, at most 14 bytes in total
+  while (position < size && position < 14) {
+    auto byte = code[position];
+    if (byte == 0x66) {
+      operandSize16 = true;
+    } else if (byte == 0x67) {
+      addressSize32 = true;
+    } else if (byte != 0xf0 && byte != 0xf2 && byte != 0xf3 && byte != 0x2e && byte != 0x36 && byte != 0x3e &&
+               byte != 0x26 && byte != 0x64 && byte != 0x65) {
+      break;
+    }
+    ++position;
+  }
+  // REX must immediately precede the opcode
+  if (position < size && (code[position] & 0xf0) == 0x40) {
+    rexW = code[position] & 0x08;
+    ++position;
+  }
+  if (position >= size) {
+    return false;
+  }
+
+  instruction.address = address;
+  instruction.kind = InstructionKind::other;
+  instruction.target = 0;
+  instruction.ripDisplacement = 0;
+
+  auto opcode = code[position++];
+  std::size_t immediate = 0;
+  std::size_t relative = 0; /**< size of a branch displacement */
+  bool modrm = false;
+  std::size_t immz = operandSize16 ? 2 : 4;
+
+  // AMD XOP looks like `pop r/m` but with a map number of 8 or more
+  if (opcode == 0x8f && position < size && (code[position] & 0x1f) >= 8) {
+    unsigned map = code[position] & 0x1f;
+    position += 3;
+    modrm = true;
+    immediate = map == 8 ? 1 : map == 0xa ? 4 : 0;
+  } else if (opcode == 0xc4 || opcode == 0xc5 || opcode == 0x62) {
+    // VEX and EVEX: the opcode map is encoded in the prefix
+    unsigned map = 1;
+    if (opcode == 0xc5) {
+      position += 1;
+    } else if (opcode == 0xc4) {
+      if (position >= size) {
+        return false;
+      }
+      map = code[position] & 0x1f;
+      position += 2;
+    } else {
+      if (position >= size) {
+        return false;
+      }
+      map = code[position] & 0x07;
+      position += 3;
+    }
+    if (position >= size) {
+      return false;
+    }
+    auto vexOpcode = code[position++];
+    // vzeroupper and vzeroall have no ModRM
+    modrm = !(map == 1 && vexOpcode == 0x77);
+    if (map == 3 || (map == 1 && twoByteHasImm8(vexOpcode))) {
+      immediate = 1;
+    }
+  } else if (opcode == 0x0f) {
+    if (position >= size) {
+      return false;
+    }
+    auto second = code[position++];
+    if (second == 0x38 || second == 0x3a) {
+      if (position >= size) {
+        return false;
+      }
+      ++position;
+      modrm = true;
+      immediate = second == 0x3a ? 1 : 0;
+    } else {
+      modrm = twoByteHasModRM(second);
+      immediate = twoByteHasImm8(second) ? 1 : 0;
+      if (second >= 0x80 && second <= 0x8f) {
+        instruction.kind = InstructionKind::conditionalJump;
+        relative = 4;
+      }
+    }
+  } else {
+    if (isInvalid64(opcode)) {
+      return false;
+    }
+    modrm = hasModRM(opcode);
+
+    switch (opcode) {
+      case 0x04:
+      case 0x0c:
+      case 0x14:
+      case 0x1c:
+      case 0x24:
+      case 0x2c:
+      case 0x34:
+      case 0x3c:
+      case 0x6a:
+      case 0x6b:
+      case 0x80:
+      case 0x83:
+      case 0xa8:
+      case 0xc0:
+      case 0xc1:
+      case 0xc6:
+      case 0xcd:
+      case 0xe4:
+      case 0xe5:
+      case 0xe6:
+      case 0xe7:
+        immediate = 1;
+        break;
+      case 0x05:
+      case 0x0d:
+      case 0x15:
+      case 0x1d:
+      case 0x25:
+      case 0x2d:
+      case 0x35:
+      case 0x3d:
+      case 0x68:
+      case 0x69:
+      case 0x81:
+      case 0xa9:
+      case 0xc7:
+        immediate = immz;
+        break;
+      case 0xa0:
+      case 0xa1:
+      case 0xa2:
+      case 0xa3:
+        immediate = addressSize32 ? 4 : 8;  // moffs
+        break;
+      case 0xc2:
+        immediate = 2;
+        instruction.kind = InstructionKind::ret;
+        break;
+      case 0xca:
+        immediate = 2;
+        instruction.kind = InstructionKind::ret;
+        break;
+      case 0xc3:
+      case 0xcb:
+      case 0xcf:
+        instruction.kind = InstructionKind::ret;
+        break;
+      case 0xc8:
+        immediate = 3;
+        break;
+      case 0xe8:
+        instruction.kind = InstructionKind::call;
+        relative = 4;
+        break;
+      case 0xe9:
+        instruction.kind = InstructionKind::jump;
+        relative = 4;
+        break;
+      case 0xeb:
+        instruction.kind = InstructionKind::jump;
+        relative = 1;
+        break;
+      case 0xe0:
+      case 0xe1:
+      case 0xe2:
+      case 0xe3:
+        instruction.kind = InstructionKind::conditionalJump;
+        relative = 1;
+        break;
+      default:
+        if (opcode >= 0x70 && opcode <= 0x7f) {
+          instruction.kind = InstructionKind::conditionalJump;
+          relative = 1;
+        } else if (opcode >= 0xb0 && opcode <= 0xb7) {
+          immediate = 1;
+        } else if (opcode >= 0xb8 && opcode <= 0xbf) {
+          immediate = rexW ? 8 : immz;  // the only 64 bit immediate
+        }
+    }
+
+    // Groups whose form depends on the reg field of ModRM
+    if ((opcode == 0xf6 || opcode == 0xf7 || opcode == 0xff) && position < size) {
+      auto reg = (code[position] >> 3) & 7;
+      if (opcode == 0xf6 && reg < 2) {
+        immediate = 1;
+      } else if (opcode == 0xf7 && reg < 2) {
+        immediate = immz;
+      } else if (opcode == 0xff && (reg == 2 || reg == 3)) {
+        instruction.kind = InstructionKind::indirectCall;
+      } else if (opcode == 0xff && (reg == 4 || reg == 5)) {
+        instruction.kind = InstructionKind::indirectJump;
+      }
+    }
+  }
+
+  if (modrm) {
+    auto length = modRMLength(code + position, size - position);
+    if (length == 0) {
+      return false;
+    }
+    // mod 00 with r/m 101 and no SIB byte is [rip + disp32]
+    if ((code[position] & 0xc7) == 0x05) {
+      instruction.ripDisplacement = position + 1;
+    }
+    position += length;
+  }
+
+  if (relative) {
+    if (position + relative > size) {
+      return false;
+    }
+    auto displacement = readSigned(code + position, relative);
+    position += relative;
+    instruction.target = address + position + displacement;
+  }
+
+  position += immediate;
+  if (position > size || position > 15) {
+    return false;
+  }
+  instruction.length = position;
+  return true;
+}
@@ -0,0 +1,91 @@
+#include "hardwarebreakpoint.h"
+
+#include "instrumentation.h"
+#include "spdlog/spdlog.h"
+#include "sys/ptrace.h"
+#include "sys/user.h"
+
+#include <cstddef>
+
+/**
+ * @brief The offset of DR<n> in the `struct user` area
+ *
+ */
+static std::size_t debugRegisterOffset(unsigned n) { return offsetof(struct user, u_debugreg) + n * sizeof(long); }
+
+static uint64_t readDebugRegister(pid_t pid, unsigned n) {
+  return tracedPtrace(PTRACE_PEEKUSER, pid, debugRegisterOffset(n), nullptr);
+}
+
+static bool writeDebugRegister(pid_t pid, unsigned n, uint64_t value) {
+  if (tracedPtrace(PTRACE_POKEUSER, pid, debugRegisterOffset(n), value) == -1) {
+    spdlog::error("Cannot write debug register DR{} of thread {}", n, pid);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief The LEN field encoding of DR7
+ *
+ */
+static uint64_t lengthBits(std::size_t length) {
+  switch (length) {
+    case 2:
+      return 0b01;
+    case 4:
+      return 0b11;
+    case 8:
+      return 0b10;
+    default:
+      return 0b00;
+  }
+}
+
+HardwareBreakpoint::HardwareBreakpoint(
+    pid_t p, unsigned s, std::intptr_t addr, HardwareBreakpointKind k, std::size_t len)
+  : pid{p}
+  , slot{s}
+  , address{addr}
+  , kind{k}
+  , length{k == HardwareBreakpointKind::execute ? 1 : len}
+  , enabled{false} {}
+
+bool HardwareBreakpoint::enable() {
+  enabled = install(pid);
+  return enabled;
+}
+
+void HardwareBreakpoint::disable() {
+  uninstall(pid);
+  enabled = false;
+}
+
+bool HardwareBreakpoint::install(pid_t tid) const {
+  if (!writeDebugRegister(tid, slot, address)) {
+    return false;
+  }
+
+  // DR7: bit 2n is the local enable of slot n, bits 16+4n..17+4n are
+  // its R/W field and bits 18+4n..19+4n its LEN field
+  auto dr7 = readDebugRegister(tid, 7);
+  auto shift = 16 + slot * 4;
+  dr7 &= ~(uint64_t{0b1111} << shift);
+  dr7 |= (static_cast<uint64_t>(kind) | lengthBits(length) << 2) << shift;
+  dr7 |= uint64_t{1} << (slot * 2);
+  return writeDebugRegister(tid, 7, dr7);
+}
+
+void HardwareBreakpoint::uninstall(pid_t tid) const {
+  auto dr7 = readDebugRegister(tid, 7);
+  dr7 &= ~(uint64_t{1} << (slot * 2));
+  writeDebugRegister(tid, 7, dr7);
+}
+
+uint64_t HardwareBreakpoint::readControl(pid_t tid) { return readDebugRegister(tid, 7); }
+
+void HardwareBreakpoint::writeControl(pid_t tid, uint64_t value) { writeDebugRegister(tid, 7, value); }
+
+uint64_t HardwareBreakpoint::readStatus(pid_t pid) { return readDebugRegister(pid, 6); }
+
+void HardwareBreakpoint::clearStatus(pid_t pid) { writeDebugRegister(pid, 6, 0); }
@@ -0,0 +1,250 @@
+#include "indexfile.h"
+
+#include "spdlog/spdlog.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char indexMagic[8] = {'M', 'D', 'B', 'I', 'N', 'D', 'E', 'X'};
+constexpr uint32_t indexVersion = 1;
+
+/**
+ * @brief FNV-1a, the hash of the name table
+ *
+ */
+uint64_t hashName(const char *name, std::size_t length) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (std::size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<uint8_t>(name[i]);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+std::size_t alignUp(std::size_t value) { return (value + 7) & ~std::size_t{7}; }
+
+/**
+ * @brief `mkdir -p`
+ *
+ */
+bool makeDirectories(const std::string &path) {
+  for (auto slash = path.find('/', 1);; slash = path.find('/', slash + 1)) {
+    auto prefix = path.substr(0, slash);
+    if (mkdir(prefix.c_str(), 0755) == -1 && errno != EEXIST) {
+      return false;
+    }
+    if (slash == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+uint32_t IndexFile::Contents::addString(const std::string &s) {
+  auto it = stringOffsets.find(s);
+  if (it != stringOffsets.end()) {
+    return it->second;
+  }
+  auto offset = static_cast<uint32_t>(strings.size());
+  strings.append(s);
+  strings.push_back('\0');
+  stringOffsets.emplace(s, offset);
+  return offset;
+}
+
+IndexFile::~IndexFile() {
+  if (data) {
+    munmap(const_cast<uint8_t *>(data), size);
+  }
+}
+
+std::string IndexFile::getBuildId(const elf::elf &ef) {
+  const auto &section = ef.get_section(".note.gnu.build-id");
+  if (!section.valid() || section.size() < 16) {
+    return "";
+  }
+  // namesz, descsz, type, then the name and the description, both
+  // padded to 4 bytes
+  auto note = static_cast<const uint8_t *>(section.data());
+  uint32_t nameSize;
+  uint32_t descriptionSize;
+  std::memcpy(&nameSize, note, 4);
+  std::memcpy(&descriptionSize, note + 4, 4);
+  auto description = 12 + ((nameSize + 3) & ~3u);
+  if (description + descriptionSize > section.size() || descriptionSize > sizeof(Header::buildId)) {
+    return "";
+  }
+  return std::string{reinterpret_cast<const char *>(note + description), descriptionSize};
+}
+
+std::string IndexFile::getPath(const std::string &directory, const std::string &buildId) {
+  std::string name;
+  for (auto c : buildId) {
+    name += fmt::format("{:02x}", static_cast<uint8_t>(c));
+  }
+  return directory + "/" + name + ".index";
+}
+
+bool IndexFile::write(const std::string &path, const std::string &buildId, const Contents &contents) {
+  // Twice as many slots as names keeps the probe sequences short
+  std::size_t slots = 1;
+  while (slots < 2 * contents.names.size()) {
+    slots <<= 1;
+  }
+  std::vector<Name> names(slots, Name{emptySlot, 0});
+  for (const auto &name : contents.names) {
+    auto text = contents.strings.c_str() + name.first;
+    auto slot = hashName(text, std::strlen(text)) & (slots - 1);
+    while (names[slot].name != emptySlot) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    names[slot] = Name{name.first, name.second};
+  }
+
+  Header header{};
+  std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+  header.version = indexVersion;
+  header.buildIdSize = buildId.size();
+  std::memcpy(header.buildId, buildId.data(), buildId.size());
+  header.unitCount = contents.unitCount;
+
+  std::string image(sizeof(header), '\0');
+  auto append = [&image, &header](TableId id, const void *records, std::size_t count, std::size_t recordSize) {
+    image.resize(alignUp(image.size()), '\0');
+    header.offsets[id] = image.size();
+    header.counts[id] = count;
+    image.append(static_cast<const char *>(records), count * recordSize);
+  };
+  append(unitRangesTable, contents.unitRanges.data(), contents.unitRanges.size(), sizeof(UnitRange));
+  append(functionsTable, contents.functions.data(), contents.functions.size(), sizeof(Function));
+  append(linesTable, contents.lines.data(), contents.lines.size(), sizeof(Line));
+  append(namesTable, names.data(), names.size(), sizeof(Name));
+  append(ciesTable, contents.cies.data(), contents.cies.size(), sizeof(Cie));
+  append(fdesTable, contents.fdes.data(), contents.fdes.size(), sizeof(Fde));
+  append(stringsTable, contents.strings.data(), contents.strings.size(), 1);
+  std::memcpy(&image[0], &header, sizeof(header));
+
+  if (!makeDirectories(path.substr(0, path.rfind('/')))) {
+    spdlog::error("Cannot create the directory of {}: {}", path, strerror(errno));
+    return false;
+  }
+  // Readers never see a partial file
+  auto temporary = path + "." + std::to_string(getpid());
+  auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    spdlog::error("Cannot create {}: {}", temporary, strerror(errno));
+    return false;
+  }
+  std::size_t done = 0;
+  while (done < image.size()) {
+    auto n = ::write(fd, image.data() + done, image.size() - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  close(fd);
+  if (done != image.size() || rename(temporary.c_str(), path.c_str()) == -1) {
+    spdlog::error("Cannot write {}: {}", path, strerror(errno));
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool IndexFile::open(const std::string &path, const std::string &buildId) {
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  auto mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<const uint8_t *>(mapping);
+  size = st.st_size;
+
+  const auto &header = *reinterpret_cast<const Header *>(data);
+  static const std::size_t recordSizes[tablesNumber] = {
+      sizeof(UnitRange), sizeof(Function), sizeof(Line), sizeof(Name), sizeof(Cie), sizeof(Fde), 1};
+  bool valid = std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) == 0 && header.version == indexVersion &&
+               header.buildIdSize == buildId.size() &&
+               std::memcmp(header.buildId, buildId.data(), buildId.size()) == 0;
+  for (unsigned id = 0; valid && id < tablesNumber; ++id) {
+    valid = header.offsets[id] % 8 == 0 && header.offsets[id] <= size &&
+            header.counts[id] <= (size - header.offsets[id]) / recordSizes[id];
+  }
+  // The strings are used as C strings
+  auto strings = getTable<char>(stringsTable);
+  valid = valid && (strings.size() == 0 || strings.last[-1] == '\0');
+  // The probing of `findFunctions` needs a power of two
+  auto slots = header.counts[namesTable];
+  valid = valid && slots != 0 && (slots & (slots - 1)) == 0;
+  if (!valid) {
+    spdlog::error("Ignoring the invalid index {}", path);
+    munmap(mapping, size);
+    data = nullptr;
+    size = 0;
+  }
+  return valid;
+}
+
+template <typename T>
+IndexFile::Table<T> IndexFile::getTable(TableId id) const {
+  if (data == nullptr) {
+    return Table<T>{};
+  }
+  const auto &header = *reinterpret_cast<const Header *>(data);
+  auto first = reinterpret_cast<const T *>(data + header.offsets[id]);
+  return Table<T>{first, first + header.counts[id]};
+}
+
+IndexFile::Table<IndexFile::UnitRange> IndexFile::getUnitRanges() const { return getTable<UnitRange>(unitRangesTable); }
+
+IndexFile::Table<IndexFile::Function> IndexFile::getFunctions() const { return getTable<Function>(functionsTable); }
+
+IndexFile::Table<IndexFile::Line> IndexFile::getLines() const { return getTable<Line>(linesTable); }
+
+IndexFile::Table<IndexFile::Cie> IndexFile::getCies() const { return getTable<Cie>(ciesTable); }
+
+IndexFile::Table<IndexFile::Fde> IndexFile::getFdes() const { return getTable<Fde>(fdesTable); }
+
+uint64_t IndexFile::getUnitCount() const { return data ? reinterpret_cast<const Header *>(data)->unitCount : 0; }
+
+const char *IndexFile::getString(uint32_t offset) const {
+  auto strings = getTable<char>(stringsTable);
+  return offset < strings.size() ? strings.first + offset : "";
+}
+
+std::vector<uint32_t> IndexFile::findFunctions(const std::string &name) const {
+  std::vector<uint32_t> functions;
+  auto names = getTable<Name>(namesTable);
+  if (names.size() == 0) {
+    return functions;
+  }
+  auto mask = names.size() - 1;
+  auto count = getFunctions().size();
+  auto slot = hashName(name.data(), name.size()) & mask;
+  // Bounded in case a damaged file has no empty slot
+  for (std::size_t probes = 0; probes < names.size() && names[slot].name != emptySlot; ++probes) {
+    if (name == getString(names[slot].name) && names[slot].function < count) {
+      functions.push_back(names[slot].function);
+    }
+    slot = (slot + 1) & mask;
+  }
+  return functions;
+}
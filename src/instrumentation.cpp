@@ -0,0 +1,275 @@
+#include "instrumentation.h"
+
+#include "spdlog/spdlog.h"
+#include "sys/user.h"
+#include "sys/wait.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <numeric>
+
+namespace {
+
+const char *const phaseNames[phasesNumber] = {"other", "tracee", "syscall", "dwarf", "source"};
+
+/**
+ * @brief The bytes a `ptrace` request moves between the debugger and the
+ * tracee
+ *
+ */
+std::size_t getPtraceBytes(long request) {
+  switch (request) {
+    case PTRACE_PEEKDATA:
+    case PTRACE_POKEDATA:
+    case PTRACE_PEEKUSER:
+    case PTRACE_POKEUSER:
+      return sizeof(long);
+    case PTRACE_GETREGS:
+    case PTRACE_SETREGS:
+      return sizeof(user_regs_struct);
+    case PTRACE_GETSIGINFO:
+      return sizeof(siginfo_t);
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+uint64_t CommandStats::getWallTime() const { return std::accumulate(time.begin(), time.end(), uint64_t{0}); }
+
+Instrumentation::Instrumentation() : origin{now()} {}
+
+Instrumentation::~Instrumentation() { closeLog(); }
+
+Instrumentation &Instrumentation::get() {
+  static Instrumentation instance;
+  return instance;
+}
+
+uint64_t Instrumentation::now() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+CommandStats &Instrumentation::current() {
+  if (!running.empty()) {
+    return *running.back();
+  }
+  static const std::string none = "(none)";
+  return commands[none];
+}
+
+void Instrumentation::charge(uint64_t now) {
+  if (!phases.empty()) {
+    current().time[static_cast<std::size_t>(phases.back())] += now - resumed;
+  }
+  resumed = now;
+}
+
+uint64_t Instrumentation::enter(Phase phase) {
+  auto start = now();
+  charge(start);
+  phases.push_back(phase);
+  return start;
+}
+
+void Instrumentation::leave(uint64_t start, const char *name) {
+  auto end = now();
+  charge(end);
+  auto phase = phases.back();
+  phases.pop_back();
+  if (log.is_open()) {
+    writeEvent(name, phaseNames[static_cast<std::size_t>(phase)], start, end);
+  }
+}
+
+void Instrumentation::beginCommand(const std::string &name) {
+  charge(now());
+  running.push_back(&commands[name]);
+  phases.push_back(Phase::other);
+}
+
+void Instrumentation::endCommand(const std::string &name, uint64_t start) {
+  auto end = now();
+  charge(end);
+  phases.pop_back();
+  ++running.back()->runs;
+  running.pop_back();
+  if (log.is_open()) {
+    writeEvent(name, "command", start, end);
+  }
+}
+
+void Instrumentation::countPtrace(long request) {
+  auto &stats = current();
+  ++stats.ptraceCalls;
+  stats.bytes += getPtraceBytes(request);
+  ++ptraceRequests[request];
+}
+
+void Instrumentation::countWait() { ++current().waitCalls; }
+
+void Instrumentation::countTransfer(std::size_t bytes) {
+  auto &stats = current();
+  ++stats.memoryCalls;
+  stats.bytes += bytes;
+}
+
+void Instrumentation::writeEvent(const std::string &name, const char *category, uint64_t start, uint64_t end) {
+  // Microseconds, relative to the creation of the instrumentation
+  log << (firstEvent ? "" : ",\n")
+      << fmt::format(R"({{"name":"{}","cat":"{}","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":{},"tid":0}})",
+                     escapeJson(name),
+                     category,
+                     (start - origin) / 1e3,
+                     (end - start) / 1e3,
+                     getpid());
+  firstEvent = false;
+}
+
+bool Instrumentation::openLog(const std::string &path) {
+  closeLog();
+  log.open(path, std::ios::trunc);
+  if (!log) {
+    spdlog::error("Cannot create {}", path);
+    return false;
+  }
+  log << "[\n";
+  firstEvent = true;
+  return true;
+}
+
+void Instrumentation::closeLog() {
+  if (log.is_open()) {
+    log << "\n]\n";
+    log.close();
+  }
+}
+
+void Instrumentation::reset() {
+  // Running commands keep pointing to their entries
+  for (auto &nameAndStats : commands) {
+    nameAndStats.second = CommandStats{};
+  }
+  ptraceRequests.clear();
+}
+
+void Instrumentation::dump() {
+  std::vector<std::pair<const std::string, CommandStats> *> sorted;
+  for (auto &nameAndStats : commands) {
+    if (nameAndStats.second.runs > 0 || nameAndStats.second.getWallTime() > 0) {
+      sorted.push_back(&nameAndStats);
+    }
+  }
+  std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+    return a->second.getWallTime() > b->second.getWallTime();
+  });
+
+  spdlog::info("{:<12} {:>6} {:>8} {:>8} {:>8} {:>12} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+               "Command",
+               "Runs",
+               "ptrace",
+               "waitpid",
+               "memory",
+               "Bytes",
+               "Wall ms",
+               "Tracee",
+               "Syscall",
+               "DWARF",
+               "Source",
+               "Other");
+  for (auto nameAndStats : sorted) {
+    const auto &stats = nameAndStats->second;
+    auto milliseconds = [&stats](Phase phase) { return stats.time[static_cast<std::size_t>(phase)] / 1e6; };
+    spdlog::info("{:<12} {:>6} {:>8} {:>8} {:>8} {:>12} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f}",
+                 nameAndStats->first,
+                 stats.runs,
+                 stats.ptraceCalls,
+                 stats.waitCalls,
+                 stats.memoryCalls,
+                 stats.bytes,
+                 stats.getWallTime() / 1e6,
+                 milliseconds(Phase::tracee),
+                 milliseconds(Phase::syscall),
+                 milliseconds(Phase::dwarf),
+                 milliseconds(Phase::source),
+                 milliseconds(Phase::other));
+  }
+
+  std::vector<std::pair<long, uint64_t>> requests{ptraceRequests.begin(), ptraceRequests.end()};
+  std::sort(requests.begin(), requests.end(), [](auto a, auto b) { return a.second > b.second; });
+  for (const auto &requestAndCount : requests) {
+    spdlog::info("{:<24} {:>10}", getPtraceRequestName(requestAndCount.first), requestAndCount.second);
+  }
+}
+
+std::string escapeJson(const std::string &text) {
+  std::string escaped;
+  for (auto c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", c);
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+const char *getPtraceRequestName(long request) {
+  switch (request) {
+    case PTRACE_TRACEME:
+      return "PTRACE_TRACEME";
+    case PTRACE_PEEKDATA:
+      return "PTRACE_PEEKDATA";
+    case PTRACE_PEEKUSER:
+      return "PTRACE_PEEKUSER";
+    case PTRACE_POKEDATA:
+      return "PTRACE_POKEDATA";
+    case PTRACE_POKEUSER:
+      return "PTRACE_POKEUSER";
+    case PTRACE_CONT:
+      return "PTRACE_CONT";
+    case PTRACE_KILL:
+      return "PTRACE_KILL";
+    case PTRACE_SINGLESTEP:
+      return "PTRACE_SINGLESTEP";
+    case PTRACE_GETREGS:
+      return "PTRACE_GETREGS";
+    case PTRACE_SETREGS:
+      return "PTRACE_SETREGS";
+    case PTRACE_ATTACH:
+      return "PTRACE_ATTACH";
+    case PTRACE_DETACH:
+      return "PTRACE_DETACH";
+    case PTRACE_SYSCALL:
+      return "PTRACE_SYSCALL";
+    case PTRACE_SETOPTIONS:
+      return "PTRACE_SETOPTIONS";
+    case PTRACE_GETEVENTMSG:
+      return "PTRACE_GETEVENTMSG";
+    case PTRACE_GETSIGINFO:
+      return "PTRACE_GETSIGINFO";
+    case PTRACE_SEIZE:
+      return "PTRACE_SEIZE";
+    case PTRACE_INTERRUPT:
+      return "PTRACE_INTERRUPT";
+    default:
+      return "PTRACE_OTHER";
+  }
+}
+
+pid_t tracedWaitpid(pid_t pid, int *status, int options) {
+  auto &instrumentation = Instrumentation::get();
+  auto start = instrumentation.enter(Phase::tracee);
+  auto result = waitpid(pid, status, options);
+  auto error = errno;
+  instrumentation.countWait();
+  instrumentation.leave(start, "waitpid");
+  errno = error;
+  return result;
+}
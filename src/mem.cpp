@@ -1,25 +1,77 @@
 #include "mem.h"
 
+#include "instrumentation.h"
 #include "spdlog/spdlog.h"
 #include "sys/ptrace.h"
+#include "sys/uio.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
 
-Memory::Memory(pid_t p) : pid(p) {}
+Memory::Memory(pid_t p) : pid(p), tid(p), memFd{-1} {}
 
-uint64_t Memory::getRegisterValue(Reg r) {
-  user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+Memory::~Memory() {
+  if (memFd != -1) {
+    close(memFd);
+  }
+}
+
+int Memory::openMemFile() {
+  if (memFd == -1) {
+    memFd = open(("/proc/" + std::to_string(pid) + "/mem").c_str(), O_RDWR);
+  }
+  return memFd;
+}
+
+uint64_t &Memory::registerSlot(Reg r) {
+  // Lazily fetch in case nobody has done it since the last stop
+  auto &cache = registers[tid];
+  if (!cache.valid) {
+    fetchRegisters();
+  }
   auto it = std::find_if(std::begin(Registers), std::end(Registers), [r](auto &&rd) { return rd.reg == r; });
-  return *(reinterpret_cast<uint64_t *>(&regs) + (it - std::begin(Registers)));
+  return *(reinterpret_cast<uint64_t *>(&cache.regs) + (it - std::begin(Registers)));
+}
+
+void Memory::selectThread(pid_t t) { tid = t; }
+
+void Memory::forgetThread(pid_t t) { registers.erase(t); }
+
+void Memory::fetchRegisters() {
+  auto &cache = registers[tid];
+  tracedPtrace(PTRACE_GETREGS, tid, nullptr, &cache.regs);
+  cache.valid = true;
+  cache.dirty = false;
+}
+
+void Memory::flushRegisters() {
+  for (auto &threadAndCache : registers) {
+    auto &cache = threadAndCache.second;
+    if (cache.valid && cache.dirty) {
+      tracedPtrace(PTRACE_SETREGS, threadAndCache.first, nullptr, &cache.regs);
+      cache.dirty = false;
+    }
+  }
+}
+
+void Memory::invalidateRegisters() {
+  flushRegisters();
+  for (auto &threadAndCache : registers) {
+    threadAndCache.second.valid = false;
+  }
 }
 
+uint64_t Memory::getRegisterValue(Reg r) { return registerSlot(r); }
+
 void Memory::setRegisterValue(Reg r, uint64_t value) {
-  user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
-  auto it = std::find_if(std::begin(Registers), std::end(Registers), [r](auto &&rd) { return rd.reg == r; });
-  *(reinterpret_cast<uint64_t *>(&regs) + (it - std::begin(Registers))) = value;
-  ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+  registerSlot(r) = value;
+  registers[tid].dirty = true;
 }
 
 uint64_t Memory::getRegisterValueFromDwarfRegister(unsigned regNum) {
@@ -48,9 +100,137 @@ void Memory::dumpRegisters() {
   }
 }
 
-uint64_t Memory::readMemory(uint64_t address) { return ptrace(PTRACE_PEEKDATA, pid, address, nullptr); }
+uint64_t Memory::readMemory(uint64_t address) { return tracedPtrace(PTRACE_PEEKDATA, tid, address, nullptr); }
+
+void Memory::writeMemory(uint64_t address, uint64_t value) { tracedPtrace(PTRACE_POKEDATA, tid, address, value); }
 
-void Memory::writeMemory(uint64_t address, uint64_t value) { ptrace(PTRACE_POKEDATA, pid, address, value); }
+std::size_t Memory::readBlock(uint64_t address, void *buffer, std::size_t length) {
+  iovec local{buffer, length};
+  iovec remote{reinterpret_cast<void *>(address), length};
+  auto n = tracedTransfer("process_vm_readv", [&] { return process_vm_readv(pid, &local, 1, &remote, 1, 0); });
+  if (n == static_cast<ssize_t>(length)) {
+    return length;
+  }
+
+  auto fd = openMemFile();
+  if (fd != -1) {
+    n = tracedTransfer("pread", [&] { return pread(fd, buffer, length, static_cast<off_t>(address)); });
+    if (n == static_cast<ssize_t>(length)) {
+      return length;
+    }
+  }
+
+  // The slow path: one `PTRACE_PEEKDATA` for every word
+  auto out = static_cast<uint8_t *>(buffer);
+  std::size_t done = 0;
+  while (done < length) {
+    errno = 0;
+    auto word = tracedPtrace(PTRACE_PEEKDATA, tid, address + done, nullptr);
+    if (errno != 0) {
+      break;
+    }
+    auto chunk = std::min(sizeof(word), length - done);
+    std::memcpy(out + done, &word, chunk);
+    done += chunk;
+  }
+  return done;
+}
+
+std::size_t Memory::writeBlock(uint64_t address, const void *buffer, std::size_t length) {
+  // `/proc/<pid>/mem` ignores the page protection like ptrace does, so
+  // it is tried first: breakpoints are written to the text segment
+  auto fd = openMemFile();
+  if (fd != -1) {
+    auto n = tracedTransfer("pwrite", [&] { return pwrite(fd, buffer, length, static_cast<off_t>(address)); });
+    if (n == static_cast<ssize_t>(length)) {
+      return length;
+    }
+  }
+
+  iovec local{const_cast<void *>(buffer), length};
+  iovec remote{reinterpret_cast<void *>(address), length};
+  auto n = tracedTransfer("process_vm_writev", [&] { return process_vm_writev(pid, &local, 1, &remote, 1, 0); });
+  if (n == static_cast<ssize_t>(length)) {
+    return length;
+  }
+
+  // The slow path: read-modify-write every word with ptrace
+  auto in = static_cast<const uint8_t *>(buffer);
+  std::size_t done = 0;
+  while (done < length) {
+    long word = 0;
+    auto chunk = std::min(sizeof(word), length - done);
+    if (chunk < sizeof(word)) {
+      errno = 0;
+      word = tracedPtrace(PTRACE_PEEKDATA, tid, address + done, nullptr);
+      if (errno != 0) {
+        break;
+      }
+    }
+    std::memcpy(&word, in + done, chunk);
+    if (tracedPtrace(PTRACE_POKEDATA, tid, address + done, word) == -1) {
+      break;
+    }
+    done += chunk;
+  }
+  return done;
+}
+
+void Memory::dumpMemory(uint64_t address, std::size_t length) {
+  // Read in chunks, the length is typed by the user and may be huge
+  constexpr std::size_t bytesPerLine = 16;
+  constexpr std::size_t chunkSize = 256 * bytesPerLine;
+  std::vector<uint8_t> data(std::min(length, chunkSize));
+  for (std::size_t done = 0; done < length;) {
+    auto size = std::min(length - done, chunkSize);
+    auto n = readBlock(address + done, data.data(), size);
+    for (std::size_t offset = 0; offset < n; offset += bytesPerLine) {
+      std::string hex;
+      std::string ascii;
+      for (std::size_t i = 0; i < bytesPerLine; ++i) {
+        if (offset + i < n) {
+          auto byte = data[offset + i];
+          hex += fmt::format("{:02x} ", byte);
+          ascii += std::isprint(byte) ? static_cast<char>(byte) : '.';
+        } else {
+          hex += "   ";
+        }
+      }
+      spdlog::info("0x{:016x}  {} {}", address + done + offset, hex, ascii);
+    }
+    done += n;
+    if (n < size) {
+      spdlog::error("Only {} of {} bytes are readable", done, length);
+      return;
+    }
+  }
+}
+
+std::vector<Mapping> Memory::getMappings() {
+  std::vector<Mapping> mappings;
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    // low-high perms offset dev inode path
+    std::istringstream ss{line};
+    Mapping mapping{};
+    std::string range;
+    std::string offset;
+    std::string device;
+    std::string inode;
+    ss >> range >> mapping.permissions >> offset >> device >> inode;
+    auto dash = range.find('-');
+    if (dash == std::string::npos) {
+      continue;
+    }
+    mapping.low = std::stoull(range.substr(0, dash), nullptr, 16);
+    mapping.high = std::stoull(range.substr(dash + 1), nullptr, 16);
+    mapping.offset = std::stoull(offset, nullptr, 16);
+    std::getline(ss >> std::ws, mapping.path);
+    mappings.push_back(mapping);
+  }
+  return mappings;
+}
 
 uint64_t Memory::getPC() { return getRegisterValue(Reg::rip); }
 
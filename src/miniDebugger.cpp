@@ -1,15 +1,248 @@
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <debugger.h>
+#include <getopt.h>
+#include <instrumentation.h>
 #include <iostream>
+#include <signal.h>
 #include <spdlog/spdlog.h>
+#include <sstream>
+#include <string>
 #include <sys/ptrace.h>
+#include <syscalls.h>
+#include <syscalltracer.h>
 #include <unistd.h>
+#include <vector>
+
+/**
+ * @brief `$XDG_CACHE_HOME/miniDebugger`, or `~/.cache/miniDebugger`
+ *
+ */
+static std::string defaultCacheDirectory() {
+  auto cache = getenv("XDG_CACHE_HOME");
+  if (cache && cache[0] == '/') {
+    return std::string{cache} + "/miniDebugger";
+  }
+  auto home = getenv("HOME");
+  return std::string{home ? home : "/tmp"} + "/.cache/miniDebugger";
+}
+
+/**
+ * @brief Parse a decimal count given to an option
+ *
+ * @return false if `text` is not a whole number up to `UINT_MAX`
+ */
+static bool parseCount(const char *text, unsigned &value) {
+  char *end = nullptr;
+  errno = 0;
+  auto number = std::strtoul(text, &end, 10);
+  if (errno != 0 || end == text || *end != '\0' || text[0] == '-' || number > UINT_MAX) {
+    return false;
+  }
+  value = static_cast<unsigned>(number);
+  return true;
+}
+
+/**
+ * @brief Parse a non negative number of seconds or a fraction
+ *
+ * @return false if `text` is not a finite number of at least 0
+ */
+static bool parseNumber(const char *text, double &value) {
+  char *end = nullptr;
+  errno = 0;
+  auto number = std::strtod(text, &end);
+  if (errno != 0 || end == text || *end != '\0' || !std::isfinite(number) || number < 0) {
+    return false;
+  }
+  value = number;
+  return true;
+}
+
+static void usage() {
+  spdlog::error("Usage: miniDebugger [-p <pid>] [-x <script>]... [--batch] [--non-stop] [--agent] "
+                "[--lazy-dwarf[=<units>]] [--index-cache[=<dir>]] [--index-threads <n>] [--trace-log <file>] "
+                "[--syscalls[=<name>,...]] [--profile <seconds>] [--frequency <hz>] [--max-depth <frames>] "
+                "[--max-overhead <fraction>] [--output <file>] <program>");
+}
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  bool profileMode = false;
+  bool nonStop = false;
+  bool agent = false;
+  bool syscallMode = false;
+  bool batchMode = false;
+  std::vector<std::string> scripts;
+  SyscallOptions syscallOptions;
+  pid_t attachPid = 0;
+  ProfileOptions profileOptions;
+  IndexOptions indexOptions;
+
+  static const option longOptions[] = {{"profile", required_argument, nullptr, 'P'},
+                                       {"frequency", required_argument, nullptr, 'F'},
+                                       {"max-depth", required_argument, nullptr, 'D'},
+                                       {"max-overhead", required_argument, nullptr, 'O'},
+                                       {"output", required_argument, nullptr, 'o'},
+                                       {"non-stop", no_argument, nullptr, 'N'},
+                                       {"agent", no_argument, nullptr, 'A'},
+                                       {"syscalls", optional_argument, nullptr, 'S'},
+                                       {"lazy-dwarf", optional_argument, nullptr, 'L'},
+                                       {"index-cache", optional_argument, nullptr, 'I'},
+                                       {"index-threads", required_argument, nullptr, 'T'},
+                                       {"trace-log", required_argument, nullptr, 'R'},
+                                       {"batch", no_argument, nullptr, 'B'},
+                                       {nullptr, 0, nullptr, 0}};
+  int opt;
+  // "+" stops at the program name
+  while ((opt = getopt_long(argc, argv, "+p:F:o:x:", longOptions, nullptr)) != -1) {
+    switch (opt) {
+      case 'p': {
+        char *end = nullptr;
+        errno = 0;
+        auto value = std::strtol(optarg, &end, 10);
+        if (errno != 0 || end == optarg || *end != '\0' || value <= 0 || value > INT_MAX) {
+          spdlog::error("Invalid pid {}", optarg);
+          return -1;
+        }
+        attachPid = static_cast<pid_t>(value);
+        break;
+      }
+      case 'x':
+        scripts.push_back(optarg);
+        break;
+      case 'B':
+        // The commands are read from stdin, without a prompt
+        batchMode = true;
+        break;
+      case 'P':
+        profileMode = true;
+        if (!parseNumber(optarg, profileOptions.duration)) {
+          spdlog::error("Invalid duration {}", optarg);
+          usage();
+          return -1;
+        }
+        break;
+      case 'F':
+        if (!parseCount(optarg, profileOptions.frequency) || profileOptions.frequency == 0) {
+          spdlog::error("Invalid frequency {}", optarg);
+          usage();
+          return -1;
+        }
+        break;
+      case 'D':
+        if (!parseCount(optarg, profileOptions.maxDepth) || profileOptions.maxDepth == 0) {
+          spdlog::error("Invalid maximum depth {}", optarg);
+          usage();
+          return -1;
+        }
+        break;
+      case 'O':
+        if (!parseNumber(optarg, profileOptions.maxOverhead) || profileOptions.maxOverhead > 1) {
+          spdlog::error("Invalid overhead fraction {}", optarg);
+          usage();
+          return -1;
+        }
+        break;
+      case 'o':
+        profileOptions.output = optarg;
+        break;
+      case 'N':
+        nonStop = true;
+        break;
+      case 'A':
+        agent = true;
+        break;
+      case 'S':
+        // --syscalls or --syscalls=read,write,...
+        syscallMode = true;
+        if (optarg) {
+          std::stringstream names{optarg};
+          std::string name;
+          while (std::getline(names, name, ',')) {
+            auto number = syscallNumber(name);
+            if (number == -1) {
+              spdlog::error("Unknown syscall {}", name);
+              return -1;
+            }
+            syscallOptions.numbers.push_back(number);
+          }
+        }
+        break;
+      case 'L':
+        // --lazy-dwarf or --lazy-dwarf=<indexed units kept>
+        indexOptions.lazy = true;
+        if (optarg) {
+          unsigned units;
+          if (!parseCount(optarg, units)) {
+            spdlog::error("Invalid number of units {}", optarg);
+            usage();
+            return -1;
+          }
+          indexOptions.maxIndexedUnits = units;
+        }
+        break;
+      case 'I':
+        // --index-cache or --index-cache=<dir>
+        indexOptions.cacheDirectory = optarg ? optarg : defaultCacheDirectory();
+        break;
+      case 'T':
+        // 0 for one thread per core
+        if (!parseCount(optarg, indexOptions.threads)) {
+          spdlog::error("Invalid number of threads {}", optarg);
+          usage();
+          return -1;
+        }
+        break;
+      case 'R':
+        // Before the index is built, so that it is logged too
+        if (!Instrumentation::get().openLog(optarg)) {
+          return -1;
+        }
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  if (attachPid > 0) {
+    // `PTRACE_SEIZE` does not stop the process, `PTRACE_INTERRUPT` does
+    if (ptrace(PTRACE_SEIZE, attachPid, nullptr, PTRACE_O_TRACECLONE | PTRACE_O_TRACESYSGOOD) == -1) {
+      spdlog::error("Cannot attach to process {}: {}", attachPid, strerror(errno));
+      return -1;
+    }
+    ptrace(PTRACE_INTERRUPT, attachPid, nullptr, nullptr);
+    spdlog::info("Attached to process {}", attachPid);
+    if (syscallMode) {
+      SyscallTracer tracer{attachPid, true};
+      tracer.run(syscallOptions);
+      return 0;
+    }
+    Debugger debugger{"/proc/" + std::to_string(attachPid) + "/exe", attachPid, true, indexOptions};
+    debugger.setNonStop(nonStop);
+    debugger.setAgent(agent);
+    for (const auto &script : scripts) {
+      debugger.addScript(script);
+    }
+    if (profileMode) {
+      debugger.runProfiler(profileOptions);
+    } else if (batchMode) {
+      debugger.runBatch(std::cin);
+    } else {
+      debugger.run();
+    }
+    return 0;
+  }
+
+  if (optind >= argc) {
     spdlog::error("Program name out specified");
+    usage();
     return -1;
   }
-  auto programName = argv[1];
+  auto programName = argv[optind];
 
   auto pid = fork();
 
@@ -18,11 +251,33 @@ int main(int argc, char *argv[]) {
     // allow its parent to trace it. And it would send a
     // signal to the process.
     ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    if (syscallMode) {
+      // Filtered syscalls fail with ENOSYS until the tracer has set
+      // `PTRACE_O_TRACESECCOMP`, let it do so first
+      raise(SIGSTOP);
+      installSyscallFilter(syscallOptions.numbers);
+    }
     execl(programName, programName, nullptr);
   } else if (pid > 0) {
     spdlog::info("Start debugging process {}", pid);
-    Debugger debugger{programName, pid};
-    debugger.run();
+    if (syscallMode) {
+      SyscallTracer tracer{pid, false};
+      tracer.run(syscallOptions);
+      return 0;
+    }
+    Debugger debugger{programName, pid, false, indexOptions};
+    debugger.setNonStop(nonStop);
+    debugger.setAgent(agent);
+    for (const auto &script : scripts) {
+      debugger.addScript(script);
+    }
+    if (profileMode) {
+      debugger.runProfiler(profileOptions);
+    } else if (batchMode) {
+      debugger.runBatch(std::cin);
+    } else {
+      debugger.run();
+    }
   } else {
     spdlog::error("Fork Error");
   }
@@ -0,0 +1,38 @@
+#include "profiler.h"
+
+#include <map>
+#include <unordered_map>
+
+void Profiler::addSample(const std::vector<uint64_t> &stack) {
+  pcs.insert(pcs.end(), stack.begin(), stack.end());
+  stackEnds.push_back(pcs.size());
+}
+
+std::size_t Profiler::writeFolded(std::ostream &out, const std::function<std::string(uint64_t)> &symbolize) const {
+  std::unordered_map<uint64_t, std::string> names;
+  for (auto pc : pcs) {
+    if (!names.count(pc)) {
+      names[pc] = symbolize(pc);
+    }
+  }
+
+  // Sorted, so that the output is stable
+  std::map<std::string, std::size_t> folded;
+  std::size_t begin = 0;
+  for (auto end : stackEnds) {
+    std::string line;
+    for (auto i = end; i-- > begin;) {
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += names[pcs[i]];
+    }
+    ++folded[line];
+    begin = end;
+  }
+
+  for (const auto &stackAndCount : folded) {
+    out << stackAndCount.first << ' ' << stackAndCount.second << '\n';
+  }
+  return folded.size();
+}
@@ -0,0 +1,62 @@
+#include "sourcecache.h"
+
+#include "sys/stat.h"
+
+#include <fstream>
+#include <sstream>
+
+const SourceCache::File &SourceCache::load(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    st = {};
+  }
+  auto it = files.find(path);
+  if (it != files.end() && it->second.size == static_cast<std::size_t>(st.st_size) &&
+      it->second.modified.tv_sec == st.st_mtim.tv_sec && it->second.modified.tv_nsec == st.st_mtim.tv_nsec) {
+    return it->second;
+  }
+
+  // Copied rather than mapped, a file truncated meanwhile would fault
+  auto &file = files[path];
+  file = File{};
+  file.size = st.st_size;
+  file.modified = st.st_mtim;
+  std::ifstream input{path, std::ios::binary};
+  if (!input) {
+    return file;
+  }
+  std::ostringstream contents;
+  contents << input.rdbuf();
+  file.text = contents.str();
+
+  if (!file.text.empty()) {
+    file.starts.push_back(0);
+    for (auto p = file.text.find('\n'); p != std::string::npos; p = file.text.find('\n', p + 1)) {
+      // A newline ending the file does not start another line
+      if (p + 1 == file.text.size()) {
+        break;
+      }
+      file.starts.push_back(p + 1);
+    }
+  }
+  return file;
+}
+
+unsigned SourceCache::getLineCount(const std::string &path) { return load(path).starts.size(); }
+
+bool SourceCache::getLine(const std::string &path, unsigned line, const char *&text, std::size_t &length) {
+  const auto &file = load(path);
+  if (line == 0 || line > file.starts.size()) {
+    return false;
+  }
+  auto start = file.starts[line - 1];
+  auto end = line < file.starts.size() ? file.starts[line] : file.text.size();
+  if (end > start && file.text[end - 1] == '\n') {
+    --end;
+  }
+  text = file.text.data() + start;
+  length = end - start;
+  return true;
+}
+
+void SourceCache::clear() { files.clear(); }
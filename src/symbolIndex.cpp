@@ -0,0 +1,741 @@
+#include "symbolindex.h"
+
+#include "instrumentation.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <exception>
+#include <memory>
+#include <thread>
+
+template <typename T>
+static void sortByLow(std::vector<T> &ranges) {
+  std::sort(ranges.begin(), ranges.end(), [](const T &a, const T &b) { return a.low < b.low; });
+}
+
+/**
+ * @brief Run `work(index)` for every index in [0, count) on `threads`
+ * threads, each taking the next index when it is done with one
+ *
+ * @details Compilation units vary a lot in size, handing them out one at
+ * a time balances the threads. The first exception is rethrown once all
+ * the threads are joined.
+ *
+ */
+template <typename Work>
+static void parallelFor(std::size_t count, unsigned threads, Work work) {
+  std::atomic<std::size_t> next{0};
+  std::exception_ptr error;
+  std::atomic_flag errorSet = ATOMIC_FLAG_INIT;
+  auto run = [&]() {
+    for (auto index = next++; index < count; index = next++) {
+      try {
+        work(index);
+      } catch (...) {
+        if (!errorSet.test_and_set()) {
+          error = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    pool.emplace_back(run);
+  }
+  run();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Demangle an Itanium C++ name, empty if `name` is not mangled
+ *
+ */
+static std::string demangle(const std::string &name) {
+  if (name.compare(0, 2, "_Z") != 0) {
+    return "";
+  }
+  int status = 0;
+  std::unique_ptr<char, decltype(&std::free)> demangled{
+      abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status), &std::free};
+  return status == 0 ? std::string{demangled.get()} : "";
+}
+
+/**
+ * @brief Strip the return type of a template instance, which the
+ * demangler prints, so that `void foo<int>` can be looked up as `foo<int>`
+ *
+ */
+static std::string stripReturnType(const std::string &name) {
+  if (name.empty() || name.back() != '>') {
+    return name;
+  }
+  int depth = 0;
+  for (auto i = name.size(); i-- > 0;) {
+    if (name[i] == ')' || name[i] == '>') {
+      ++depth;
+    } else if (name[i] == '(' || name[i] == '<') {
+      // `operator<` opens nothing
+      depth = std::max(depth - 1, 0);
+    } else if (name[i] == ' ' && depth == 0) {
+      // The spaces of `operator new` or `A::operator int` are part of the name
+      auto word = name.find_last_of(" :", i - 1);
+      word = word == std::string::npos ? 0 : word + 1;
+      if (name.compare(word, 8, "operator") != 0) {
+        return name.substr(i + 1);
+      }
+    }
+  }
+  return name;
+}
+
+/**
+ * @brief Strip the parameter list so that `ns::foo(int) const` can be
+ * looked up as `ns::foo`, and the return type of a template instance
+ *
+ */
+static std::string stripParameters(std::string name) {
+  const std::string constSuffix = " const";
+  if (name.size() > constSuffix.size() &&
+      name.compare(name.size() - constSuffix.size(), constSuffix.size(), constSuffix) == 0) {
+    name.resize(name.size() - constSuffix.size());
+  }
+  if (name.empty() || name.back() != ')') {
+    return name;
+  }
+  int depth = 0;
+  for (auto i = name.size(); i-- > 0;) {
+    if (name[i] == ')') {
+      ++depth;
+    } else if (name[i] == '(' && --depth == 0) {
+      return stripReturnType(name.substr(0, i));
+    }
+  }
+  return name;
+}
+
+/**
+ * @brief The names a subprogram is looked up by: plain, mangled,
+ * demangled and demangled without parameters, the first one is the
+ * plain name if there is one
+ *
+ */
+static std::vector<std::string> getFunctionNames(const dwarf::die &die) {
+  std::vector<std::string> names;
+  auto addName = [&names](const std::string &name) {
+    if (!name.empty() && std::find(names.begin(), names.end(), name) == names.end()) {
+      names.push_back(name);
+    }
+  };
+
+  // Out-of-line member definitions keep their names on the declaration
+  auto named = die;
+  if (!named.has(dwarf::DW_AT::name) && named.has(dwarf::DW_AT::specification)) {
+    named = named[dwarf::DW_AT::specification].as_reference();
+  }
+  if (named.has(dwarf::DW_AT::name)) {
+    addName(at_name(named));
+  }
+  for (auto attribute : {dwarf::DW_AT::linkage_name, dwarf::DW_AT::MIPS_linkage_name}) {
+    if (named.has(attribute)) {
+      auto mangled = named[attribute].as_string();
+      auto demangled = demangle(mangled);
+      addName(mangled);
+      addName(demangled);
+      addName(stripParameters(demangled));
+    }
+  }
+  return names;
+}
+
+SymbolIndex::SymbolIndex(const dwarf::dwarf &dw,
+                         const elf::elf &ef,
+                         const IndexOptions &indexOptions,
+                         const IndexFile *index)
+  : options{indexOptions}
+  , pDwarf{&dw}
+  , pElf{&ef} {
+  Instrumentation::Scope scope{Phase::dwarf, "SymbolIndex"};
+  units.resize(dw.compilation_units().size());
+
+  if (index && index->getUnitCount() != units.size()) {
+    spdlog::error("The index has {} compilation units instead of {}, ignoring it", index->getUnitCount(), units.size());
+  } else if (index) {
+    indexFile = index;
+    for (const auto &range : index->getUnitRanges()) {
+      if (range.unit < units.size()) {
+        unitRanges.push_back(UnitRange{range.low, range.high, range.unit});
+      }
+    }
+    spdlog::info("Loaded {} compilation unit ranges and {} functions from the index",
+                 unitRanges.size(),
+                 index->getFunctions().size());
+    return;
+  }
+
+  if (!options.lazy) {
+    auto start = std::chrono::steady_clock::now();
+    auto threads = getThreadCount();
+    loadSections();
+    // Each unit is indexed by one thread into its own slot
+    parallelFor(units.size(), threads, [this](std::size_t index) { indexUnit(index, units[index]); });
+    for (std::size_t index = 0; index < units.size(); ++index) {
+      units[index].parsed = true;
+      addUnitRanges(index);
+    }
+    parsedUnits = units.size();
+    sortByLow(unitRanges);
+    spdlog::info("Indexed {} compilation units in {:.3f}s with {} threads", units.size(), secondsSince(start), threads);
+    return;
+  }
+
+  auto covered = readAddressRanges();
+  std::size_t rootsRead = 0;
+  for (std::size_t index = 0; index < units.size(); ++index) {
+    if (!covered[index]) {
+      addUnitRanges(index);
+      ++rootsRead;
+    }
+  }
+  sortByLow(unitRanges);
+  spdlog::info("Found {} compilation units, {} without address ranges", units.size(), rootsRead);
+}
+
+unsigned SymbolIndex::getThreadCount() const {
+  auto threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+  return std::max(1u, std::min<unsigned>(threads, units.size()));
+}
+
+void SymbolIndex::loadSections() const {
+  // libelfin loads a section on its first use, which must not happen in
+  // two threads at once
+  for (auto type : {dwarf::section_type::str, dwarf::section_type::line, dwarf::section_type::ranges}) {
+    try {
+      pDwarf->get_section(type);
+    } catch (const std::exception &) {
+      // Not in this file
+    }
+  }
+  // So are the abbreviations of a unit, read by its root DIE, and a
+  // `DW_FORM_ref_addr` reference reads another unit than the one indexed
+  for (const auto &unit : pDwarf->compilation_units()) {
+    unit.root();
+  }
+}
+
+std::vector<bool> SymbolIndex::readAddressRanges() {
+  const auto &compilationUnits = pDwarf->compilation_units();
+  std::vector<bool> covered(compilationUnits.size());
+  const auto &section = pElf->get_section(".debug_aranges");
+  if (!section.valid()) {
+    return covered;
+  }
+
+  auto data = static_cast<const uint8_t *>(section.data());
+  auto size = section.size();
+  auto read = [data](std::size_t offset, std::size_t length) {
+    uint64_t value = 0;
+    std::memcpy(&value, data + offset, length);
+    return value;
+  };
+
+  // Each set: unit_length, version, debug_info_offset, address_size,
+  // segment_size, then (address, length) pairs aligned to twice the
+  // address size and ended by (0, 0)
+  std::size_t offset = 0;
+  while (offset + 4 <= size) {
+    auto setStart = offset;
+    std::size_t offsetSize = 4;
+    uint64_t length = read(offset, 4);
+    offset += 4;
+    if (length == 0xffffffff) {
+      offsetSize = 8;
+      length = read(offset, 8);
+      offset += 8;
+    }
+    auto setEnd = offset + length;
+    if (setEnd > size || offset + 2 + offsetSize + 2 > setEnd) {
+      break;
+    }
+    auto unitOffset = read(offset + 2, offsetSize);
+    auto addressSize = data[offset + 2 + offsetSize];
+    offset += 2 + offsetSize + 2;
+    if (addressSize != 8) {
+      offset = setEnd;
+      continue;
+    }
+
+    auto byOffset = [](const dwarf::compilation_unit &cu, uint64_t o) { return cu.get_section_offset() < o; };
+    auto unit = std::lower_bound(compilationUnits.begin(), compilationUnits.end(), unitOffset, byOffset);
+    if (unit == compilationUnits.end() || unit->get_section_offset() != unitOffset) {
+      offset = setEnd;
+      continue;
+    }
+    auto index = static_cast<std::size_t>(unit - compilationUnits.begin());
+
+    offset = setStart + (offset - setStart + 15) / 16 * 16;
+    for (; offset + 16 <= setEnd; offset += 16) {
+      auto low = read(offset, 8);
+      auto rangeLength = read(offset + 8, 8);
+      if (low == 0 && rangeLength == 0) {
+        break;
+      }
+      // Discarded functions keep their ranges at address 0
+      if (low != 0 && rangeLength != 0) {
+        unitRanges.push_back(UnitRange{low, low + rangeLength, index});
+        covered[index] = true;
+      }
+    }
+    offset = setEnd;
+  }
+  return covered;
+}
+
+void SymbolIndex::addUnitRanges(std::size_t index) {
+  try {
+    for (const auto &range : dwarf::die_pc_range(pDwarf->compilation_units()[index].root())) {
+      unitRanges.push_back(UnitRange{range.low, range.high, index});
+    }
+  } catch (const std::exception &) {
+    // A unit without code is never looked up by PC
+  }
+}
+
+void SymbolIndex::parseUnit(std::size_t index) {
+  if (options.lazy && parsedUnits >= std::max<std::size_t>(options.maxIndexedUnits, 1)) {
+    auto oldest = std::min_element(units.begin(), units.end(), [](const UnitIndex &a, const UnitIndex &b) {
+      // Units which are not parsed sort last
+      return a.parsed && (!b.parsed || a.lastUse < b.lastUse);
+    });
+    *oldest = UnitIndex{};
+    --parsedUnits;
+  }
+
+  indexUnit(index, units[index]);
+  units[index].parsed = true;
+  ++parsedUnits;
+}
+
+void SymbolIndex::indexUnit(std::size_t index, UnitIndex &unit) const {
+  const auto &compilationUnit = pDwarf->compilation_units()[index];
+
+  for (const auto &die : compilationUnit.root()) {
+    if (die.tag != dwarf::DW_TAG::subprogram) {
+      continue;
+    }
+    // Declarations and inlined-only functions have no code
+    try {
+      for (const auto &range : dwarf::die_pc_range(die)) {
+        unit.functions.push_back(FunctionRange{range.low, range.high, die});
+      }
+    } catch (const std::exception &) {
+      continue;
+    }
+  }
+
+  // Every row covers the addresses up to the next row, the row
+  // ending a sequence covers nothing. This mirrors `find_address`.
+  const auto &lt = compilationUnit.get_line_table();
+  auto prev = lt.begin();
+  if (prev != lt.end()) {
+    auto it = prev;
+    for (++it; it != lt.end(); prev = it++) {
+      if (!prev->end_sequence && it->address > prev->address) {
+        unit.lines.push_back(LineRange{prev->address, it->address, prev});
+      }
+    }
+  }
+
+  sortByLow(unit.functions);
+  sortByLow(unit.lines);
+}
+
+const SymbolIndex::UnitIndex &SymbolIndex::useUnit(std::size_t index) {
+  auto &unit = units[index];
+  if (!unit.parsed) {
+    parseUnit(index);
+  }
+  unit.lastUse = ++useClock;
+  return unit;
+}
+
+void SymbolIndex::exportIndex(IndexFile::Contents &contents) {
+  contents.unitCount = units.size();
+  for (const auto &range : unitRanges) {
+    contents.unitRanges.push_back(IndexFile::UnitRange{range.low, range.high, range.unit});
+  }
+
+  // The units and the names of their functions are collected in parallel,
+  // then merged in the order of the units so that the file is the same
+  // whatever the number of threads
+  struct UnitExport {
+    UnitIndex scratch;                           /**< the unit, if it is not kept indexed */
+    std::vector<std::vector<std::string>> names; /**< names of every function range */
+  };
+  auto start = std::chrono::steady_clock::now();
+  auto threads = getThreadCount();
+  std::vector<UnitExport> exports(units.size());
+  loadSections();
+  parallelFor(units.size(), threads, [this, &exports](std::size_t index) {
+    auto &unitExport = exports[index];
+    if (!units[index].parsed) {
+      indexUnit(index, unitExport.scratch);
+    }
+    const auto &unit = units[index].parsed ? units[index] : unitExport.scratch;
+    for (const auto &function : unit.functions) {
+      unitExport.names.push_back(getFunctionNames(function.die));
+    }
+  });
+
+  for (std::size_t index = 0; index < units.size(); ++index) {
+    const auto &unit = units[index].parsed ? units[index] : exports[index].scratch;
+    const auto &names = exports[index].names;
+
+    std::unordered_map<uint64_t, uint32_t> functionByDie; /**< first range of every subprogram */
+    for (std::size_t i = 0; i < unit.functions.size(); ++i) {
+      const auto &function = unit.functions[i];
+      auto dieOffset = function.die.get_section_offset();
+      auto name = contents.addString(names[i].empty() ? "" : names[i].front());
+      auto functionIndex = static_cast<uint32_t>(contents.functions.size());
+      contents.functions.push_back(IndexFile::Function{
+          function.low, function.high, dieOffset, static_cast<uint32_t>(index), name});
+      // Like `buildFunctionNames`, only the functions with a low pc are found by name
+      if (functionByDie.emplace(dieOffset, functionIndex).second && function.die.has(dwarf::DW_AT::low_pc)) {
+        for (const auto &alias : names[i]) {
+          contents.names.emplace_back(contents.addString(alias), functionIndex);
+        }
+      }
+    }
+    for (const auto &line : unit.lines) {
+      contents.lines.push_back(
+          IndexFile::Line{line.low, line.high, contents.addString(line.entry->file->path), line.entry->line});
+    }
+    exports[index] = UnitExport{};
+  }
+
+  // Names refer to the functions by index, sort them in place of the records
+  std::vector<uint32_t> order(contents.functions.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&contents](uint32_t a, uint32_t b) {
+    return contents.functions[a].low < contents.functions[b].low;
+  });
+  std::vector<IndexFile::Function> functions(order.size());
+  std::vector<uint32_t> position(order.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    functions[i] = contents.functions[order[i]];
+    position[order[i]] = i;
+  }
+  contents.functions = std::move(functions);
+  for (auto &name : contents.names) {
+    name.second = position[name.second];
+  }
+  sortByLow(contents.lines);
+  sortByLow(contents.unitRanges);
+  spdlog::info("Prepared the index of {} functions in {:.3f}s with {} threads",
+               contents.functions.size(),
+               secondsSince(start),
+               threads);
+}
+
+template <typename T>
+const T *SymbolIndex::findRange(const T *begin, const T *end, uint64_t pc) {
+  // The first range starting after `pc`, the candidate is the one before it
+  auto it = std::upper_bound(begin, end, pc, [](uint64_t p, const T &r) { return p < r.low; });
+  if (it == begin) {
+    return nullptr;
+  }
+  --it;
+  return pc < it->high ? it : nullptr;
+}
+
+template <typename T, typename SameLine>
+void SymbolIndex::extendLineRange(
+    const T *begin, const T *end, const T *range, SameLine sameLine, uint64_t &low, uint64_t &high) {
+  auto first = range;
+  auto last = range;
+  while (first != begin && (first - 1)->high == first->low && sameLine(*(first - 1))) {
+    --first;
+  }
+  while (last + 1 != end && (last + 1)->low == last->high && sameLine(*(last + 1))) {
+    ++last;
+  }
+  low = first->low;
+  high = last->high;
+}
+
+const SymbolIndex::UnitIndex *SymbolIndex::findUnit(uint64_t pc) {
+  auto range = findRange(unitRanges, pc);
+  return range ? &useUnit(range->unit) : nullptr;
+}
+
+const dwarf::die *SymbolIndex::findFunction(uint64_t pc) {
+  Instrumentation::Scope scope{Phase::dwarf, "findFunction"};
+  auto unit = findUnit(pc);
+  if (unit == nullptr) {
+    return nullptr;
+  }
+  auto range = findRange(unit->functions, pc);
+  return range ? &range->die : nullptr;
+}
+
+const dwarf::line_table::iterator *SymbolIndex::findLineEntry(uint64_t pc) {
+  Instrumentation::Scope scope{Phase::dwarf, "findLineEntry"};
+  auto unit = findUnit(pc);
+  if (unit == nullptr) {
+    return nullptr;
+  }
+  auto range = findRange(unit->lines, pc);
+  return range ? &range->entry : nullptr;
+}
+
+bool SymbolIndex::findLineRange(uint64_t pc, uint64_t &low, uint64_t &high) {
+  Instrumentation::Scope scope{Phase::dwarf, "findLineRange"};
+  if (indexFile) {
+    auto lines = indexFile->getLines();
+    auto range = findRange(lines.begin(), lines.end(), pc);
+    if (range == nullptr) {
+      return false;
+    }
+    auto sameLine = [range](const IndexFile::Line &other) {
+      return other.line == range->line && other.file == range->file;
+    };
+    extendLineRange(lines.begin(), lines.end(), range, sameLine, low, high);
+    return true;
+  }
+
+  auto unit = findUnit(pc);
+  if (unit == nullptr) {
+    return false;
+  }
+  auto range = findRange(unit->lines, pc);
+  if (range == nullptr) {
+    return false;
+  }
+
+  auto sameLine = [range](const LineRange &other) {
+    return other.entry->line == range->entry->line && other.entry->file == range->entry->file;
+  };
+  auto begin = unit->lines.data();
+  extendLineRange(begin, begin + unit->lines.size(), range, sameLine, low, high);
+  return true;
+}
+
+std::string SymbolIndex::findFunctionName(uint64_t pc) {
+  Instrumentation::Scope scope{Phase::dwarf, "findFunctionName"};
+  if (indexFile) {
+    auto functions = indexFile->getFunctions();
+    auto function = findRange(functions.begin(), functions.end(), pc);
+    return function ? indexFile->getString(function->name) : "";
+  }
+  auto die = findFunction(pc);
+  if (!die) {
+    return "";
+  }
+  // Follows `DW_AT_specification` for out-of-line member definitions
+  auto names = getFunctionNames(*die);
+  return names.empty() ? "" : names.front();
+}
+
+bool SymbolIndex::findSourceLine(uint64_t pc, std::string &file, unsigned &line) {
+  Instrumentation::Scope scope{Phase::dwarf, "findSourceLine"};
+  if (indexFile) {
+    auto lines = indexFile->getLines();
+    auto range = findRange(lines.begin(), lines.end(), pc);
+    if (range == nullptr) {
+      return false;
+    }
+    file = indexFile->getString(range->file);
+    line = range->line;
+    return true;
+  }
+  auto entry = findLineEntry(pc);
+  if (entry == nullptr) {
+    return false;
+  }
+  file = (*entry)->file->path;
+  line = (*entry)->line;
+  return true;
+}
+
+void SymbolIndex::buildFunctionNames() {
+  functionNamesBuilt = true;
+
+  auto addFunction = [this](const std::string &key, const dwarf::die &die) {
+    auto &dies = functionsByName[key];
+    if (std::find(dies.begin(), dies.end(), die) == dies.end()) {
+      dies.push_back(die);
+    }
+  };
+
+  // Each thread fills the lists of the units it takes, which are merged
+  // in the order of the units
+  auto start = std::chrono::steady_clock::now();
+  auto threads = getThreadCount();
+  const auto &compilationUnits = pDwarf->compilation_units();
+  std::vector<std::vector<std::pair<std::string, dwarf::die>>> unitNames(compilationUnits.size());
+  loadSections();
+  parallelFor(compilationUnits.size(), threads, [&compilationUnits, &unitNames](std::size_t index) {
+    for (const auto &die : compilationUnits[index].root()) {
+      if (die.tag != dwarf::DW_TAG::subprogram || !die.has(dwarf::DW_AT::low_pc)) {
+        continue;
+      }
+      for (auto &name : getFunctionNames(die)) {
+        unitNames[index].emplace_back(std::move(name), die);
+      }
+    }
+  });
+
+  for (auto &names : unitNames) {
+    for (const auto &nameAndDie : names) {
+      addFunction(nameAndDie.first, nameAndDie.second);
+    }
+    names.clear();
+  }
+
+  spdlog::info("Indexed {} function names in {:.3f}s with {} threads",
+               functionsByName.size(),
+               secondsSince(start),
+               threads);
+}
+
+void SymbolIndex::buildSymbolNames() {
+  symbolNamesBuilt = true;
+
+  for (auto &section : pElf->sections()) {
+    if (section.get_hdr().type != elf::sht::symtab && section.get_hdr().type != elf::sht::dynsym) {
+      continue;
+    }
+
+    for (auto sym : section.as_symtab()) {
+      auto name = sym.get_name();
+      if (name.empty()) {
+        continue;
+      }
+      auto &data = sym.get_data();
+      Sym entry{elfToSymType11(data.type()), name, data.value};
+      symbolsByName[name].push_back(entry);
+      auto demangled = demangle(name);
+      if (!demangled.empty()) {
+        symbolsByName[demangled].push_back(entry);
+        auto stripped = stripParameters(demangled);
+        if (stripped != demangled) {
+          symbolsByName[stripped].push_back(entry);
+        }
+      }
+    }
+  }
+
+  spdlog::info("Indexed {} symbol names", symbolsByName.size());
+}
+
+void SymbolIndex::buildSymbolRanges() {
+  symbolRangesBuilt = true;
+
+  for (auto &section : pElf->sections()) {
+    if (section.get_hdr().type != elf::sht::symtab && section.get_hdr().type != elf::sht::dynsym) {
+      continue;
+    }
+    for (auto sym : section.as_symtab()) {
+      auto &data = sym.get_data();
+      if (data.type() != elf::stt::func || data.value == 0) {
+        continue;
+      }
+      auto name = sym.get_name();
+      auto demangled = demangle(name);
+      symbolRanges.push_back(SymbolRange{data.value, data.value + data.size, demangled.empty() ? name : demangled});
+    }
+  }
+
+  // Aliases share their address, the first one is kept
+  std::stable_sort(
+      symbolRanges.begin(), symbolRanges.end(), [](const auto &a, const auto &b) { return a.low < b.low; });
+  symbolRanges.erase(std::unique(symbolRanges.begin(),
+                                 symbolRanges.end(),
+                                 [](const auto &a, const auto &b) { return a.low == b.low; }),
+                     symbolRanges.end());
+  // Symbols of hand written code often have no size, they extend to the next one
+  for (std::size_t i = 0; i < symbolRanges.size(); ++i) {
+    if (symbolRanges[i].high == symbolRanges[i].low) {
+      symbolRanges[i].high = i + 1 < symbolRanges.size() ? symbolRanges[i + 1].low : symbolRanges[i].low + 1;
+    }
+  }
+}
+
+std::string SymbolIndex::findSymbolName(uint64_t pc) {
+  if (!symbolRangesBuilt) {
+    buildSymbolRanges();
+  }
+  auto range = findRange(symbolRanges, pc);
+  return range ? range->name : "";
+}
+
+const std::vector<dwarf::die> &SymbolIndex::findFunctions(const std::string &name) {
+  Instrumentation::Scope scope{Phase::dwarf, "findFunctions"};
+  static const std::vector<dwarf::die> none;
+  if (indexFile) {
+    // Only the units of the functions found in the name table are indexed
+    resolvedFunctions.clear();
+    for (auto index : indexFile->findFunctions(name)) {
+      const auto &function = indexFile->getFunctions()[index];
+      if (function.unit >= units.size()) {
+        continue;
+      }
+      const auto &unit = useUnit(function.unit);
+      for (const auto &range : unit.functions) {
+        if (range.die.get_section_offset() == function.dieOffset &&
+            std::find(resolvedFunctions.begin(), resolvedFunctions.end(), range.die) == resolvedFunctions.end()) {
+          resolvedFunctions.push_back(range.die);
+        }
+      }
+    }
+    return resolvedFunctions;
+  }
+  if (options.lazy && !functionNamesBuilt) {
+    // The symbol gives the address, only the unit containing it is indexed
+    resolvedFunctions.clear();
+    for (const auto &sym : findSymbols(name)) {
+      if (sym.type != symType::func || sym.address == 0) {
+        continue;
+      }
+      auto die = findFunction(sym.address);
+      if (die && std::find(resolvedFunctions.begin(), resolvedFunctions.end(), *die) == resolvedFunctions.end()) {
+        resolvedFunctions.push_back(*die);
+      }
+    }
+    if (!resolvedFunctions.empty()) {
+      return resolvedFunctions;
+    }
+  }
+  if (!functionNamesBuilt) {
+    buildFunctionNames();
+  }
+  auto it = functionsByName.find(name);
+  return it == functionsByName.end() ? none : it->second;
+}
+
+const std::vector<Sym> &SymbolIndex::findSymbols(const std::string &name) {
+  Instrumentation::Scope scope{Phase::dwarf, "findSymbols"};
+  static const std::vector<Sym> none;
+  if (!symbolNamesBuilt) {
+    buildSymbolNames();
+  }
+  auto it = symbolsByName.find(name);
+  return it == symbolsByName.end() ? none : it->second;
+}
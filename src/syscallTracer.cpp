@@ -0,0 +1,180 @@
+#include "syscalltracer.h"
+
+#include "reg.h"
+#include "spdlog/spdlog.h"
+#include "sys/ptrace.h"
+#include "sys/wait.h"
+#include "syscalls.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <unordered_set>
+
+SyscallTracer::SyscallTracer(pid_t p, bool s) : pid{p}, seized{s}, memory(p) {}
+
+bool SyscallTracer::isWanted(long number) const {
+  return numbers.empty() || std::binary_search(numbers.begin(), numbers.end(), number);
+}
+
+void SyscallTracer::resume(pid_t tid, int signal) {
+  memory.invalidateRegisters();
+  // With the filter, the next syscall of interest stops the thread by
+  // itself, only the exit of the current one must be asked for
+  bool stopAtSyscall = !filtered || calls.count(tid);
+  ptrace(stopAtSyscall ? PTRACE_SYSCALL : PTRACE_CONT, tid, nullptr, static_cast<long>(signal));
+}
+
+void SyscallTracer::enter(pid_t tid) {
+  auto number = static_cast<long>(memory.getRegisterValue(Reg::orig_rax));
+  Call call{number, isWanted(number), "", Clock::now()};
+  if (call.wanted) {
+    call.text = formatSyscallEntry(memory);
+  }
+  calls[tid] = call;
+}
+
+void SyscallTracer::leave(pid_t tid) {
+  auto call = calls[tid];
+  calls.erase(tid);
+  if (!call.wanted) {
+    return;
+  }
+
+  auto seconds = std::chrono::duration<double>(Clock::now() - call.start).count();
+  auto value = static_cast<int64_t>(memory.getRegisterValue(Reg::rax));
+  spdlog::info("[{}] {} = {} <{:.6f}>", tid, call.text, formatSyscallReturn(value), seconds);
+
+  auto &total = totals[call.number];
+  ++total.calls;
+  total.errors += value < 0 && value >= -4095;
+  total.seconds += seconds;
+}
+
+void SyscallTracer::printSummary() {
+  std::vector<std::pair<long, Totals>> sorted(totals.begin(), totals.end());
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<long, Totals> &a, const std::pair<long, Totals> &b) {
+    return a.second.seconds > b.second.seconds;
+  });
+  double seconds = 0;
+  uint64_t count = 0;
+  for (const auto &numberAndTotals : sorted) {
+    seconds += numberAndTotals.second.seconds;
+    count += numberAndTotals.second.calls;
+  }
+
+  // The times include the stops of the tracer, compare them to each other
+  spdlog::info("{:>7} {:>11} {:>9} {:>9}  {}", "% time", "seconds", "calls", "errors", "syscall");
+  for (const auto &numberAndTotals : sorted) {
+    const auto &total = numberAndTotals.second;
+    spdlog::info("{:>7.2f} {:>11.6f} {:>9} {:>9}  {}",
+                 seconds > 0 ? 100 * total.seconds / seconds : 0.0,
+                 total.seconds,
+                 total.calls,
+                 total.errors,
+                 syscallName(numberAndTotals.first));
+  }
+  spdlog::info("{:>7.2f} {:>11.6f} {:>9} {:>9}  {}", 100.0, seconds, count, "", "total");
+}
+
+void SyscallTracer::run(const SyscallOptions &options) {
+  numbers = options.numbers;
+  std::sort(numbers.begin(), numbers.end());
+  long ptraceOptions = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACESECCOMP;
+  std::unordered_set<pid_t> threads{pid};
+  int waitStatus;
+  waitpid(pid, &waitStatus, __WALL);
+
+  if (seized) {
+    // An attached process has no filter, every syscall stops it
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, ptraceOptions);
+    auto dir = opendir(("/proc/" + std::to_string(pid) + "/task").c_str());
+    while (dir != nullptr) {
+      auto entry = readdir(dir);
+      if (entry == nullptr) {
+        closedir(dir);
+        break;
+      }
+      pid_t tid = std::atoi(entry->d_name);
+      if (tid > 0 && tid != pid && ptrace(PTRACE_SEIZE, tid, nullptr, ptraceOptions) == 0) {
+        ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+        waitpid(tid, &waitStatus, __WALL);
+        threads.insert(tid);
+      }
+    }
+  } else {
+    // The child stopped itself, the filter is installed once it goes on
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, ptraceOptions | PTRACE_O_EXITKILL);
+    filtered = true;
+  }
+  spdlog::info("Tracing the syscalls of process {}", pid);
+  for (auto tid : threads) {
+    resume(tid);
+  }
+
+  bool checked = seized;
+  while (!threads.empty()) {
+    auto tid = waitpid(-1, &waitStatus, __WALL);
+    if (tid == -1) {
+      spdlog::error("Cannot wait for the process: {}", strerror(errno));
+      break;
+    }
+    if (WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+      if (calls.count(tid) && calls[tid].wanted) {
+        spdlog::info("[{}] {} = ?", tid, calls[tid].text);
+      }
+      calls.erase(tid);
+      threads.erase(tid);
+      memory.forgetThread(tid);
+      if (tid == pid) {
+        spdlog::info("Process {} exited with status {}", pid, WIFEXITED(waitStatus) ? WEXITSTATUS(waitStatus) : -1);
+      }
+      continue;
+    }
+
+    if (!checked) {
+      // The first stop comes after the filter installation, or its failure
+      std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+      std::string line;
+      filtered = false;
+      while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Seccomp:") == 0) {
+          filtered = std::atoi(line.c_str() + 8) == 2;
+        }
+      }
+      if (!filtered) {
+        spdlog::error("No seccomp filter, stopping at every syscall");
+      }
+      checked = true;
+    }
+
+    bool known = !threads.insert(tid).second;
+    auto signal = WSTOPSIG(waitStatus);
+    auto event = waitStatus >> 16;
+    memory.selectThread(tid);
+    if (event == PTRACE_EVENT_SECCOMP) {
+      enter(tid);
+      resume(tid);
+    } else if (signal == (SIGTRAP | 0x80)) {
+      if (calls.count(tid)) {
+        leave(tid);
+      } else {
+        enter(tid);
+      }
+      resume(tid);
+    } else if (event == PTRACE_EVENT_CLONE || signal == SIGTRAP || (!known && (signal == SIGSTOP || event))) {
+      // Clone events, the first stop of new threads and the trap after exec
+      resume(tid);
+    } else {
+      resume(tid, signal);
+    }
+  }
+
+  if (options.summary) {
+    printSummary();
+  }
+}
@@ -0,0 +1,76 @@
+#include "tracebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+TraceBuffer::TraceBuffer(std::size_t capacity) : storage(capacity) {}
+
+void TraceBuffer::copyIn(std::size_t offset, const void *data, std::size_t length) {
+  if (length == 0) {
+    return;
+  }
+  auto bytes = static_cast<const uint8_t *>(data);
+  auto first = std::min(length, storage.size() - offset);
+  std::memcpy(storage.data() + offset, bytes, first);
+  std::memcpy(storage.data(), bytes + first, length - first);
+}
+
+void TraceBuffer::copyOut(std::size_t offset, void *data, std::size_t length) const {
+  if (length == 0) {
+    return;
+  }
+  auto bytes = static_cast<uint8_t *>(data);
+  auto first = std::min(length, storage.size() - offset);
+  std::memcpy(bytes, storage.data() + offset, first);
+  std::memcpy(bytes + first, storage.data(), length - first);
+}
+
+void TraceBuffer::record(unsigned tracepoint, pid_t tid, uint64_t timestamp, const std::vector<int64_t> &values) {
+  Header header{tracepoint, tid, timestamp, static_cast<uint32_t>(values.size())};
+  auto size = sizeof(header) + values.size() * sizeof(int64_t);
+  if (size > storage.size()) {
+    ++dropped;
+    return;
+  }
+
+  // Make room by dropping the oldest records
+  while (used + size > storage.size()) {
+    Header oldest;
+    copyOut(tail, &oldest, sizeof(oldest));
+    auto oldestSize = sizeof(oldest) + oldest.count * sizeof(int64_t);
+    tail = (tail + oldestSize) % storage.size();
+    used -= oldestSize;
+    ++dropped;
+  }
+
+  auto head = (tail + used) % storage.size();
+  copyIn(head, &header, sizeof(header));
+  copyIn((head + sizeof(header)) % storage.size(), values.data(), values.size() * sizeof(int64_t));
+  used += size;
+  ++recorded;
+}
+
+std::vector<TraceRecord> TraceBuffer::decode() const {
+  std::vector<TraceRecord> records;
+  std::size_t offset = tail;
+  std::size_t left = used;
+  while (left > 0) {
+    Header header;
+    copyOut(offset, &header, sizeof(header));
+    TraceRecord record{header.tracepoint, header.tid, header.timestamp, std::vector<int64_t>(header.count)};
+    copyOut((offset + sizeof(header)) % storage.size(), record.values.data(), header.count * sizeof(int64_t));
+    records.push_back(std::move(record));
+
+    auto size = sizeof(header) + header.count * sizeof(int64_t);
+    offset = (offset + size) % storage.size();
+    left -= size;
+  }
+  return records;
+}
+
+void TraceBuffer::clear() {
+  tail = 0;
+  used = 0;
+  recorded = 0;
+  dropped = 0;
+}
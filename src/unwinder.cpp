@@ -0,0 +1,586 @@
+#include "unwinder.h"
+
+#include "instrumentation.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Pointer encodings of `.eh_frame`
+constexpr uint8_t DW_EH_PE_omit = 0xff;
+constexpr uint8_t DW_EH_PE_absptr = 0x00;
+constexpr uint8_t DW_EH_PE_uleb128 = 0x01;
+constexpr uint8_t DW_EH_PE_udata2 = 0x02;
+constexpr uint8_t DW_EH_PE_udata4 = 0x03;
+constexpr uint8_t DW_EH_PE_udata8 = 0x04;
+constexpr uint8_t DW_EH_PE_sleb128 = 0x09;
+constexpr uint8_t DW_EH_PE_sdata2 = 0x0a;
+constexpr uint8_t DW_EH_PE_sdata4 = 0x0b;
+constexpr uint8_t DW_EH_PE_sdata8 = 0x0c;
+constexpr uint8_t DW_EH_PE_pcrel = 0x10;
+
+constexpr unsigned dwarfRSP = 7;
+constexpr unsigned dwarfRBP = 6;
+constexpr unsigned dwarfRA = 16;
+
+/**
+ * @brief A cursor over the bytes of a CFI section
+ *
+ */
+struct Reader {
+  const uint8_t *begin;
+  const uint8_t *position;
+  const uint8_t *end;
+  uint64_t address; /**< virtual address of `begin`, for pc relative pointers */
+
+  void need(std::size_t n) const {
+    if (static_cast<std::size_t>(end - position) < n) {
+      throw std::out_of_range{"Truncated call frame information"};
+    }
+  }
+
+  template <typename T>
+  T fixed() {
+    need(sizeof(T));
+    T value;
+    std::memcpy(&value, position, sizeof(T));
+    position += sizeof(T);
+    return value;
+  }
+
+  uint64_t uleb() {
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+      byte = fixed<uint8_t>();
+      if (shift < 64) {
+        value |= uint64_t{byte & 0x7fu} << shift;
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    return value;
+  }
+
+  int64_t sleb() {
+    int64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+      byte = fixed<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<int64_t>(uint64_t{byte & 0x7fu} << shift);
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40)) {
+      value |= -(int64_t{1} << shift);
+    }
+    return value;
+  }
+
+  const char *string() {
+    auto s = reinterpret_cast<const char *>(position);
+    auto length = strnlen(s, end - position);
+    need(length + 1);
+    position += length + 1;
+    return s;
+  }
+
+  /**
+   * @brief Read a pointer in a `DW_EH_PE_*` encoding
+   *
+   */
+  uint64_t pointer(uint8_t encoding) {
+    auto fieldAddress = address + (position - begin);
+    uint64_t value;
+    switch (encoding & 0x0f) {
+      case DW_EH_PE_absptr:
+        value = fixed<uint64_t>();
+        break;
+      case DW_EH_PE_uleb128:
+        value = uleb();
+        break;
+      case DW_EH_PE_udata2:
+        value = fixed<uint16_t>();
+        break;
+      case DW_EH_PE_udata4:
+        value = fixed<uint32_t>();
+        break;
+      case DW_EH_PE_udata8:
+        value = fixed<uint64_t>();
+        break;
+      case DW_EH_PE_sleb128:
+        value = sleb();
+        break;
+      case DW_EH_PE_sdata2:
+        value = static_cast<int64_t>(fixed<int16_t>());
+        break;
+      case DW_EH_PE_sdata4:
+        value = static_cast<int64_t>(fixed<int32_t>());
+        break;
+      case DW_EH_PE_sdata8:
+        value = fixed<int64_t>();
+        break;
+      default:
+        throw std::out_of_range{"Unknown pointer encoding"};
+    }
+    if ((encoding & 0x70) == DW_EH_PE_pcrel) {
+      value += fieldAddress;
+    }
+    return value;
+  }
+};
+
+}  // namespace
+
+Unwinder::Unwinder(const elf::elf &ef, const IndexFile *index) {
+  if (index && loadIndex(ef, *index)) {
+    spdlog::info("Loaded {} FDEs from the index", fdes.size());
+    return;
+  }
+  for (const auto &section : ef.sections()) {
+    try {
+      if (section.get_name() == ".eh_frame") {
+        parseSection(section, true);
+      } else if (section.get_name() == ".debug_frame") {
+        parseSection(section, false);
+      }
+    } catch (const std::exception &e) {
+      spdlog::error("Cannot parse {}: {}", section.get_name(), e.what());
+    }
+  }
+  std::sort(fdes.begin(), fdes.end(), [](const Fde &a, const Fde &b) { return a.low < b.low; });
+  spdlog::info("Indexed {} FDEs", fdes.size());
+}
+
+bool Unwinder::loadIndex(const elf::elf &ef, const IndexFile &index) {
+  const auto &ehFrame = ef.get_section(".eh_frame");
+  const auto &debugFrame = ef.get_section(".debug_frame");
+  // The instructions are given as offsets in their section
+  auto locate = [&ehFrame, &debugFrame](bool isEhFrame, uint64_t offset, uint64_t length) -> const uint8_t * {
+    const auto &section = isEhFrame ? ehFrame : debugFrame;
+    if (!section.valid() || offset > section.size() || length > section.size() - offset) {
+      return nullptr;
+    }
+    return static_cast<const uint8_t *>(section.data()) + offset;
+  };
+
+  auto indexCies = index.getCies();
+  for (const auto &cie : indexCies) {
+    auto instructions = locate(cie.isEhFrame, cie.instructions, cie.length);
+    if (instructions == nullptr) {
+      cies.clear();
+      return false;
+    }
+    cies.push_back(Cie{cie.codeAlignment,
+                       cie.dataAlignment,
+                       cie.returnAddressRegister,
+                       cie.pointerEncoding,
+                       instructions,
+                       static_cast<std::size_t>(cie.length)});
+  }
+  for (const auto &fde : index.getFdes()) {
+    auto instructions =
+        fde.cie < cies.size() ? locate(indexCies[fde.cie].isEhFrame, fde.instructions, fde.length) : nullptr;
+    if (instructions == nullptr) {
+      cies.clear();
+      fdes.clear();
+      return false;
+    }
+    fdes.push_back(Fde{fde.low, fde.high, static_cast<std::size_t>(fde.cie), instructions, fde.length});
+  }
+  return true;
+}
+
+void Unwinder::exportIndex(const elf::elf &ef, IndexFile::Contents &contents) const {
+  const auto &ehFrame = ef.get_section(".eh_frame");
+  auto ehFrameData = ehFrame.valid() ? static_cast<const uint8_t *>(ehFrame.data()) : nullptr;
+  auto inEhFrame = [ehFrameData, &ehFrame](const uint8_t *p) {
+    return ehFrameData && p >= ehFrameData && p <= ehFrameData + ehFrame.size();
+  };
+  const auto &debugFrame = ef.get_section(".debug_frame");
+  auto debugFrameData = debugFrame.valid() ? static_cast<const uint8_t *>(debugFrame.data()) : nullptr;
+
+  for (const auto &cie : cies) {
+    bool isEhFrame = inEhFrame(cie.instructions);
+    uint64_t offset = cie.instructions - (isEhFrame ? ehFrameData : debugFrameData);
+    contents.cies.push_back(IndexFile::Cie{cie.codeAlignment,
+                                           cie.dataAlignment,
+                                           offset,
+                                           cie.length,
+                                           cie.returnAddressRegister,
+                                           cie.pointerEncoding,
+                                           isEhFrame,
+                                           0});
+  }
+  for (const auto &fde : fdes) {
+    auto base = contents.cies[fde.cie].isEhFrame ? ehFrameData : debugFrameData;
+    uint64_t offset = fde.instructions - base;
+    contents.fdes.push_back(IndexFile::Fde{fde.low, fde.high, fde.cie, offset, fde.length});
+  }
+}
+
+void Unwinder::parseSection(const elf::section &section, bool isEhFrame) {
+  auto data = static_cast<const uint8_t *>(section.data());
+  Reader reader{data, data, data + section.size(), section.get_hdr().addr};
+  std::unordered_map<std::size_t, std::size_t> cieByOffset;
+
+  while (reader.position < reader.end) {
+    auto entryOffset = static_cast<std::size_t>(reader.position - data);
+    uint64_t length = reader.fixed<uint32_t>();
+    if (length == 0) {
+      // The terminator of `.eh_frame`
+      if (isEhFrame) {
+        break;
+      }
+      continue;
+    }
+    bool is64 = length == 0xffffffff;
+    if (is64) {
+      length = reader.fixed<uint64_t>();
+    }
+    reader.need(length);
+    auto entryEnd = reader.position + length;
+    auto idPosition = reader.position;
+    uint64_t id = is64 ? reader.fixed<uint64_t>() : reader.fixed<uint32_t>();
+    bool isCie = isEhFrame ? id == 0 : id == (is64 ? ~uint64_t{0} : 0xffffffff);
+
+    Reader entry{reader.begin, reader.position, entryEnd, reader.address};
+    if (isCie) {
+      Cie cie{};
+      auto version = entry.fixed<uint8_t>();
+      std::string augmentation = entry.string();
+      if (!isEhFrame && version >= 4) {
+        entry.fixed<uint8_t>();  // address size
+        entry.fixed<uint8_t>();  // segment size
+      }
+      cie.codeAlignment = entry.uleb();
+      cie.dataAlignment = entry.sleb();
+      cie.returnAddressRegister = version == 1 ? entry.fixed<uint8_t>() : entry.uleb();
+      cie.pointerEncoding = DW_EH_PE_absptr;
+
+      if (!augmentation.empty() && augmentation[0] == 'z') {
+        auto augmentationLength = entry.uleb();
+        entry.need(augmentationLength);
+        auto augmentationEnd = entry.position + augmentationLength;
+        for (auto c : augmentation.substr(1)) {
+          if (c == 'R') {
+            cie.pointerEncoding = entry.fixed<uint8_t>();
+          } else if (c == 'L') {
+            entry.fixed<uint8_t>();
+          } else if (c == 'P') {
+            entry.pointer(entry.fixed<uint8_t>() & 0x7f);
+          } else if (c != 'S' && c != 'B') {
+            break;
+          }
+        }
+        entry.position = augmentationEnd;
+      }
+      cie.instructions = entry.position;
+      cie.length = entryEnd - entry.position;
+      cieByOffset[entryOffset] = cies.size();
+      cies.push_back(cie);
+    } else {
+      // `.eh_frame` points backwards from the id field, `.debug_frame`
+      // gives the offset from the start of the section
+      auto cieOffset = isEhFrame ? static_cast<std::size_t>(idPosition - data) - id : id;
+      auto cie = cieByOffset.find(cieOffset);
+      if (cie == cieByOffset.end()) {
+        reader.position = entryEnd;
+        continue;
+      }
+      auto encoding = cies[cie->second].pointerEncoding;
+      if (encoding == DW_EH_PE_omit) {
+        encoding = DW_EH_PE_absptr;
+      }
+      Fde fde{};
+      fde.cie = cie->second;
+      fde.low = entry.pointer(encoding);
+      fde.high = fde.low + entry.pointer(encoding & 0x0f);
+      // Augmentation data of the FDE
+      if (isEhFrame) {
+        auto augmentationLength = entry.uleb();
+        entry.need(augmentationLength);
+        entry.position += augmentationLength;
+      }
+      fde.instructions = entry.position;
+      fde.length = entryEnd - entry.position;
+      if (fde.low != 0) {
+        fdes.push_back(fde);
+      }
+    }
+    reader.position = entryEnd;
+  }
+}
+
+const std::vector<Unwinder::Row> &Unwinder::getRows(std::size_t index) {
+  auto cached = rowCache.find(index);
+  if (cached != rowCache.end()) {
+    return cached->second;
+  }
+
+  const auto &fde = fdes[index];
+  const auto &cie = cies[fde.cie];
+  std::vector<Row> rows;
+
+  Row row{};
+  row.location = fde.low;
+  row.cfaSupported = true;
+  for (auto &rule : row.rules) {
+    rule = Rule{RuleType::sameValue, 0};
+  }
+  Row initial = row;
+  std::vector<Row> stack; /**< remember_state and restore_state */
+
+  auto setRule = [&row](uint64_t reg, Rule rule) {
+    if (reg < Frame::registersNumber) {
+      row.rules[reg] = rule;
+    }
+  };
+  auto restoreRule = [&row, &initial](uint64_t reg) {
+    if (reg < Frame::registersNumber) {
+      row.rules[reg] = initial.rules[reg];
+    }
+  };
+
+  auto run = [&](const uint8_t *instructions, std::size_t length, bool isCie) {
+    Reader reader{instructions, instructions, instructions + length, 0};
+    while (reader.position < reader.end) {
+      auto opcode = reader.fixed<uint8_t>();
+      auto operand = opcode & 0x3f;
+      switch (opcode & 0xc0) {
+        case 0x40:  // DW_CFA_advance_loc
+          rows.push_back(row);
+          row.location += operand * cie.codeAlignment;
+          continue;
+        case 0x80:  // DW_CFA_offset
+          setRule(operand, Rule{RuleType::offset, static_cast<int64_t>(reader.uleb()) * cie.dataAlignment});
+          continue;
+        case 0xc0:  // DW_CFA_restore
+          restoreRule(operand);
+          continue;
+        default:
+          break;
+      }
+
+      switch (opcode) {
+        case 0x00:  // DW_CFA_nop
+          break;
+        case 0x01:  // DW_CFA_set_loc
+          rows.push_back(row);
+          row.location = reader.pointer(cie.pointerEncoding & 0x0f);
+          break;
+        case 0x02:  // DW_CFA_advance_loc1
+          rows.push_back(row);
+          row.location += reader.fixed<uint8_t>() * cie.codeAlignment;
+          break;
+        case 0x03:  // DW_CFA_advance_loc2
+          rows.push_back(row);
+          row.location += reader.fixed<uint16_t>() * cie.codeAlignment;
+          break;
+        case 0x04:  // DW_CFA_advance_loc4
+          rows.push_back(row);
+          row.location += reader.fixed<uint32_t>() * cie.codeAlignment;
+          break;
+        case 0x05: {  // DW_CFA_offset_extended
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::offset, static_cast<int64_t>(reader.uleb()) * cie.dataAlignment});
+          break;
+        }
+        case 0x06:  // DW_CFA_restore_extended
+          restoreRule(reader.uleb());
+          break;
+        case 0x07:  // DW_CFA_undefined
+          setRule(reader.uleb(), Rule{RuleType::undefined, 0});
+          break;
+        case 0x08:  // DW_CFA_same_value
+          setRule(reader.uleb(), Rule{RuleType::sameValue, 0});
+          break;
+        case 0x09: {  // DW_CFA_register
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::reg, static_cast<int64_t>(reader.uleb())});
+          break;
+        }
+        case 0x0a:  // DW_CFA_remember_state
+          stack.push_back(row);
+          break;
+        case 0x0b:  // DW_CFA_restore_state
+          if (!stack.empty()) {
+            auto location = row.location;
+            row = stack.back();
+            row.location = location;
+            stack.pop_back();
+          }
+          break;
+        case 0x0c:  // DW_CFA_def_cfa
+          row.cfaRegister = reader.uleb();
+          row.cfaOffset = reader.uleb();
+          row.cfaSupported = true;
+          break;
+        case 0x0d:  // DW_CFA_def_cfa_register
+          row.cfaRegister = reader.uleb();
+          break;
+        case 0x0e:  // DW_CFA_def_cfa_offset
+          row.cfaOffset = reader.uleb();
+          break;
+        case 0x0f: {  // DW_CFA_def_cfa_expression
+          auto size = reader.uleb();
+          reader.need(size);
+          reader.position += size;
+          row.cfaSupported = false;
+          break;
+        }
+        case 0x10:    // DW_CFA_expression
+        case 0x16: {  // DW_CFA_val_expression
+          auto reg = reader.uleb();
+          auto size = reader.uleb();
+          reader.need(size);
+          reader.position += size;
+          setRule(reg, Rule{RuleType::unsupported, 0});
+          break;
+        }
+        case 0x11: {  // DW_CFA_offset_extended_sf
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::offset, reader.sleb() * cie.dataAlignment});
+          break;
+        }
+        case 0x12:  // DW_CFA_def_cfa_sf
+          row.cfaRegister = reader.uleb();
+          row.cfaOffset = reader.sleb() * cie.dataAlignment;
+          row.cfaSupported = true;
+          break;
+        case 0x13:  // DW_CFA_def_cfa_offset_sf
+          row.cfaOffset = reader.sleb() * cie.dataAlignment;
+          break;
+        case 0x14: {  // DW_CFA_val_offset
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::valOffset, static_cast<int64_t>(reader.uleb()) * cie.dataAlignment});
+          break;
+        }
+        case 0x15: {  // DW_CFA_val_offset_sf
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::valOffset, reader.sleb() * cie.dataAlignment});
+          break;
+        }
+        case 0x2e:  // DW_CFA_GNU_args_size
+          reader.uleb();
+          break;
+        case 0x2f: {  // DW_CFA_GNU_negative_offset_extended
+          auto reg = reader.uleb();
+          setRule(reg, Rule{RuleType::offset, -static_cast<int64_t>(reader.uleb()) * cie.dataAlignment});
+          break;
+        }
+        default:
+          throw std::out_of_range{"Unknown CFA instruction"};
+      }
+    }
+    if (isCie) {
+      initial = row;
+    }
+  };
+
+  try {
+    run(cie.instructions, cie.length, true);
+    run(fde.instructions, fde.length, false);
+    rows.push_back(row);
+  } catch (const std::exception &e) {
+    spdlog::error("Cannot run the CFA program at 0x{:x}: {}", fde.low, e.what());
+    rows.clear();
+  }
+  return rowCache[index] = std::move(rows);
+}
+
+const Unwinder::Row *Unwinder::findRow(uint64_t pc) {
+  auto it = std::upper_bound(fdes.begin(), fdes.end(), pc, [](uint64_t p, const Fde &f) { return p < f.low; });
+  if (it == fdes.begin() || pc >= (it - 1)->high) {
+    return nullptr;
+  }
+  const auto &rows = getRows(it - 1 - fdes.begin());
+  auto row = std::upper_bound(rows.begin(), rows.end(), pc, [](uint64_t p, const Row &r) { return p < r.location; });
+  if (row == rows.begin()) {
+    return nullptr;
+  }
+  return &*(row - 1);
+}
+
+bool Unwinder::covers(uint64_t pc) {
+  Instrumentation::Scope scope{Phase::dwarf, "Unwinder::covers"};
+  return findRow(pc) != nullptr;
+}
+
+Frame Unwinder::currentFrame(Memory &memory) {
+  Frame frame;
+  for (unsigned reg = 0; reg < dwarfRA; ++reg) {
+    frame.regs[reg] = memory.getRegisterValueFromDwarfRegister(reg);
+    frame.valid[reg] = true;
+  }
+  frame.pc = memory.getPC();
+  frame.regs[dwarfRA] = frame.pc;
+  frame.valid[dwarfRA] = true;
+  return frame;
+}
+
+bool Unwinder::unwind(Memory &memory, uint64_t loadBias, const Frame &callee, Frame &caller) {
+  Instrumentation::Scope scope{Phase::dwarf, "Unwinder::unwind"};
+  // A return address points after the call, which may already be
+  // another function or row, so callers are looked up at pc - 1
+  auto lookup = callee.pc - loadBias - (callee.depth == 0 ? 0 : 1);
+  auto row = findRow(lookup);
+
+  caller = callee;
+  caller.depth = callee.depth + 1;
+  uint64_t cfa;
+  if (row && row->cfaSupported && row->cfaRegister < Frame::registersNumber && callee.valid[row->cfaRegister]) {
+    cfa = callee.regs[row->cfaRegister] + row->cfaOffset;
+    for (unsigned reg = 0; reg < Frame::registersNumber; ++reg) {
+      const auto &rule = row->rules[reg];
+      switch (rule.type) {
+        case RuleType::sameValue:
+          break;
+        case RuleType::undefined:
+        case RuleType::unsupported:
+          caller.valid[reg] = false;
+          break;
+        case RuleType::offset:
+          caller.regs[reg] = memory.readMemory(cfa + rule.value);
+          caller.valid[reg] = true;
+          break;
+        case RuleType::valOffset:
+          caller.regs[reg] = cfa + rule.value;
+          caller.valid[reg] = true;
+          break;
+        case RuleType::reg:
+          caller.regs[reg] = rule.value < Frame::registersNumber ? callee.regs[rule.value] : 0;
+          caller.valid[reg] = rule.value < Frame::registersNumber && callee.valid[rule.value];
+          break;
+      }
+    }
+    if (row->rules[dwarfRA].type == RuleType::sameValue) {
+      // Without a rule the return address cannot be recovered
+      return false;
+    }
+  } else if (callee.valid[dwarfRBP] && callee.regs[dwarfRBP] != 0) {
+    // No CFI for this PC, fall back to the frame pointer chain
+    auto framePointer = callee.regs[dwarfRBP];
+    cfa = framePointer + 16;
+    caller.regs[dwarfRA] = memory.readMemory(framePointer + 8);
+    caller.regs[dwarfRBP] = memory.readMemory(framePointer);
+    caller.valid[dwarfRA] = true;
+  } else {
+    return false;
+  }
+
+  // The stack only grows downwards, anything else is garbage
+  if (!caller.valid[dwarfRA] || caller.regs[dwarfRA] == 0 ||
+      (callee.valid[dwarfRSP] && cfa <= callee.regs[dwarfRSP])) {
+    return false;
+  }
+  caller.regs[dwarfRSP] = cfa;
+  caller.valid[dwarfRSP] = true;
+  caller.pc = caller.regs[dwarfRA];
+  return true;
+}